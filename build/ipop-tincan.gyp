@@ -74,6 +74,7 @@
       'dependencies': [
         'libjingle.gyp:libjingle_p2p',
         '<(DEPTH)/third_party/jsoncpp/jsoncpp.gyp:jsoncpp',
+        '<(DEPTH)/third_party/zlib/zlib.gyp:zlib',
       ],
       'conditions': [
         ['OS=="linux" or OS=="android"', {
@@ -106,12 +107,40 @@
       ],
       'sources': [
         'ipop-project/ipop-tincan/src/tincan.cc',
+        'ipop-project/ipop-tincan/src/candidatecache.cc',
+        'ipop-project/ipop-tincan/src/candidatecache.h',
+        'ipop-project/ipop-tincan/src/candidatecodec.cc',
+        'ipop-project/ipop-tincan/src/candidatecodec.h',
         'ipop-project/ipop-tincan/src/tincanconnectionmanager.cc',
         'ipop-project/ipop-tincan/src/tincanconnectionmanager.h',
         'ipop-project/ipop-tincan/src/xmppnetwork.cc',
         'ipop-project/ipop-tincan/src/xmppnetwork.h',
         'ipop-project/ipop-tincan/src/controlleraccess.cc',
         'ipop-project/ipop-tincan/src/controlleraccess.h',
+        'ipop-project/ipop-tincan/src/fec.cc',
+        'ipop-project/ipop-tincan/src/fec.h',
+        'ipop-project/ipop-tincan/src/grouptable.cc',
+        'ipop-project/ipop-tincan/src/grouptable.h',
+        'ipop-project/ipop-tincan/src/linkstats.cc',
+        'ipop-project/ipop-tincan/src/linkstats.h',
+        'ipop-project/ipop-tincan/src/neighborcache.cc',
+        'ipop-project/ipop-tincan/src/neighborcache.h',
+        'ipop-project/ipop-tincan/src/packetclassifier.cc',
+        'ipop-project/ipop-tincan/src/packetclassifier.h',
+        'ipop-project/ipop-tincan/src/peerdirectory.cc',
+        'ipop-project/ipop-tincan/src/peerdirectory.h',
+        'ipop-project/ipop-tincan/src/sharedsocketfactory.cc',
+        'ipop-project/ipop-tincan/src/sharedsocketfactory.h',
+        'ipop-project/ipop-tincan/src/signalcompression.cc',
+        'ipop-project/ipop-tincan/src/signalcompression.h',
+        'ipop-project/ipop-tincan/src/streammanagement.cc',
+        'ipop-project/ipop-tincan/src/streammanagement.h',
+        'ipop-project/ipop-tincan/src/tincanchannel.cc',
+        'ipop-project/ipop-tincan/src/tincanchannel.h',
+        'ipop-project/ipop-tincan/src/tincanidentity.cc',
+        'ipop-project/ipop-tincan/src/tincanidentity.h',
+        'ipop-project/ipop-tincan/src/tokenbucket.cc',
+        'ipop-project/ipop-tincan/src/tokenbucket.h',
         'ipop-project/ipop-tincan/src/tincanxmppsocket.cc',
         'ipop-project/ipop-tincan/src/tincanxmppsocket.h',
         'ipop-project/ipop-tincan/src/tincan_utils.h',
@@ -120,5 +149,53 @@
         'xmpp/jingleinfotask.h',
       ],
     },  # target ipop-tincan
+    {
+      'target_name': 'ipop-tincan_unittest',
+      'type': 'executable',
+      'cflags' : [
+        '-Wall',
+      ],
+      'dependencies': [
+        'libjingle.gyp:libjingle_p2p',
+        '<(DEPTH)/third_party/jsoncpp/jsoncpp.gyp:jsoncpp',
+        '<(DEPTH)/third_party/zlib/zlib.gyp:zlib',
+        '<(DEPTH)/testing/gtest.gyp:gtest',
+        '<(DEPTH)/testing/gtest.gyp:gtest_main',
+      ],
+      'include_dirs': [
+        '<(DEPTH)/testing/gtest/include',
+      ],
+      'sources': [
+        'ipop-project/ipop-tincan/src/candidatecodec.cc',
+        'ipop-project/ipop-tincan/src/candidatecodec.h',
+        'ipop-project/ipop-tincan/src/candidatecodec_unittest.cc',
+        'ipop-project/ipop-tincan/src/fec.cc',
+        'ipop-project/ipop-tincan/src/fec.h',
+        'ipop-project/ipop-tincan/src/fec_unittest.cc',
+        'ipop-project/ipop-tincan/src/grouptable.cc',
+        'ipop-project/ipop-tincan/src/grouptable.h',
+        'ipop-project/ipop-tincan/src/grouptable_unittest.cc',
+        'ipop-project/ipop-tincan/src/linkstats.cc',
+        'ipop-project/ipop-tincan/src/linkstats.h',
+        'ipop-project/ipop-tincan/src/linkstats_unittest.cc',
+        'ipop-project/ipop-tincan/src/neighborcache.cc',
+        'ipop-project/ipop-tincan/src/neighborcache.h',
+        'ipop-project/ipop-tincan/src/neighborcache_unittest.cc',
+        'ipop-project/ipop-tincan/src/packetclassifier.cc',
+        'ipop-project/ipop-tincan/src/packetclassifier.h',
+        'ipop-project/ipop-tincan/src/packetclassifier_unittest.cc',
+        'ipop-project/ipop-tincan/src/signalcompression.cc',
+        'ipop-project/ipop-tincan/src/signalcompression.h',
+        'ipop-project/ipop-tincan/src/signalcompression_unittest.cc',
+        'ipop-project/ipop-tincan/src/streammanagement.cc',
+        'ipop-project/ipop-tincan/src/streammanagement.h',
+        'ipop-project/ipop-tincan/src/streammanagement_unittest.cc',
+        'ipop-project/ipop-tincan/src/tincan_utils.cc',
+        'ipop-project/ipop-tincan/src/tincan_utils.h',
+        'ipop-project/ipop-tincan/src/tokenbucket.cc',
+        'ipop-project/ipop-tincan/src/tokenbucket.h',
+        'ipop-project/ipop-tincan/src/tokenbucket_unittest.cc',
+      ],
+    },  # target ipop-tincan_unittest
   ],
 }
@@ -0,0 +1,82 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "talk/base/timeutils.h"
+#include "talk/p2p/base/port.h"
+
+#include "candidatecache.h"
+
+namespace tincan {
+
+CandidateCache::CandidateCache(uint32 ttl)
+    : ttl_(ttl),
+      hits_(0),
+      misses_(0) {
+}
+
+void CandidateCache::Add(const std::string& stun_server,
+                         const cricket::Candidate& candidate) {
+  if (ttl_ == 0 || candidate.type() != cricket::STUN_PORT_TYPE) return;
+
+  // the related address of a reflexive candidate is the local socket it
+  // was gathered on
+  Entry& entry =
+      entries_[stun_server][candidate.related_address().ToString()];
+  entry.candidate = candidate;
+  entry.time = talk_base::Time();
+}
+
+bool CandidateCache::Lookup(const std::string& stun_server,
+                            cricket::Candidates* candidates) {
+  if (ttl_ == 0) return false;
+  std::map<std::string, std::map<std::string, Entry> >::iterator it =
+      entries_.find(stun_server);
+  if (it == entries_.end()) {
+    misses_++;
+    return false;
+  }
+
+  // expired entries are dropped, the next link to miss the cache gathers
+  // candidates from the network again and refreshes them
+  uint32 now = talk_base::Time();
+  std::map<std::string, Entry>& entries = it->second;
+  for (std::map<std::string, Entry>::iterator eit = entries.begin();
+       eit != entries.end();) {
+    if (talk_base::TimeDiff(now, eit->second.time) > static_cast<int>(ttl_)) {
+      entries.erase(eit++);
+    }
+    else {
+      candidates->push_back(eit->second.candidate);
+      ++eit;
+    }
+  }
+  if (entries.empty()) {
+    entries_.erase(it);
+    misses_++;
+    return false;
+  }
+  hits_++;
+  return true;
+}
+
+}  // namespace tincan
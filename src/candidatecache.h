@@ -0,0 +1,79 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_CANDIDATECACHE_H_
+#define TINCAN_CANDIDATECACHE_H_
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "talk/base/basictypes.h"
+#include "talk/p2p/base/candidate.h"
+
+namespace tincan {
+
+// CandidateCache remembers the server reflexive candidates learned through
+// a STUN server for a given local socket. When all links share one socket
+// per interface these candidates are the same for every peer, so new links
+// can signal them right away instead of querying the server again. Relay
+// candidates are not cached, a TURN allocation belongs to the socket of a
+// single link.
+class CandidateCache {
+ public:
+  explicit CandidateCache(uint32 ttl);
+
+  // ttl is in ms, a ttl of 0 disables the cache
+  void set_ttl(uint32 ttl) { ttl_ = ttl; }
+
+  uint32 hits() const { return hits_; }
+
+  uint32 misses() const { return misses_; }
+
+  void ResetCounters() { hits_ = misses_ = 0; }
+
+  void Add(const std::string& stun_server,
+           const cricket::Candidate& candidate);
+
+  // returns false unless at least one fresh candidate was found
+  bool Lookup(const std::string& stun_server,
+              cricket::Candidates* candidates);
+
+  void Clear() { entries_.clear(); }
+
+ private:
+  struct Entry {
+    cricket::Candidate candidate;
+    uint32 time;
+  };
+
+  uint32 ttl_;
+  uint32 hits_;
+  uint32 misses_;
+  // stun server -> local socket -> entry
+  std::map<std::string, std::map<std::string, Entry> > entries_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_CANDIDATECACHE_H_
@@ -0,0 +1,368 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/base64.h"
+#include "talk/base/bytebuffer.h"
+#include "talk/base/ipaddress.h"
+#include "talk/base/socketaddress.h"
+#include "talk/base/stringencode.h"
+#include "talk/p2p/base/constants.h"
+#include "talk/p2p/base/port.h"
+
+#include "candidatecodec.h"
+
+namespace tincan {
+
+static const char kBinaryPrefix[] = "b1.";
+static const size_t kBinaryPrefixLen = sizeof(kBinaryPrefix) - 1;
+static const size_t kTextFields = 12;
+static const size_t kMaxString = 255;
+// fixed part of a record, flags through foundation
+static const size_t kRecordHeaderLen = 14;
+static const uint8 kFlagIpv6 = 0x01;
+static const int kProtocolShift = 1;
+static const int kTypeShift = 3;
+static const uint8 kFieldMask = 0x03;
+static const uint8 kTypeMask = 0x07;
+
+// the position in these tables is the value sent on the wire
+static const char* const kProtocols[] = {
+  cricket::UDP_PROTOCOL_NAME,
+  cricket::TCP_PROTOCOL_NAME,
+  cricket::SSLTCP_PROTOCOL_NAME,
+};
+static const char* const kTypes[] = {
+  cricket::LOCAL_PORT_TYPE,
+  cricket::STUN_PORT_TYPE,
+  cricket::PRFLX_PORT_TYPE,
+  cricket::RELAY_PORT_TYPE,
+};
+
+static const size_t kProtocolCount =
+    sizeof(kProtocols) / sizeof(kProtocols[0]);
+static const size_t kTypeCount = sizeof(kTypes) / sizeof(kTypes[0]);
+
+static int IndexOf(const char* const* table, size_t size,
+                   const std::string& value) {
+  for (size_t i = 0; i < size; i++) {
+    if (value == table[i]) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+// parses a decimal number that fills the whole field
+static bool ParseUint(const char* data, size_t len, uint32* value) {
+  if (len == 0 || len > 10) return false;
+  uint64 result = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] < '0' || data[i] > '9') return false;
+    result = result * 10 + (data[i] - '0');
+  }
+  if (result > 0xFFFFFFFFULL) return false;
+  *value = static_cast<uint32>(result);
+  return true;
+}
+
+static int Base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+// decodes base64 straight into the output buffer, padding is optional
+static bool Base64Decode(const char* data, size_t len, uint8* out,
+                         size_t out_size, size_t* out_len) {
+  while (len > 0 && data[len - 1] == '=') len--;
+  uint32 bits = 0;
+  int nbits = 0;
+  size_t pos = 0;
+  for (size_t i = 0; i < len; i++) {
+    int value = Base64Value(data[i]);
+    if (value < 0) return false;
+    bits = (bits << 6) | value;
+    nbits += 6;
+    if (nbits >= 8) {
+      nbits -= 8;
+      if (pos == out_size) return false;
+      out[pos++] = static_cast<uint8>(bits >> nbits);
+    }
+  }
+  *out_len = pos;
+  return true;
+}
+
+static uint16 GetBE16(const uint8* data) {
+  return static_cast<uint16>((data[0] << 8) | data[1]);
+}
+
+static uint32 GetBE32(const uint8* data) {
+  return (static_cast<uint32>(data[0]) << 24) |
+         (static_cast<uint32>(data[1]) << 16) |
+         (static_cast<uint32>(data[2]) << 8) | data[3];
+}
+
+CandidateFormat CandidateFormatFromString(const std::string& format) {
+  if (format == "binary") return CANDIDATE_FORMAT_BINARY;
+  if (format == "auto") return CANDIDATE_FORMAT_AUTO;
+  return CANDIDATE_FORMAT_TEXT;
+}
+
+bool IsBinaryCandidates(const char* token, size_t len) {
+  return len > kBinaryPrefixLen &&
+         memcmp(token, kBinaryPrefix, kBinaryPrefixLen) == 0;
+}
+
+bool IsBinaryCapability(const char* token, size_t len) {
+  return len == sizeof(kBinaryCapability) - 1 &&
+         memcmp(token, kBinaryCapability, len) == 0;
+}
+
+// appends the record of one candidate, returns false if the candidate
+// cannot be represented in the binary format
+static bool EncodeRecord(const cricket::Candidate& candidate,
+                         talk_base::ByteBuffer* buffer) {
+  int protocol = IndexOf(kProtocols, kProtocolCount, candidate.protocol());
+  int type = IndexOf(kTypes, kTypeCount, candidate.type());
+  uint32 foundation;
+  // the text format only carries the interface name
+  std::string network = candidate.network_name().substr(
+      0, candidate.network_name().find(' '));
+  if (protocol < 0 || type < 0 || candidate.generation() > 0xFFFF ||
+      candidate.component() > 0xFF || network.size() > kMaxString ||
+      !ParseUint(candidate.foundation().data(), candidate.foundation().size(),
+                 &foundation) ||
+      talk_base::ToString(foundation) != candidate.foundation()) {
+    return false;
+  }
+
+  const talk_base::IPAddress& ip = candidate.address().ipaddr();
+  uint8 flags = static_cast<uint8>((protocol << kProtocolShift) |
+                                   (type << kTypeShift));
+  if (ip.family() == AF_INET6) flags |= kFlagIpv6;
+  else if (ip.family() != AF_INET) return false;
+  buffer->WriteUInt8(flags);
+  buffer->WriteUInt8(static_cast<uint8>(candidate.component()));
+  buffer->WriteUInt16(candidate.address().port());
+  buffer->WriteUInt32(candidate.priority());
+  buffer->WriteUInt16(static_cast<uint16>(candidate.generation()));
+  buffer->WriteUInt32(foundation);
+  if (ip.family() == AF_INET6) {
+    in6_addr addr = ip.ipv6_address();
+    buffer->WriteBytes(reinterpret_cast<const char*>(&addr), sizeof(addr));
+  }
+  else {
+    in_addr addr = ip.ipv4_address();
+    buffer->WriteBytes(reinterpret_cast<const char*>(&addr), sizeof(addr));
+  }
+  buffer->WriteUInt8(static_cast<uint8>(network.size()));
+  buffer->WriteString(network);
+  return true;
+}
+
+static void AppendBatch(const std::string& header, uint8 count,
+                        const std::string& records, std::string* tokens) {
+  talk_base::ByteBuffer buffer;
+  buffer.WriteString(header);
+  buffer.WriteUInt8(count);
+  buffer.WriteString(records);
+  std::string encoded;
+  talk_base::Base64::EncodeFromArray(buffer.Data(), buffer.Length(), &encoded);
+  if (!tokens->empty()) *tokens += " ";
+  *tokens += kBinaryPrefix + encoded;
+}
+
+bool EncodeCandidates(const cricket::Candidates& candidates,
+                      std::string* tokens) {
+  if (candidates.empty()) return false;
+  const std::string& username = candidates[0].username();
+  const std::string& password = candidates[0].password();
+  if (username.size() > kMaxString || password.size() > kMaxString) {
+    return false;
+  }
+  std::string header;
+  header += static_cast<char>(username.size());
+  header += username;
+  header += static_cast<char>(password.size());
+  header += password;
+
+  // records are collected until the next one would push the decoded batch
+  // over the limit or the count over 255, then a batch is closed
+  std::string result;
+  std::string records;
+  uint8 count = 0;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    const cricket::Candidate& candidate = candidates[i];
+    if (candidate.username() != username ||
+        candidate.password() != password) return false;
+    talk_base::ByteBuffer record;
+    if (!EncodeRecord(candidate, &record)) return false;
+    if (header.size() + 1 + record.Length() > kMaxCandidatePayload) {
+      return false;
+    }
+    if (count == 0xFF || header.size() + 1 + records.size() +
+        record.Length() > kMaxCandidatePayload) {
+      AppendBatch(header, count, records, &result);
+      records.clear();
+      count = 0;
+    }
+    records.append(record.Data(), record.Length());
+    count++;
+  }
+  AppendBatch(header, count, records, &result);
+  tokens->swap(result);
+  return true;
+}
+
+bool ParseTextCandidate(const char* token, size_t len,
+                        cricket::Candidate* candidate) {
+  // the fields point into the token, like the old split based parser any
+  // fields beyond the twelfth one are ignored
+  const char* fields[kTextFields];
+  size_t lens[kTextFields];
+  size_t count = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= len && count < kTextFields; i++) {
+    if (i == len || token[i] == ':') {
+      fields[count] = token + start;
+      lens[count] = i - start;
+      count++;
+      start = i + 1;
+    }
+  }
+  if (count < kTextFields) return false;
+
+  uint32 component, port, priority, generation;
+  if (!ParseUint(fields[1], lens[1], &component) ||
+      !ParseUint(fields[4], lens[4], &port) ||
+      !ParseUint(fields[5], lens[5], &priority) ||
+      !ParseUint(fields[10], lens[10], &generation)) {
+    return false;
+  }
+  talk_base::IPAddress ip;
+  if (!talk_base::IPFromString(std::string(fields[3], lens[3]), &ip)) {
+    return false;
+  }
+  *candidate = cricket::Candidate(
+      std::string(fields[0], lens[0]), component,
+      std::string(fields[2], lens[2]), talk_base::SocketAddress(ip, port),
+      priority, std::string(fields[6], lens[6]),
+      std::string(fields[7], lens[7]), std::string(fields[8], lens[8]),
+      std::string(fields[9], lens[9]), generation,
+      std::string(fields[11], lens[11]));
+  return true;
+}
+
+CandidateDecoder::CandidateDecoder()
+    : size_(0),
+      pos_(0),
+      count_(0),
+      index_(0),
+      username_(NULL),
+      username_len_(0),
+      password_(NULL),
+      password_len_(0) {
+}
+
+bool CandidateDecoder::Read(size_t len, const uint8** data) {
+  if (size_ - pos_ < len) return false;
+  *data = buffer_ + pos_;
+  pos_ += len;
+  return true;
+}
+
+bool CandidateDecoder::Init(const char* token, size_t len) {
+  size_ = pos_ = count_ = index_ = 0;
+  if (!IsBinaryCandidates(token, len) ||
+      !Base64Decode(token + kBinaryPrefixLen, len - kBinaryPrefixLen,
+                    buffer_, kMaxCandidatePayload, &size_)) {
+    return false;
+  }
+  const uint8* data;
+  if (!Read(1, &data)) return false;
+  username_len_ = data[0];
+  if (!Read(username_len_, &data)) return false;
+  username_ = reinterpret_cast<const char*>(data);
+  if (!Read(1, &data)) return false;
+  password_len_ = data[0];
+  if (!Read(password_len_, &data)) return false;
+  password_ = reinterpret_cast<const char*>(data);
+  if (!Read(1, &data)) return false;
+  count_ = data[0];
+  return true;
+}
+
+bool CandidateDecoder::Next(CandidateRecord* record) {
+  const uint8* data;
+  if (index_ == count_ || !Read(kRecordHeaderLen, &data)) return false;
+  uint8 flags = data[0];
+  record->ipv6 = (flags & kFlagIpv6) != 0;
+  record->protocol = (flags >> kProtocolShift) & kFieldMask;
+  record->type = (flags >> kTypeShift) & kTypeMask;
+  record->component = data[1];
+  record->port = GetBE16(data + 2);
+  record->priority = GetBE32(data + 4);
+  record->generation = GetBE16(data + 8);
+  record->foundation = GetBE32(data + 10);
+  if (record->protocol >= kProtocolCount ||
+      record->type >= kTypeCount) return false;
+  if (!Read(record->ipv6 ? sizeof(in6_addr) : sizeof(in_addr),
+            &record->address)) return false;
+  if (!Read(1, &data)) return false;
+  record->network_len = data[0];
+  if (!Read(record->network_len, &data)) return false;
+  record->network = reinterpret_cast<const char*>(data);
+  index_++;
+  return true;
+}
+
+void CandidateDecoder::ToCandidate(const CandidateRecord& record,
+                                   cricket::Candidate* candidate) const {
+  talk_base::IPAddress ip;
+  if (record.ipv6) {
+    in6_addr addr;
+    memcpy(&addr, record.address, sizeof(addr));
+    ip = talk_base::IPAddress(addr);
+  }
+  else {
+    in_addr addr;
+    memcpy(&addr, record.address, sizeof(addr));
+    ip = talk_base::IPAddress(addr);
+  }
+  std::string foundation = talk_base::ToString(record.foundation);
+  // the candidate id is not used for remote candidates, the foundation
+  // keeps it unique enough for logging
+  *candidate = cricket::Candidate(
+      foundation, record.component, kProtocols[record.protocol],
+      talk_base::SocketAddress(ip, record.port), record.priority,
+      std::string(username_, username_len_),
+      std::string(password_, password_len_), kTypes[record.type],
+      std::string(record.network, record.network_len), record.generation,
+      foundation);
+}
+
+}  // namespace tincan
@@ -0,0 +1,135 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_CANDIDATECODEC_H_
+#define TINCAN_CANDIDATECODEC_H_
+#pragma once
+
+#include <string>
+
+#include "talk/base/basictypes.h"
+#include "talk/p2p/base/candidate.h"
+
+namespace tincan {
+
+// Binary candidate batches are sent as a single token "b1.<base64>" in
+// place of the colon delimited text candidates. The payload is
+//
+//   ufrag_len(1) ufrag password_len(1) password count(1)
+//
+// followed by count records of
+//
+//   flags(1) component(1) port(2) priority(4) generation(2) foundation(4)
+//   address(4 or 16) network_len(1) network
+//
+// with all integers in network byte order. flags holds the address family
+// in bit 0, the protocol in bits 1-2 and the candidate type in bits 3-5.
+// The ICE credentials are the same for every candidate of a link so they
+// are only sent once per batch.
+
+// decoded size limit of a single batch, larger candidate sets are split
+static const size_t kMaxCandidatePayload = 2048;
+
+// peers in auto mode add this token to text candidates to advertise that
+// they decode binary batches, older peers skip it like any token with
+// fewer than twelve fields
+static const char kBinaryCapability[] = "b1";
+
+// which format is used to signal local candidates, text is understood by
+// every peer, auto answers in binary to peers that signal in binary or
+// advertise kBinaryCapability
+enum CandidateFormat {
+  CANDIDATE_FORMAT_TEXT = 0,
+  CANDIDATE_FORMAT_BINARY = 1,
+  CANDIDATE_FORMAT_AUTO = 2,
+};
+
+CandidateFormat CandidateFormatFromString(const std::string& format);
+
+// returns true if the token holds a binary candidate batch
+bool IsBinaryCandidates(const char* token, size_t len);
+
+// returns true if the token is kBinaryCapability
+bool IsBinaryCapability(const char* token, size_t len);
+
+// encodes the candidates into space delimited binary tokens, each batch
+// stays within kMaxCandidatePayload. Returns false if one of them cannot
+// be represented (e.g. a non numeric foundation) so that the caller can
+// fall back to the text format.
+bool EncodeCandidates(const cricket::Candidates& candidates,
+                      std::string* tokens);
+
+// parses one colon delimited text candidate without intermediate strings
+bool ParseTextCandidate(const char* token, size_t len,
+                        cricket::Candidate* candidate);
+
+// CandidateRecord points into the buffer of the decoder that produced it
+struct CandidateRecord {
+  bool ipv6;
+  const uint8* address;
+  uint16 port;
+  uint8 component;
+  uint8 protocol;
+  uint8 type;
+  uint32 priority;
+  uint16 generation;
+  uint32 foundation;
+  const char* network;
+  size_t network_len;
+};
+
+// CandidateDecoder decodes a binary batch into a fixed buffer and walks the
+// records in place, it never allocates
+class CandidateDecoder {
+ public:
+  CandidateDecoder();
+
+  // returns false if the token is not a valid binary batch
+  bool Init(const char* token, size_t len);
+
+  // returns false when there are no more records or the batch is truncated
+  bool Next(CandidateRecord* record);
+
+  // builds a libjingle candidate from a record of this batch
+  void ToCandidate(const CandidateRecord& record,
+                   cricket::Candidate* candidate) const;
+
+  size_t count() const { return count_; }
+
+ private:
+  bool Read(size_t len, const uint8** data);
+
+  uint8 buffer_[kMaxCandidatePayload];
+  size_t size_;
+  size_t pos_;
+  size_t count_;
+  size_t index_;
+  const char* username_;
+  size_t username_len_;
+  const char* password_;
+  size_t password_len_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_CANDIDATECODEC_H_
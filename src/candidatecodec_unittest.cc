@@ -0,0 +1,164 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "talk/base/gunit.h"
+#include "talk/base/socketaddress.h"
+#include "talk/p2p/base/candidate.h"
+
+#include "candidatecodec.h"
+
+namespace tincan {
+
+static cricket::Candidate MakeCandidate(const std::string& ip, int port,
+                                        const std::string& type) {
+  return cricket::Candidate("", 1, "udp", talk_base::SocketAddress(ip, port),
+                            2130706431, "ufragufrag",
+                            "passwordpasswordpassword", type, "eth0", 0,
+                            "12345");
+}
+
+// decodes every token of tokens and appends the candidates
+static bool DecodeTokens(const std::string& tokens,
+                         cricket::Candidates* candidates, int* batches) {
+  std::istringstream in(tokens);
+  std::string token;
+  *batches = 0;
+  while (in >> token) {
+    if (!IsBinaryCandidates(token.data(), token.size())) return false;
+    CandidateDecoder decoder;
+    if (!decoder.Init(token.data(), token.size())) return false;
+    CandidateRecord record;
+    while (decoder.Next(&record)) {
+      cricket::Candidate candidate;
+      decoder.ToCandidate(record, &candidate);
+      candidates->push_back(candidate);
+    }
+    (*batches)++;
+  }
+  return true;
+}
+
+TEST(CandidateCodecTest, RoundTrip) {
+  cricket::Candidates candidates;
+  candidates.push_back(MakeCandidate("192.168.1.10", 50000, "local"));
+  candidates.push_back(MakeCandidate("128.227.1.2", 61000, "stun"));
+  candidates.push_back(MakeCandidate("10.1.2.3", 3478, "relay"));
+  std::string tokens;
+  ASSERT_TRUE(EncodeCandidates(candidates, &tokens));
+  EXPECT_EQ(std::string::npos, tokens.find(' '));
+
+  cricket::Candidates decoded;
+  int batches;
+  ASSERT_TRUE(DecodeTokens(tokens, &decoded, &batches));
+  EXPECT_EQ(1, batches);
+  ASSERT_EQ(candidates.size(), decoded.size());
+  for (size_t i = 0; i < candidates.size(); i++) {
+    EXPECT_TRUE(candidates[i].IsEquivalent(decoded[i]));
+    EXPECT_EQ(candidates[i].priority(), decoded[i].priority());
+    EXPECT_EQ(candidates[i].network_name(), decoded[i].network_name());
+  }
+}
+
+TEST(CandidateCodecTest, SplitsLargeSets) {
+  cricket::Candidates candidates;
+  for (int i = 0; i < 300; i++) {
+    std::ostringstream ip;
+    ip << "10.0." << i / 250 << "." << i % 250;
+    candidates.push_back(MakeCandidate(ip.str(), 1000 + i, "local"));
+  }
+  std::string tokens;
+  ASSERT_TRUE(EncodeCandidates(candidates, &tokens));
+
+  cricket::Candidates decoded;
+  int batches;
+  ASSERT_TRUE(DecodeTokens(tokens, &decoded, &batches));
+  EXPECT_LT(1, batches);
+  ASSERT_EQ(candidates.size(), decoded.size());
+  for (size_t i = 0; i < candidates.size(); i++) {
+    EXPECT_TRUE(candidates[i].IsEquivalent(decoded[i]));
+  }
+}
+
+TEST(CandidateCodecTest, RejectsTextOnlyFoundation) {
+  cricket::Candidates candidates;
+  candidates.push_back(cricket::Candidate(
+      "", 1, "udp", talk_base::SocketAddress("10.0.0.1", 5000), 1, "u", "p",
+      "local", "eth0", 0, "abc"));
+  std::string tokens;
+  EXPECT_FALSE(EncodeCandidates(candidates, &tokens));
+}
+
+TEST(CandidateCodecTest, RejectsTruncatedBatch) {
+  cricket::Candidates candidates;
+  candidates.push_back(MakeCandidate("10.0.0.1", 5000, "local"));
+  candidates.push_back(MakeCandidate("10.0.0.2", 5001, "local"));
+  std::string tokens;
+  ASSERT_TRUE(EncodeCandidates(candidates, &tokens));
+  // dropping base64 characters cuts the second record short
+  std::string truncated = tokens.substr(0, tokens.size() - 8);
+  CandidateDecoder decoder;
+  size_t count = 0;
+  if (decoder.Init(truncated.data(), truncated.size())) {
+    CandidateRecord record;
+    while (decoder.Next(&record)) count++;
+  }
+  EXPECT_GT(candidates.size(), count);
+}
+
+TEST(CandidateCodecTest, Capability) {
+  EXPECT_TRUE(IsBinaryCapability(kBinaryCapability, 2));
+  EXPECT_FALSE(IsBinaryCapability("b1.AAAA", 7));
+  EXPECT_TRUE(IsBinaryCandidates("b1.AAAA", 7));
+  EXPECT_FALSE(IsBinaryCandidates(kBinaryCapability, 2));
+  EXPECT_EQ(CANDIDATE_FORMAT_BINARY, CandidateFormatFromString("binary"));
+  EXPECT_EQ(CANDIDATE_FORMAT_AUTO, CandidateFormatFromString("auto"));
+  EXPECT_EQ(CANDIDATE_FORMAT_TEXT, CandidateFormatFromString("text"));
+}
+
+TEST(CandidateCodecTest, ParseText) {
+  const std::string token =
+      "id:1:udp:128.227.1.2:61000:2130706431:ufrag:password:stun:eth0:0:7";
+  cricket::Candidate candidate;
+  ASSERT_TRUE(ParseTextCandidate(token.data(), token.size(), &candidate));
+  EXPECT_EQ(1, candidate.component());
+  EXPECT_EQ("udp", candidate.protocol());
+  EXPECT_EQ(61000, candidate.address().port());
+  EXPECT_EQ(2130706431U, candidate.priority());
+  EXPECT_EQ("ufrag", candidate.username());
+  EXPECT_EQ("stun", candidate.type());
+  EXPECT_EQ("7", candidate.foundation());
+
+  const std::string short_token = "id:1:udp:128.227.1.2:61000";
+  EXPECT_FALSE(ParseTextCandidate(short_token.data(), short_token.size(),
+                                  &candidate));
+  const std::string bad_port =
+      "id:1:udp:128.227.1.2:port:2130706431:ufrag:password:stun:eth0:0:7";
+  EXPECT_FALSE(ParseTextCandidate(bad_port.data(), bad_port.size(),
+                                  &candidate));
+}
+
+}  // namespace tincan
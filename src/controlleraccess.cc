@@ -30,6 +30,8 @@ static const char kLocalHost[] = "127.0.0.1";
 static const char kLocalHost6[] = "::1";
 static const int kDefaultXmppPort = 5222;
 static const int kBufferSize = 1024;
+// replies larger than this are split across several datagrams
+static const size_t kMaxReplySize = 16384;
 static std::map<std::string, int> rpc_calls;
 
 enum {
@@ -47,6 +49,25 @@ enum {
   ECHO_REQUEST = 12,
   ECHO_REPLY = 13,
   SET_NETWORK_IGNORE_LIST = 14,
+  BATCH = 15,
+  SET_SHARED_SOCKET = 16,
+  SET_CANDIDATE_CACHE = 17,
+  SET_TRICKLE = 18,
+  GET_LINK_STATS = 19,
+  SET_CANDIDATE_FORMAT = 20,
+  SET_IDLE_POLICY = 21,
+  SET_MULTIPATH = 22,
+  SET_PATH_SELECTION = 23,
+  SET_ONDEMAND_POLICY = 24,
+  ADD_ROUTE = 25,
+  DEL_ROUTE = 26,
+  SET_FORWARDING = 27,
+  SET_NEIGHBOR_PROXY = 28,
+  SET_REPLICATION = 29,
+  SET_ACL = 30,
+  SET_RATE_LIMIT = 31,
+  SET_FEC = 32,
+  SET_ACCEPT_RELAYED = 33,
 };
 
 static void init_map() {
@@ -64,22 +85,41 @@ static void init_map() {
   rpc_calls["echo_request"] = ECHO_REQUEST;
   rpc_calls["echo_reply"] = ECHO_REPLY;
   rpc_calls["set_network_ignore_list"] = SET_NETWORK_IGNORE_LIST;
+  rpc_calls["batch"] = BATCH;
+  rpc_calls["set_shared_socket"] = SET_SHARED_SOCKET;
+  rpc_calls["set_candidate_cache"] = SET_CANDIDATE_CACHE;
+  rpc_calls["set_trickle"] = SET_TRICKLE;
+  rpc_calls["get_link_stats"] = GET_LINK_STATS;
+  rpc_calls["set_candidate_format"] = SET_CANDIDATE_FORMAT;
+  rpc_calls["set_idle_policy"] = SET_IDLE_POLICY;
+  rpc_calls["set_multipath"] = SET_MULTIPATH;
+  rpc_calls["set_path_selection"] = SET_PATH_SELECTION;
+  rpc_calls["set_ondemand_policy"] = SET_ONDEMAND_POLICY;
+  rpc_calls["add_route"] = ADD_ROUTE;
+  rpc_calls["del_route"] = DEL_ROUTE;
+  rpc_calls["set_forwarding"] = SET_FORWARDING;
+  rpc_calls["set_neighbor_proxy"] = SET_NEIGHBOR_PROXY;
+  rpc_calls["set_replication"] = SET_REPLICATION;
+  rpc_calls["set_acl"] = SET_ACL;
+  rpc_calls["set_rate_limit"] = SET_RATE_LIMIT;
+  rpc_calls["set_fec"] = SET_FEC;
+  rpc_calls["set_accept_relayed"] = SET_ACCEPT_RELAYED;
 }
 
 ControllerAccess::ControllerAccess(
     TinCanConnectionManager& manager, XmppNetwork& network,
     talk_base::BasicPacketSocketFactory* packet_factory,
-    thread_opts_t* opts)
+    thread_opts_t* opts, int port)
     : manager_(manager),
       network_(network),
       packet_options_(talk_base::DSCP_DEFAULT),
       opts_(opts) {
   signal_thread_ = talk_base::Thread::Current();
   socket_.reset(packet_factory->CreateUdpSocket(
-      talk_base::SocketAddress(kLocalHost, tincan::kUdpPort), 0, 0));
+      talk_base::SocketAddress(kLocalHost, port), 0, 0));
   socket_->SignalReadPacket.connect(this, &ControllerAccess::HandlePacket);
   socket6_.reset(packet_factory->CreateUdpSocket(
-      talk_base::SocketAddress(kLocalHost6, tincan::kUdpPort), 0, 0));
+      talk_base::SocketAddress(kLocalHost6, port), 0, 0));
   socket6_->SignalReadPacket.connect(this, &ControllerAccess::HandlePacket);
   manager_.set_forward_socket(socket6_.get());
   init_map();
@@ -126,12 +166,14 @@ void ControllerAccess::SendState(const std::string& uid, bool get_stats,
   ASSERT(signal_thread_->Current());
   Json::Value state;
   if (uid != "") {
-    std::map<std::string, uint32> friends;
-    friends[uid] = talk_base::Time();
-    state = manager_.GetState(friends, get_stats);
+    PeerDirectory peer;
+    peer.UpdatePresence(uid, talk_base::Time());
+    const PeerRecord* record = network_.directory()->Find(uid);
+    if (record != NULL) peer.UpdateLinkState(uid, record->link_state);
+    state = manager_.GetState(peer, get_stats);
   }
   else {
-    state = manager_.GetState(network_.friends(), get_stats);
+    state = manager_.GetState(*network_.directory(), get_stats);
   }
   Json::Value local_state;
   local_state["_uid"] = manager_.uid();
@@ -148,6 +190,7 @@ void ControllerAccess::SendState(const std::string& uid, bool get_stats,
     mac << std::hex << ((int) *(opts_->mac+i) & 0xff);
   }
   local_state["_mac"] = mac.str();
+  local_state["_rate_limit"] = manager_.GetRateLimitState();
   std::string msg = local_state.toStyledString();
   SendTo(msg.c_str(), msg.size(), addr);
 
@@ -159,37 +202,40 @@ void ControllerAccess::SendState(const std::string& uid, bool get_stats,
   }
 }
 
-void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
-    const char* data, size_t len, const talk_base::SocketAddress& addr,
-    const talk_base::PacketTime& ptime) {
+void ControllerAccess::SendReplies(const Json::Value& results,
+                                   const talk_base::SocketAddress& addr) {
   ASSERT(signal_thread_->Current());
-  if (data[0] != kIpopVer) {
-    LOG_TS(LS_ERROR) << "IPOP version mismatch tincan:" << kIpopVer 
-                     << " controller:" << data[0];
-  }
-  if (data[1] == kTincanPacket) return ProcessIPPacket(socket, data, len, addr);
-  if (data[1] == kICCControl || data[1] == kICCPacket) {
-    /* ICC message is received from controller. Remove IPOP version and type
-       field and pass to TinCan Connection manager */
-    manager_.DoPacketSend(data+2, len-2);
-    return;
-  }
-  if (data[1] != kTincanControl) {
-    LOG_TS(LS_ERROR) << "Unknown message type"; 
-  }
-  std::string result;
-  std::string message(data, 2, len);
-  Json::Reader reader;
-  Json::Value root;
-  if (!reader.parse(message, root)) {
-    result = "{\"error\":\"json parsing failed\"}";
-  }
-  else {
-    LOG_TS(LS_VERBOSE) << "JSONRPC " << message;
+  // replies are packed into as few datagrams as possible, a new datagram is
+  // started whenever the current one would exceed kMaxReplySize
+  Json::FastWriter writer;
+  Json::Value reply(Json::objectValue);
+  reply["type"] = "rpc_reply";
+  reply["results"] = Json::Value(Json::arrayValue);
+  size_t reply_size = 0;
+  for (Json::ValueConstIterator it = results.begin(); it != results.end();
+       it++) {
+    std::string entry = writer.write(*it);
+    if (reply_size > 0 && reply_size + entry.size() > kMaxReplySize) {
+      std::string msg = writer.write(reply);
+      SendTo(msg.c_str(), msg.size(), addr);
+      reply["results"] = Json::Value(Json::arrayValue);
+      reply_size = 0;
+    }
+    reply["results"].append(*it);
+    reply_size += entry.size();
   }
+  if (reply_size == 0) return;
+  std::string msg = writer.write(reply);
+  SendTo(msg.c_str(), msg.size(), addr);
+}
 
+bool ControllerAccess::HandleRpc(const Json::Value& root,
+                                 const talk_base::SocketAddress& addr,
+                                 std::string* error) {
+  ASSERT(signal_thread_->Current());
   // TODO - input sanitazation for security purposes
   std::string method = root["m"].asString();
+  bool res = true;
 
   switch (rpc_calls[method]) {
     case REGISTER_SVC: {
@@ -200,7 +246,9 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
         if (root.isMember("port")) {
           port = root["port"].asInt();
         }
-        bool res = network_.Login(user, pass, manager_.uid(), host, port);
+        bool stream_management = root["stream_management"].asBool();
+        res = network_.Login(user, pass, manager_.uid(), host, port,
+                             stream_management);
       }
       break;
     case CREATE_LINK: {
@@ -213,10 +261,12 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
         std::string turn_pass = root["turn_pass"].asString();
         std::string cas = root["cas"].asString();
         bool sec = root["sec"].asBool();
-        bool res = manager_.CreateTransport(uid, fpr, overlay_id, stun, turn,
-                                            turn_user, turn_pass, sec);
+        res = manager_.CreateTransport(uid, fpr, overlay_id, stun, turn,
+                                       turn_user, turn_pass, sec);
+        // CreateTransport refuses a link that already exists, candidates
+        // are still added to it and only a missing transport is an error
         if (!cas.empty()) {
-          manager_.CreateConnections(uid, cas);
+          res = manager_.CreateConnections(uid, cas);
         }
       }
       break;
@@ -228,6 +278,9 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
         int ip6_mask = root["ip6_mask"].asInt();
         int subnet_mask = root["subnet_mask"].asInt();
         int switchmode = root["switchmode"].asInt();
+        // optional, an identity_file keeps the fingerprint across restarts
+        manager_.set_identity_options(root["identity_file"].asString(),
+                                      root["key_type"].asString());
         manager_.Setup(uid, ip4, ip4_mask, ip6, ip6_mask, subnet_mask,
                        switchmode);
       }
@@ -236,12 +289,12 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
         std::string uid = root["uid"].asString();
         std::string ip4 = root["ip4"].asString();
         std::string ip6 = root["ip6"].asString();
-        bool res = manager_.AddIPMapping(uid, ip4, ip6);
+        res = manager_.AddIPMapping(uid, ip4, ip6);
       }
       break;
     case TRIM_LINK: {
         std::string uid = root["uid"].asString();
-        manager_.DestroyTransport(uid);
+        res = manager_.DestroyTransport(uid);
       }
       break;
     case SET_CB_ENDPOINT: {
@@ -312,7 +365,8 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
       Json::Value network_ignore_list = root["network_ignore_list"];
       if (network_ignore_list.isArray() != 1) {
         LOG_TS(LERROR) << "Unproperrly styled json network_ignore_list";
-        break;
+        *error = "network_ignore_list is not an array";
+        return false;
       }
       LOG_TS(INFO) << "Listed network device is ignored for TinCan connection"
                    << network_ignore_list.toStyledString();  
@@ -323,6 +377,146 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
       manager_.set_network_ignore_list(ignore_list);
       }
       break;
+    case SET_SHARED_SOCKET: {
+        bool shared_socket = root["shared_socket"].asBool();
+        int port = root["port"].asInt();
+        manager_.set_shared_socket(shared_socket, port);
+      }
+      break;
+    case SET_CANDIDATE_CACHE: {
+        int ttl = root["ttl"].asInt();
+        manager_.set_candidate_cache_ttl(ttl);
+      }
+      break;
+    case SET_TRICKLE: {
+        bool trickle = root["trickle_enabled"].asBool();
+        manager_.set_trickle(trickle);
+      }
+      break;
+    case GET_LINK_STATS: {
+        bool reset = root["reset"].asBool();
+        Json::Value link_stats;
+        link_stats["type"] = "link_stats";
+        link_stats["phases"] = manager_.GetLinkStats(reset);
+        link_stats["candidate_codec"] = manager_.GetCodecStats(reset);
+        link_stats["candidate_cache"] =
+            manager_.GetCandidateCacheStats(reset);
+        link_stats["hibernation"] = manager_.GetIdleStats(reset);
+        link_stats["network_restart"] = manager_.GetRestartStats(reset);
+        link_stats["on_demand"] = manager_.GetOnDemandStats(reset);
+        link_stats["routing"] = manager_.GetRouteStats(reset);
+        link_stats["neighbor_proxy"] = manager_.GetNeighborStats(reset);
+        link_stats["replication"] = manager_.GetReplicationStats(reset);
+        link_stats["acl"] = manager_.GetAclStats(reset);
+        link_stats["fec"] = manager_.GetFecStats();
+        link_stats["signaling"] = network_.GetSignalingStats(reset);
+        std::string msg = link_stats.toStyledString();
+        SendTo(msg.c_str(), msg.size(), addr);
+      }
+      break;
+    case SET_CANDIDATE_FORMAT: {
+        std::string format = root["format"].asString();
+        manager_.set_candidate_format(format);
+      }
+      break;
+    case SET_IDLE_POLICY: {
+        int idle_timeout = root["idle_timeout"].asInt();
+        manager_.set_idle_timeout(idle_timeout);
+      }
+      break;
+    case SET_MULTIPATH: {
+        bool multipath = root["multipath"].asBool();
+        manager_.set_multipath(multipath);
+      }
+      break;
+    case SET_PATH_SELECTION: {
+        bool path_selection = root["path_selection"].asBool();
+        manager_.set_path_selection(path_selection);
+      }
+      break;
+    case SET_ONDEMAND_POLICY: {
+        TinCanConnectionManager::OnDemandPolicy policy;
+        policy.threshold = root["threshold"].asUInt();
+        policy.window = root["window"].asUInt();
+        if (root.isMember("overlay_id")) {
+          policy.overlay_id = root["overlay_id"].asInt();
+        }
+        policy.stun_server = root["stun"].asString();
+        policy.turn_server = root["turn"].asString();
+        policy.turn_user = root["turn_user"].asString();
+        policy.turn_pass = root["turn_pass"].asString();
+        if (root.isMember("sec")) policy.sec_enabled = root["sec"].asBool();
+        manager_.set_on_demand_policy(policy);
+      }
+      break;
+    case ADD_ROUTE: {
+        std::string uid = root["uid"].asString();
+        std::string next_hop = root["next_hop"].asString();
+        res = manager_.AddRoute(uid, next_hop);
+      }
+      break;
+    case DEL_ROUTE: {
+        std::string uid = root["uid"].asString();
+        res = manager_.DelRoute(uid);
+      }
+      break;
+    case SET_FORWARDING: {
+        bool forwarding = root["forwarding"].asBool();
+        res = manager_.set_forwarding(forwarding);
+      }
+      break;
+    case SET_ACCEPT_RELAYED: {
+        bool accept_relayed = root["accept_relayed"].asBool();
+        res = manager_.set_accept_relayed(accept_relayed);
+      }
+      break;
+    case SET_NEIGHBOR_PROXY: {
+        bool neighbor_proxy = root["neighbor_proxy"].asBool();
+        manager_.set_neighbor_proxy(neighbor_proxy);
+      }
+      break;
+    case SET_REPLICATION: {
+        bool replication = root["replication"].asBool();
+        manager_.set_replication(replication);
+      }
+      break;
+    case SET_ACL: {
+        // the rule order is the match priority, the first match decides
+        Json::Value rules_json = root["rules"];
+        if (!rules_json.isNull() && !rules_json.isArray()) {
+          *error = "rules is not an array";
+          return false;
+        }
+        std::vector<PacketClassifier::Rule> rules(rules_json.size());
+        for (Json::ArrayIndex i = 0; i < rules_json.size(); i++) {
+          if (!PacketClassifier::ParseRule(rules_json[i], &rules[i], error)) {
+            return false;
+          }
+        }
+        bool default_allow = root["default"].asString() != "deny";
+        manager_.SetAcl(rules, default_allow);
+      }
+      break;
+    case SET_RATE_LIMIT: {
+        std::string uid = root["uid"].asString();
+        bool global = root["scope"].asString() == "global";
+        uint32 rate_kbps = root["rate_kbps"].asUInt();
+        uint32 burst = root["burst"].asUInt();
+        res = manager_.SetRateLimit(uid, global, rate_kbps, burst);
+      }
+      break;
+    case SET_FEC: {
+        std::string uid = root["uid"].asString();
+        bool enabled = root["fec"].asBool();
+        res = manager_.SetFec(uid, enabled);
+      }
+      break;
+    case BATCH: {
+        // nested batches are not allowed, the controller should flatten them
+        *error = "nested batch";
+        return false;
+      }
+      break;
     default: {
         int overlay_id = root["overlay_id"].asInt();
         std::string uid = root["uid"].asString();
@@ -331,9 +525,83 @@ void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
       }
       break;
   }
- 
-  if (result.empty()) return;
-  SendTo(result.c_str(), result.size(), addr);
+  if (!res) *error = method + " failed";
+  return res;
+}
+
+void ControllerAccess::HandleBatch(const Json::Value& root,
+                                   const talk_base::SocketAddress& addr) {
+  ASSERT(signal_thread_->Current());
+  const Json::Value& calls = root["calls"];
+  Json::Value results(Json::arrayValue);
+  if (!calls.isArray()) {
+    Json::Value result(Json::objectValue);
+    result["id"] = root["id"];
+    result["ok"] = false;
+    result["error"] = "calls is not an array";
+    results.append(result);
+    return SendReplies(results, addr);
+  }
+
+  // each call is processed in order and its result is tagged with the id
+  // given by the controller so that replies can be matched to requests
+  for (Json::ValueConstIterator it = calls.begin(); it != calls.end(); it++) {
+    std::string error;
+    bool ok = HandleRpc(*it, addr, &error);
+    Json::Value result(Json::objectValue);
+    result["id"] = (*it)["id"];
+    result["ok"] = ok;
+    if (!ok) result["error"] = error;
+    results.append(result);
+  }
+  LOG_TS(LS_VERBOSE) << "BATCH processed " << results.size() << " calls";
+  SendReplies(results, addr);
+}
+
+void ControllerAccess::HandlePacket(talk_base::AsyncPacketSocket* socket,
+    const char* data, size_t len, const talk_base::SocketAddress& addr,
+    const talk_base::PacketTime& ptime) {
+  ASSERT(signal_thread_->Current());
+  if (data[0] != kIpopVer) {
+    LOG_TS(LS_ERROR) << "IPOP version mismatch tincan:" << kIpopVer 
+                     << " controller:" << data[0];
+  }
+  if (data[1] == kTincanPacket) return ProcessIPPacket(socket, data, len, addr);
+  if (data[1] == kICCControl || data[1] == kICCPacket) {
+    /* ICC message is received from controller. Remove IPOP version and type
+       field and pass to TinCan Connection manager */
+    manager_.QueueFromTap(data+2, len-2);
+    return;
+  }
+  if (data[1] != kTincanControl) {
+    LOG_TS(LS_ERROR) << "Unknown message type"; 
+  }
+  std::string message(data, 2, len);
+  Json::Reader reader;
+  Json::Value root;
+  if (!reader.parse(message, root)) {
+    std::string result = "{\"error\":\"json parsing failed\"}";
+    SendTo(result.c_str(), result.size(), addr);
+    return;
+  }
+  LOG_TS(LS_VERBOSE) << "JSONRPC " << message;
+
+  if (rpc_calls[root["m"].asString()] == BATCH) {
+    return HandleBatch(root, addr);
+  }
+
+  // calls without an id keep the old fire and forget behaviour, calls
+  // with an id get a reply so the controller can detect lost requests
+  std::string error;
+  bool ok = HandleRpc(root, addr, &error);
+  if (!root.isMember("id")) return;
+  Json::Value results(Json::arrayValue);
+  Json::Value result(Json::objectValue);
+  result["id"] = root["id"];
+  result["ok"] = ok;
+  if (!ok) result["error"] = error;
+  results.append(result);
+  SendReplies(results, addr);
 }
 
 }  // namespace tincan
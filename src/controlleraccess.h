@@ -28,21 +28,20 @@
 #include "talk/base/socketaddress.h"
 #include "talk/p2p/base/basicpacketsocketfactory.h"
 #include "talk/base/logging.h"
+#include "talk/base/json.h"
 
 #include "peersignalsender.h"
 #include "xmppnetwork.h"
 #include "tincanconnectionmanager.h"
 
 namespace tincan {
-//port is configurable via argument to tincan.
-extern int kUdpPort;
 
 class ControllerAccess : public PeerSignalSenderInterface,
                          public sigslot::has_slots<> {
  public:
   ControllerAccess(TinCanConnectionManager& manager, XmppNetwork& network,
          talk_base::BasicPacketSocketFactory* packet_factory,
-         thread_opts_t* opts);
+         thread_opts_t* opts, int port);
 
   // Inherited from PeerSignalSenderInterface
   virtual void SendToPeer(int overlay_id, const std::string& uid,
@@ -61,6 +60,12 @@ class ControllerAccess : public PeerSignalSenderInterface,
               const talk_base::SocketAddress& addr);
   void SendState(const std::string& uid, bool get_stats,
                  const talk_base::SocketAddress& addr);
+  void SendReplies(const Json::Value& results,
+                   const talk_base::SocketAddress& addr);
+  bool HandleRpc(const Json::Value& root,
+                 const talk_base::SocketAddress& addr, std::string* error);
+  void HandleBatch(const Json::Value& root,
+                   const talk_base::SocketAddress& addr);
 
   thread_opts_t* opts_;
   XmppNetwork& network_;
@@ -0,0 +1,278 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fec.h"
+
+namespace tincan {
+
+static const uint8 kFecMagic0 = 0xfe;
+static const uint8 kFecMagic1 = 0xc0;
+static const uint8 kTypeData = 0;
+static const uint8 kTypeParity = 1;
+static const uint8 kTypeFeedback = 2;
+// group sizes for low (< 1%), medium (< 5%) and high loss
+static const uint8 kLargeGroup = 16;
+static const uint8 kMediumGroup = 8;
+static const uint8 kSmallGroup = 4;
+// a loss figure needs at least this many expected packets
+static const uint32 kMinLossSample = 50;
+
+static uint16 GetUint16(const char* data) {
+  return (static_cast<uint8>(data[0]) << 8) | static_cast<uint8>(data[1]);
+}
+
+static void SetUint16(char* data, uint16 value) {
+  data[0] = static_cast<char>(value >> 8);
+  data[1] = static_cast<char>(value & 0xff);
+}
+
+// dst ^= src, 16 bytes at a time where SSE2 is available
+static void XorBytes(char* dst, const char* src, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_xor_si128(a, b));
+  }
+#endif
+  for (; i < len; i++) dst[i] ^= src[i];
+}
+
+static void WriteShim(char* out, uint8 type, uint8 count, uint16 group,
+                      uint8 index) {
+  out[0] = static_cast<char>(kFecMagic0);
+  out[1] = static_cast<char>(kFecMagic1);
+  out[2] = type;
+  out[3] = count;
+  SetUint16(out + 4, group);
+  out[6] = index;
+  out[7] = 0;
+}
+
+bool IsFecCapability(const char* token, size_t len) {
+  return len == sizeof(kFecCapability) - 1 &&
+         memcmp(token, kFecCapability, len) == 0;
+}
+
+bool IsFecPacket(const char* data, size_t len) {
+  return len >= kFecShimLen && static_cast<uint8>(data[0]) == kFecMagic0 &&
+         static_cast<uint8>(data[1]) == kFecMagic1 &&
+         static_cast<uint8>(data[2]) <= kTypeFeedback;
+}
+
+FecEncoder::FecEncoder()
+    : group_size_(kLargeGroup),
+      group_(0),
+      count_(0),
+      len_xor_(0),
+      max_len_(0),
+      data_packets_(0),
+      parity_packets_(0) {
+}
+
+bool FecEncoder::Encode(const char* data, size_t len, char* out) {
+  WriteShim(out, kTypeData, count_ + 1, group_, count_);
+  memcpy(out + kFecShimLen, data, len);
+  // the parity covers the longest frame, shorter ones count as zero padded
+  if (len > max_len_) {
+    memset(parity_ + max_len_, 0, len - max_len_);
+    max_len_ = len;
+  }
+  XorBytes(parity_, data, len);
+  len_xor_ ^= static_cast<uint16>(len);
+  count_++;
+  data_packets_++;
+  return count_ >= group_size_;
+}
+
+size_t FecEncoder::Parity(char* out) {
+  if (count_ == 0) return 0;
+  WriteShim(out, kTypeParity, count_, group_, count_);
+  SetUint16(out + kFecShimLen, len_xor_);
+  memcpy(out + kFecShimLen + 2, parity_, max_len_);
+  size_t len = kFecShimLen + 2 + max_len_;
+  group_++;
+  count_ = 0;
+  len_xor_ = 0;
+  max_len_ = 0;
+  parity_packets_++;
+  return len;
+}
+
+void FecEncoder::UpdateLoss(int loss) {
+  if (loss < 10) group_size_ = kLargeGroup;
+  else if (loss < 50) group_size_ = kMediumGroup;
+  else group_size_ = kSmallGroup;
+}
+
+FecDecoder::FecDecoder()
+    : started_(false),
+      last_group_(0),
+      last_count_(0),
+      expected_(0),
+      missing_(0),
+      received_(0),
+      recovered_(0),
+      lost_(0) {
+  for (int i = 0; i < kWindow; i++) groups_[i].used = false;
+}
+
+FecDecoder::Group* FecDecoder::FindGroup(uint16 group, uint8 count) {
+  // groups that never showed up at all are lost too
+  int16 ahead = static_cast<int16>(group - last_group_);
+  if (!started_) {
+    started_ = true;
+    last_group_ = group;
+    last_count_ = count;
+  }
+  else if (ahead > 0) {
+    uint32 skipped = (ahead - 1) * last_count_;
+    expected_ += skipped;
+    missing_ += skipped;
+    lost_ += skipped;
+    last_group_ = group;
+    last_count_ = count;
+  }
+
+  Group* slot = &groups_[group % kWindow];
+  if (slot->used && slot->group == group) return slot;
+  if (slot->used) {
+    // a late packet of a group that has been retired already
+    if (static_cast<int16>(group - slot->group) < 0) return NULL;
+    Retire(slot);
+  }
+  slot->used = true;
+  slot->group = group;
+  slot->done = false;
+  slot->have_parity = false;
+  slot->count = count;
+  slot->received = 0;
+  slot->mask = 0;
+  slot->len_xor = 0;
+  slot->max_len = 0;
+  return slot;
+}
+
+void FecDecoder::Retire(Group* group) {
+  uint32 count = group->count;
+  uint32 received = group->received < count ? group->received : count;
+  expected_ += count;
+  missing_ += count - received;
+  uint32 repaired = group->done ? 1 : 0;
+  if (count > received + repaired) lost_ += count - received - repaired;
+  group->used = false;
+}
+
+static void Accumulate(char* xor_buf, size_t* max_len, const char* data,
+                       size_t len) {
+  if (len > *max_len) {
+    memset(xor_buf + *max_len, 0, len - *max_len);
+    *max_len = len;
+  }
+  XorBytes(xor_buf, data, len);
+}
+
+void FecDecoder::TryRecover(Group* group, Output* out) {
+  // the parity XOR all received frames leaves the one missing frame
+  if (!group->have_parity || group->done ||
+      group->received + 1 != group->count) return;
+  size_t len = group->len_xor;
+  if (len == 0 || len > group->max_len) return;
+  memcpy(out->recovered, group->xor_buf, len);
+  out->recovered_len = len;
+  group->done = true;
+  recovered_++;
+}
+
+void FecDecoder::Decode(const char* data, size_t len, Output* out) {
+  out->frame = NULL;
+  out->frame_len = 0;
+  out->recovered_len = 0;
+  out->feedback = -1;
+  uint8 type = data[2];
+  uint8 count = data[3];
+  uint16 group_id = GetUint16(data + 4);
+  uint8 index = data[6];
+
+  if (type == kTypeFeedback) {
+    if (len >= kFecShimLen + 2) out->feedback = GetUint16(data + kFecShimLen);
+    return;
+  }
+  if (type == kTypeData) {
+    out->frame = data + kFecShimLen;
+    out->frame_len = len - kFecShimLen;
+    received_++;
+    if (out->frame_len > kFecMaxFrame || index >= 32) return;
+    Group* group = FindGroup(group_id, count);
+    if (group == NULL || (group->mask & (1u << index))) return;
+    // until the parity arrives the group is as long as the latest frame
+    // says, frames lost at the end of a group without parity go unseen
+    if (!group->have_parity && count > group->count) {
+      group->count = count;
+      if (group->group == last_group_) last_count_ = count;
+    }
+    group->mask |= 1u << index;
+    group->received++;
+    Accumulate(group->xor_buf, &group->max_len, out->frame, out->frame_len);
+    group->len_xor ^= static_cast<uint16>(out->frame_len);
+    TryRecover(group, out);
+  }
+  else if (type == kTypeParity) {
+    if (len < kFecShimLen + 2 || len - kFecShimLen - 2 > kFecMaxFrame ||
+        count == 0) return;
+    Group* group = FindGroup(group_id, count);
+    if (group == NULL || group->have_parity) return;
+    group->have_parity = true;
+    group->count = count;
+    if (group->group == last_group_) last_count_ = count;
+    Accumulate(group->xor_buf, &group->max_len, data + kFecShimLen + 2,
+               len - kFecShimLen - 2);
+    group->len_xor ^= GetUint16(data + kFecShimLen);
+    TryRecover(group, out);
+  }
+}
+
+int FecDecoder::TakeLoss() {
+  if (expected_ < kMinLossSample) return -1;
+  int loss = static_cast<int>(static_cast<uint64>(missing_) * 1000 /
+                              expected_);
+  expected_ = 0;
+  missing_ = 0;
+  return loss;
+}
+
+size_t FecDecoder::Feedback(int loss, char* out) {
+  WriteShim(out, kTypeFeedback, 0, 0, 0);
+  SetUint16(out + kFecShimLen, static_cast<uint16>(loss));
+  return kFecShimLen + 2;
+}
+
+}  // namespace tincan
@@ -0,0 +1,152 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_FEC_H_
+#define TINCAN_FEC_H_
+#pragma once
+
+#include "talk/base/basictypes.h"
+
+namespace tincan {
+
+// Every FEC packet starts with an 8 byte shim: 0xfe 0xc0, the packet type,
+// the number of data packets in the group, the group number (2 bytes), the
+// index within the group and a reserved byte. Data packets count the frames
+// sent so far, index + 1, because a group may be flushed before it is full,
+// the parity packet carries the final count. Parity packets carry the XOR
+// of the data frame lengths (2 bytes) followed by the XOR of the frames.
+static const size_t kFecShimLen = 8;
+static const size_t kFecMaxFrame = 2048;
+static const size_t kFecMaxPacket = kFecShimLen + 2 + kFecMaxFrame;
+
+// peers that decode FEC add this token to their signaled candidates,
+// frames to a peer are only protected once it has been seen
+static const char kFecCapability[] = "f1";
+
+// returns true if the token is kFecCapability
+bool IsFecCapability(const char* token, size_t len);
+
+// true if the packet starts like an FEC shim, a plain frame from a peer
+// whose uid starts with the same bytes must be ruled out by the caller
+bool IsFecPacket(const char* data, size_t len);
+
+// FecEncoder protects groups of up to 16 frames with one XOR parity packet,
+// fewer frames per group when the peer reports more loss
+class FecEncoder {
+ public:
+  FecEncoder();
+
+  uint8 group_size() const { return group_size_; }
+  uint32 data_packets() const { return data_packets_; }
+  uint32 parity_packets() const { return parity_packets_; }
+
+  // writes the shim and the frame to out, which must hold len +
+  // kFecShimLen bytes, and returns true when the group is complete and
+  // Parity should be sent after it
+  bool Encode(const char* data, size_t len, char* out);
+
+  // writes the parity packet of the current group to out, which must hold
+  // kFecMaxPacket bytes, and starts a new group. Returns 0 if the group
+  // is empty.
+  size_t Parity(char* out);
+
+  bool pending() const { return count_ > 0; }
+
+  // loss reported by the peer in permille
+  void UpdateLoss(int loss);
+
+ private:
+  uint8 group_size_;
+  uint16 group_;
+  uint8 count_;
+  uint16 len_xor_;
+  size_t max_len_;
+  uint32 data_packets_;
+  uint32 parity_packets_;
+  char parity_[kFecMaxFrame];
+};
+
+// FecDecoder recovers one lost frame per group and measures the loss of
+// the link before recovery
+class FecDecoder {
+ public:
+  struct Output {
+    // the received frame, NULL for parity and feedback packets
+    const char* frame;
+    size_t frame_len;
+    // a frame recovered from the parity when recovered_len > 0
+    size_t recovered_len;
+    char recovered[kFecMaxFrame];
+    // loss reported by the peer in permille, -1 if none
+    int feedback;
+  };
+
+  FecDecoder();
+
+  uint32 received() const { return received_; }
+  uint32 recovered() const { return recovered_; }
+  uint32 lost() const { return lost_; }
+
+  void Decode(const char* data, size_t len, Output* out);
+
+  // loss in permille since the last call, -1 if too few packets were seen
+  int TakeLoss();
+
+  // writes a feedback packet reporting loss to out, which must hold
+  // kFecShimLen + 2 bytes, and returns its length
+  static size_t Feedback(int loss, char* out);
+
+ private:
+  struct Group {
+    uint16 group;
+    bool used;
+    bool done;
+    bool have_parity;
+    // number of data packets, known from the parity or the shims
+    uint8 count;
+    uint8 received;
+    uint32 mask;
+    uint16 len_xor;
+    size_t max_len;
+    char xor_buf[kFecMaxFrame];
+  };
+
+  Group* FindGroup(uint16 group, uint8 count);
+  void Retire(Group* group);
+  void TryRecover(Group* group, Output* out);
+
+  static const int kWindow = 4;
+  Group groups_[kWindow];
+  bool started_;
+  uint16 last_group_;
+  uint8 last_count_;
+  uint32 expected_;
+  uint32 missing_;
+  uint32 received_;
+  uint32 recovered_;
+  uint32 lost_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_FEC_H_
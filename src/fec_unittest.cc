@@ -0,0 +1,161 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/gunit.h"
+
+#include "fec.h"
+
+namespace tincan {
+
+class FecTest : public testing::Test {
+ protected:
+  // frame i is filled with i + 1 and is 60 + i bytes long
+  size_t MakeFrame(int i) {
+    size_t len = 60 + i;
+    memset(frame_, i + 1, len);
+    return len;
+  }
+
+  // encodes frames 0 to count - 1 and flushes the group, the frames in
+  // drop_mask and the parity, if drop_parity is set, are not decoded.
+  // Returns the number of frames recovered.
+  int SendGroup(int count, uint32 drop_mask, bool drop_parity) {
+    int recovered = 0;
+    for (int i = 0; i < count; i++) {
+      size_t len = MakeFrame(i);
+      bool complete = encoder_.Encode(frame_, len, packet_);
+      if (!(drop_mask & (1u << i))) {
+        decoder_.Decode(packet_, len + kFecShimLen, &out_);
+        EXPECT_EQ(len, out_.frame_len);
+        EXPECT_EQ(0, memcmp(out_.frame, frame_, len));
+        recovered += CheckRecovered();
+      }
+      if (complete) {
+        EXPECT_EQ(count - 1, i);
+      }
+    }
+    size_t parity_len = encoder_.Parity(packet_);
+    EXPECT_LT(0U, parity_len);
+    if (!drop_parity) {
+      decoder_.Decode(packet_, parity_len, &out_);
+      EXPECT_TRUE(out_.frame == NULL);
+      recovered += CheckRecovered();
+    }
+    return recovered;
+  }
+
+  int CheckRecovered() {
+    if (out_.recovered_len == 0) return 0;
+    int i = static_cast<int>(out_.recovered_len) - 60;
+    EXPECT_LE(0, i);
+    EXPECT_EQ(i + 1, out_.recovered[0]);
+    EXPECT_EQ(i + 1, out_.recovered[out_.recovered_len - 1]);
+    return 1;
+  }
+
+  FecEncoder encoder_;
+  FecDecoder decoder_;
+  FecDecoder::Output out_;
+  char frame_[kFecMaxFrame];
+  char packet_[kFecMaxPacket];
+};
+
+TEST_F(FecTest, PassesFramesThrough) {
+  EXPECT_EQ(0, SendGroup(16, 0, false));
+  EXPECT_EQ(16U, decoder_.received());
+  EXPECT_EQ(0U, decoder_.lost());
+  EXPECT_EQ(16U, encoder_.data_packets());
+  EXPECT_EQ(1U, encoder_.parity_packets());
+}
+
+TEST_F(FecTest, RecoversAnyLostFrame) {
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(1, SendGroup(16, 1u << i, false)) << "frame " << i;
+  }
+  EXPECT_EQ(16U, decoder_.recovered());
+}
+
+TEST_F(FecTest, RecoversInFlushedGroup) {
+  EXPECT_EQ(1, SendGroup(3, 1u << 1, false));
+  EXPECT_EQ(1, SendGroup(5, 1u << 4, false));
+  EXPECT_EQ(2U, decoder_.recovered());
+}
+
+TEST_F(FecTest, CannotRecoverTwoLosses) {
+  EXPECT_EQ(0, SendGroup(16, (1u << 2) | (1u << 9), false));
+  EXPECT_EQ(0U, decoder_.recovered());
+}
+
+TEST_F(FecTest, LostParityOfFlushedGroupsIsNoLoss) {
+  for (int g = 0; g < 20; g++) SendGroup(3, 0, true);
+  EXPECT_EQ(0U, decoder_.lost());
+  int loss = decoder_.TakeLoss();
+  EXPECT_GE(0, loss);
+}
+
+TEST_F(FecTest, MeasuresLossBeforeRecovery) {
+  // one frame of every group is lost and recovered
+  for (int g = 0; g < 10; g++) SendGroup(16, 1u << (g % 16), false);
+  int loss = decoder_.TakeLoss();
+  EXPECT_LT(40, loss);
+  EXPECT_GT(80, loss);
+  // the sample starts over after it was taken
+  EXPECT_EQ(-1, decoder_.TakeLoss());
+}
+
+TEST_F(FecTest, GroupSizeFollowsLoss) {
+  EXPECT_EQ(16, encoder_.group_size());
+  encoder_.UpdateLoss(20);
+  EXPECT_EQ(8, encoder_.group_size());
+  encoder_.UpdateLoss(100);
+  EXPECT_EQ(4, encoder_.group_size());
+  // the encoder reports the group as complete after four frames
+  for (int i = 0; i < 4; i++) {
+    size_t len = MakeFrame(i);
+    EXPECT_EQ(i == 3, encoder_.Encode(frame_, len, packet_));
+  }
+  encoder_.UpdateLoss(0);
+  EXPECT_EQ(16, encoder_.group_size());
+}
+
+TEST_F(FecTest, Feedback) {
+  char packet[kFecShimLen + 2];
+  size_t len = FecDecoder::Feedback(37, packet);
+  EXPECT_TRUE(IsFecPacket(packet, len));
+  decoder_.Decode(packet, len, &out_);
+  EXPECT_TRUE(out_.frame == NULL);
+  EXPECT_EQ(0U, out_.recovered_len);
+  EXPECT_EQ(37, out_.feedback);
+}
+
+TEST(FecCapabilityTest, Tokens) {
+  EXPECT_TRUE(IsFecCapability(kFecCapability, 2));
+  EXPECT_FALSE(IsFecCapability("b1", 2));
+  EXPECT_FALSE(IsFecCapability("f12", 3));
+  const char plain[] = "0123456789";
+  EXPECT_FALSE(IsFecPacket(plain, sizeof(plain)));
+}
+
+}  // namespace tincan
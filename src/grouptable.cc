@@ -0,0 +1,214 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/timeutils.h"
+
+#include "grouptable.h"
+
+namespace tincan {
+
+// default group membership interval of IGMPv2/MLDv1 (ms)
+static const uint32 kMembershipTtl = 260000;
+static const size_t kMaxGroups = 1024;
+
+static const size_t kMacLen = 6;
+static const size_t kEthOffset = 40;
+static const size_t kEthTypeOffset = kEthOffset + 12;
+static const size_t kPayloadOffset = kEthOffset + 14;
+
+static const uint16 kEthTypeIpv4 = 0x0800;
+static const uint16 kEthTypeIpv6 = 0x86dd;
+static const uint8 kIpProtoIgmp = 2;
+static const uint8 kIpProtoHopByHop = 0;
+static const uint8 kIpProtoIcmpv6 = 58;
+
+static const uint8 kIgmpV1Report = 0x12;
+static const uint8 kIgmpV2Report = 0x16;
+static const uint8 kIgmpLeave = 0x17;
+static const uint8 kIgmpV3Report = 0x22;
+static const uint8 kMldReport = 131;
+static const uint8 kMldDone = 132;
+static const uint8 kMldV2Report = 143;
+
+// IGMPv3/MLDv2 group record types
+static const uint8 kModeIsInclude = 1;
+static const uint8 kModeIsExclude = 2;
+static const uint8 kChangeToInclude = 3;
+static const uint8 kChangeToExclude = 4;
+static const uint8 kAllowNewSources = 5;
+
+static uint16 GetUint16(const char* data) {
+  return (static_cast<uint8>(data[0]) << 8) | static_cast<uint8>(data[1]);
+}
+
+static std::string Ipv4GroupMac(const char* group) {
+  char mac[kMacLen] = { 0x01, 0x00, 0x5e, 0, 0, 0 };
+  mac[3] = group[1] & 0x7f;
+  mac[4] = group[2];
+  mac[5] = group[3];
+  return std::string(mac, kMacLen);
+}
+
+static std::string Ipv6GroupMac(const char* group) {
+  char mac[kMacLen] = { 0x33, 0x33, 0, 0, 0, 0 };
+  memcpy(mac + 2, group + 12, 4);
+  return std::string(mac, kMacLen);
+}
+
+// a record joins the group unless it excludes every source or only blocks
+// some, source filtering is left to the receivers
+static int RecordAction(uint8 type, uint16 sources) {
+  if (type == kModeIsExclude || type == kChangeToExclude) return 1;
+  if (type == kModeIsInclude || type == kChangeToInclude ||
+      type == kAllowNewSources) {
+    return sources > 0 ? 1 : (type == kAllowNewSources ? 0 : -1);
+  }
+  return 0;
+}
+
+GroupTable::GroupTable()
+    : ttl_(kMembershipTtl) {
+}
+
+void GroupTable::Snoop(const char* data, size_t len,
+                       const std::string& peer) {
+  if (len < kPayloadOffset + 40) return;
+  uint16 type = GetUint16(data + kEthTypeOffset);
+  const char* ip = data + kPayloadOffset;
+  size_t ip_len = len - kPayloadOffset;
+  if (type == kEthTypeIpv4) {
+    size_t header_len = (ip[0] & 0x0f) * 4;
+    if (static_cast<uint8>(ip[9]) != kIpProtoIgmp || header_len < 20 ||
+        ip_len < header_len + 8) return;
+    SnoopIgmp(ip + header_len, ip_len - header_len, peer);
+  }
+  else if (type == kEthTypeIpv6) {
+    // MLD messages carry a router alert in a hop-by-hop header
+    uint8 next = ip[6];
+    size_t offset = 40;
+    if (next == kIpProtoHopByHop) {
+      if (ip_len < offset + 8) return;
+      next = ip[offset];
+      offset += (static_cast<uint8>(ip[offset + 1]) + 1) * 8;
+    }
+    if (next != kIpProtoIcmpv6 || ip_len < offset + 24) return;
+    SnoopMld(ip + offset, ip_len - offset, peer);
+  }
+}
+
+void GroupTable::SnoopIgmp(const char* igmp, size_t len,
+                           const std::string& peer) {
+  uint8 type = igmp[0];
+  if (type == kIgmpV1Report || type == kIgmpV2Report) {
+    Join(Ipv4GroupMac(igmp + 4), peer);
+  }
+  else if (type == kIgmpLeave) {
+    Leave(Ipv4GroupMac(igmp + 4), peer);
+  }
+  else if (type == kIgmpV3Report) {
+    uint16 records = GetUint16(igmp + 6);
+    size_t offset = 8;
+    for (uint16 i = 0; i < records && offset + 8 <= len; i++) {
+      const char* record = igmp + offset;
+      uint16 sources = GetUint16(record + 2);
+      int action = RecordAction(record[0], sources);
+      if (action > 0) Join(Ipv4GroupMac(record + 4), peer);
+      else if (action < 0) Leave(Ipv4GroupMac(record + 4), peer);
+      offset += 8 + sources * 4 + static_cast<uint8>(record[1]) * 4;
+    }
+  }
+}
+
+void GroupTable::SnoopMld(const char* icmp, size_t len,
+                          const std::string& peer) {
+  uint8 type = icmp[0];
+  if (type == kMldReport) {
+    Join(Ipv6GroupMac(icmp + 8), peer);
+  }
+  else if (type == kMldDone) {
+    Leave(Ipv6GroupMac(icmp + 8), peer);
+  }
+  else if (type == kMldV2Report) {
+    uint16 records = GetUint16(icmp + 6);
+    size_t offset = 8;
+    for (uint16 i = 0; i < records && offset + 20 <= len; i++) {
+      const char* record = icmp + offset;
+      uint16 sources = GetUint16(record + 2);
+      int action = RecordAction(record[0], sources);
+      if (action > 0) Join(Ipv6GroupMac(record + 4), peer);
+      else if (action < 0) Leave(Ipv6GroupMac(record + 4), peer);
+      offset += 20 + sources * 16 + static_cast<uint8>(record[1]) * 4;
+    }
+  }
+}
+
+void GroupTable::Join(const std::string& mac, const std::string& peer) {
+  std::map<std::string, Members>::iterator it = groups_.find(mac);
+  if (it == groups_.end()) {
+    if (groups_.size() >= kMaxGroups) return;
+    it = groups_.insert(std::make_pair(mac, Members())).first;
+  }
+  if (it->second.find(peer) == it->second.end()) stats_.joins++;
+  it->second[peer] = talk_base::Time();
+}
+
+void GroupTable::Leave(const std::string& mac, const std::string& peer) {
+  std::map<std::string, Members>::iterator it = groups_.find(mac);
+  if (it == groups_.end()) return;
+  if (it->second.erase(peer) > 0) stats_.leaves++;
+  if (it->second.empty()) groups_.erase(it);
+}
+
+const GroupTable::Members* GroupTable::Lookup(const char* data, size_t len) {
+  if (len < kPayloadOffset) return NULL;
+  const uint8* mac = reinterpret_cast<const uint8*>(data + kEthOffset);
+  // 224.0.0.0/24 and the ff02::1, ff02::2, ff02::16 style groups are used
+  // by routing and discovery protocols without membership reports
+  if (mac[0] == 0x01 && mac[1] == 0x00 && mac[2] == 0x5e &&
+      mac[3] == 0x00 && mac[4] == 0x00) return NULL;
+  if (mac[0] == 0x33 && mac[1] == 0x33 && mac[2] == 0x00 &&
+      mac[3] == 0x00 && mac[4] == 0x00) return NULL;
+
+  std::map<std::string, Members>::iterator it =
+      groups_.find(std::string(data + kEthOffset, kMacLen));
+  if (it == groups_.end()) return NULL;
+  uint32 now = talk_base::Time();
+  for (Members::iterator mit = it->second.begin();
+       mit != it->second.end();) {
+    if (talk_base::TimeDiff(now, mit->second) > static_cast<int>(ttl_)) {
+      it->second.erase(mit++);
+    }
+    else {
+      ++mit;
+    }
+  }
+  if (it->second.empty()) {
+    groups_.erase(it);
+    return NULL;
+  }
+  return &it->second;
+}
+
+}  // namespace tincan
@@ -0,0 +1,81 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_GROUPTABLE_H_
+#define TINCAN_GROUPTABLE_H_
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "talk/base/basictypes.h"
+
+namespace tincan {
+
+// GroupTable snoops IGMP and MLD reports received from peers and keeps the
+// peers that joined each multicast group, keyed by the group MAC address.
+// Frames start with the 40 byte ipop header followed by the ethernet frame.
+// It must only be used on the packet handling thread.
+class GroupTable {
+ public:
+  // peer short uid to time of its last report
+  typedef std::map<std::string, uint32> Members;
+
+  struct Stats {
+    Stats() : joins(0), leaves(0) {}
+    uint32 joins;
+    uint32 leaves;
+  };
+
+  GroupTable();
+
+  // membership lifetime in ms, peers repeat their reports when queried
+  void set_ttl(uint32 ttl) { ttl_ = ttl; }
+
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+  size_t size() const { return groups_.size(); }
+
+  // peer is the short uid of the link the frame came from
+  void Snoop(const char* data, size_t len, const std::string& peer);
+
+  // returns NULL when the frame must be flooded to every peer: broadcast,
+  // link local control groups and groups nobody reported
+  const Members* Lookup(const char* data, size_t len);
+
+  void Clear() { groups_.clear(); }
+
+ private:
+  void SnoopIgmp(const char* igmp, size_t len, const std::string& peer);
+  void SnoopMld(const char* icmp, size_t len, const std::string& peer);
+  void Join(const std::string& mac, const std::string& peer);
+  void Leave(const std::string& mac, const std::string& peer);
+
+  uint32 ttl_;
+  Stats stats_;
+  std::map<std::string, Members> groups_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_GROUPTABLE_H_
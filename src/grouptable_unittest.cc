@@ -0,0 +1,169 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include <string>
+
+#include "talk/base/gunit.h"
+
+#include "grouptable.h"
+
+namespace tincan {
+
+static const size_t kEthOffset = 40;
+static const size_t kPayloadOffset = kEthOffset + 14;
+static const size_t kFrameLen = 160;
+
+static const uint8 kGroup4[4] = { 239, 1, 2, 3 };
+static const uint8 kGroupMac4[6] = { 0x01, 0x00, 0x5e, 0x01, 0x02, 0x03 };
+static const uint8 kGroup6[16] = { 0xff, 0x05, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0x12, 0x34, 0x56, 0x78 };
+static const uint8 kGroupMac6[6] = { 0x33, 0x33, 0x12, 0x34, 0x56, 0x78 };
+
+// IPv4 frame with a router alert option, returns the IGMP message
+static char* MakeIgmp(char* frame, uint8 type) {
+  memset(frame, 0, kFrameLen);
+  frame[kEthOffset + 12] = 0x08;
+  char* ip = frame + kPayloadOffset;
+  ip[0] = 0x46;
+  ip[9] = 2;
+  char* igmp = ip + 24;
+  igmp[0] = type;
+  return igmp;
+}
+
+// IPv6 frame with a hop-by-hop header, returns the ICMPv6 message
+static char* MakeMld(char* frame, uint8 type) {
+  memset(frame, 0, kFrameLen);
+  frame[kEthOffset + 12] = static_cast<char>(0x86);
+  frame[kEthOffset + 13] = static_cast<char>(0xdd);
+  char* ip = frame + kPayloadOffset;
+  ip[0] = 0x60;
+  ip[6] = 0;
+  ip[40] = 58;
+  char* icmp = ip + 48;
+  icmp[0] = type;
+  return icmp;
+}
+
+// frame read from the tap for the group MAC
+static void MakeData(char* frame, const uint8* mac) {
+  memset(frame, 0, kFrameLen);
+  memcpy(frame + kEthOffset, mac, 6);
+}
+
+TEST(GroupTableTest, IgmpJoinAndLeave) {
+  GroupTable table;
+  char frame[kFrameLen];
+  char* igmp = MakeIgmp(frame, 0x16);
+  memcpy(igmp + 4, kGroup4, 4);
+  table.Snoop(frame, sizeof(frame), "peer1");
+  table.Snoop(frame, sizeof(frame), "peer2");
+  // a repeated report only refreshes the membership
+  table.Snoop(frame, sizeof(frame), "peer1");
+  EXPECT_EQ(2U, table.stats().joins);
+
+  char data[kFrameLen];
+  MakeData(data, kGroupMac4);
+  const GroupTable::Members* members = table.Lookup(data, sizeof(data));
+  ASSERT_TRUE(members != NULL);
+  EXPECT_EQ(2U, members->size());
+
+  igmp = MakeIgmp(frame, 0x17);
+  memcpy(igmp + 4, kGroup4, 4);
+  table.Snoop(frame, sizeof(frame), "peer1");
+  table.Snoop(frame, sizeof(frame), "peer2");
+  EXPECT_EQ(2U, table.stats().leaves);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+  EXPECT_EQ(0U, table.size());
+}
+
+TEST(GroupTableTest, IgmpV3Records) {
+  GroupTable table;
+  char frame[kFrameLen];
+  char* igmp = MakeIgmp(frame, 0x22);
+  igmp[7] = 1;
+  // EXCLUDE with no sources joins the group
+  igmp[8] = 4;
+  memcpy(igmp + 12, kGroup4, 4);
+  table.Snoop(frame, sizeof(frame), "peer1");
+  char data[kFrameLen];
+  MakeData(data, kGroupMac4);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) != NULL);
+
+  // INCLUDE with no sources leaves it
+  igmp[8] = 3;
+  table.Snoop(frame, sizeof(frame), "peer1");
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+}
+
+TEST(GroupTableTest, MldJoin) {
+  GroupTable table;
+  char frame[kFrameLen];
+  char* icmp = MakeMld(frame, 131);
+  memcpy(icmp + 8, kGroup6, 16);
+  table.Snoop(frame, sizeof(frame), "peer1");
+
+  char data[kFrameLen];
+  MakeData(data, kGroupMac6);
+  const GroupTable::Members* members = table.Lookup(data, sizeof(data));
+  ASSERT_TRUE(members != NULL);
+  EXPECT_EQ(1U, members->count("peer1"));
+}
+
+TEST(GroupTableTest, FloodsUnknownAndLinkLocalGroups) {
+  GroupTable table;
+  char data[kFrameLen];
+  const uint8 broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  MakeData(data, broadcast);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+  MakeData(data, kGroupMac4);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+
+  // reports for 224.0.0.251 do not stop flooding of link local groups
+  const uint8 mdns[4] = { 224, 0, 0, 251 };
+  const uint8 mdns_mac[6] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb };
+  char frame[kFrameLen];
+  char* igmp = MakeIgmp(frame, 0x16);
+  memcpy(igmp + 4, mdns, 4);
+  table.Snoop(frame, sizeof(frame), "peer1");
+  MakeData(data, mdns_mac);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+}
+
+TEST(GroupTableTest, ExpiresMembers) {
+  GroupTable table;
+  char frame[kFrameLen];
+  char* igmp = MakeIgmp(frame, 0x16);
+  memcpy(igmp + 4, kGroup4, 4);
+  table.Snoop(frame, sizeof(frame), "peer1");
+  // a negative age never happens, so a ttl of -1 ms expires everything
+  table.set_ttl(static_cast<uint32>(-1));
+  char data[kFrameLen];
+  MakeData(data, kGroupMac4);
+  EXPECT_TRUE(table.Lookup(data, sizeof(data)) == NULL);
+  EXPECT_EQ(0U, table.size());
+}
+
+}  // namespace tincan
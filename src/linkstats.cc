@@ -0,0 +1,181 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/timeutils.h"
+
+#include "linkstats.h"
+
+namespace tincan {
+
+static const char* const kPhaseNames[PHASE_COUNT] = {
+  "create_link",
+  "first_candidate",
+  "allocation_done",
+  "con_resp_sent",
+  "remote_candidates",
+  "stun_success",
+  "ice_writable",
+  "dtls_done",
+  "online",
+};
+
+const char* LinkPhaseName(LinkPhase phase) {
+  return kPhaseNames[phase];
+}
+
+LinkTimes::LinkTimes() {
+  Reset();
+}
+
+void LinkTimes::Reset() {
+  memset(times_, 0, sizeof(times_));
+  memset(recorded_, 0, sizeof(recorded_));
+}
+
+void LinkTimes::Mark(LinkPhase phase) {
+  Mark(phase, talk_base::Time());
+}
+
+void LinkTimes::Mark(LinkPhase phase, uint32 time) {
+  if (recorded_[phase]) return;
+  times_[phase] = time;
+  recorded_[phase] = true;
+}
+
+uint32 LinkTimes::Elapsed(LinkPhase phase) const {
+  if (!recorded_[phase] || !recorded_[PHASE_CREATE_LINK]) return 0;
+  return talk_base::TimeDiff(times_[phase], times_[PHASE_CREATE_LINK]);
+}
+
+uint32 LinkTimes::Age() const {
+  if (!recorded_[PHASE_CREATE_LINK]) return 0;
+  return talk_base::TimeSince(times_[PHASE_CREATE_LINK]);
+}
+
+LinkPhase LinkTimes::last() const {
+  // phases can complete out of order, e.g. candidates arrive before ours
+  // are sent, so the latest one by time is taken
+  LinkPhase last = PHASE_CREATE_LINK;
+  for (int i = PHASE_FIRST_CANDIDATE; i < PHASE_COUNT; i++) {
+    LinkPhase phase = static_cast<LinkPhase>(i);
+    if (has(phase) && Elapsed(phase) >= Elapsed(last)) last = phase;
+  }
+  return last;
+}
+
+Json::Value LinkTimes::ToJson() const {
+  Json::Value times(Json::objectValue);
+  for (int i = PHASE_FIRST_CANDIDATE; i < PHASE_COUNT; i++) {
+    LinkPhase phase = static_cast<LinkPhase>(i);
+    if (has(phase)) times[kPhaseNames[i]] = Elapsed(phase);
+  }
+  return times;
+}
+
+void LinkSetupStats::Histogram::Add(uint32 value) {
+  // bucket 0 holds values below 1 ms, bucket i holds [2^(i-1), 2^i) ms
+  int bucket = 0;
+  while (bucket < kBuckets - 1 && (value >> bucket) != 0) bucket++;
+  buckets[bucket]++;
+  count++;
+  sum += value;
+  if (value > max) max = value;
+}
+
+uint32 LinkSetupStats::Histogram::Percentile(double fraction) const {
+  // the upper bound of the bucket holding the percentile is reported
+  uint32 target = static_cast<uint32>(count * fraction);
+  uint32 seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += buckets[i];
+    if (seen > target) return i == 0 ? 1 : (1 << i);
+  }
+  return max;
+}
+
+Json::Value LinkSetupStats::Histogram::ToJson() const {
+  Json::Value hist(Json::objectValue);
+  hist["count"] = count;
+  if (count == 0) return hist;
+  hist["mean"] = sum / count;
+  hist["max"] = max;
+  hist["p50"] = Percentile(0.5);
+  hist["p90"] = Percentile(0.9);
+  hist["p99"] = Percentile(0.99);
+  Json::Value counts(Json::arrayValue);
+  for (int i = 0; i < kBuckets; i++) {
+    counts.append(buckets[i]);
+  }
+  hist["buckets"] = counts;
+  return hist;
+}
+
+LinkSetupStats::LinkSetupStats() {
+  Clear();
+}
+
+void LinkSetupStats::Clear() {
+  memset(phases_, 0, sizeof(phases_));
+  memset(failed_phases_, 0, sizeof(failed_phases_));
+  memset(&failed_age_, 0, sizeof(failed_age_));
+  memset(stalled_, 0, sizeof(stalled_));
+}
+
+void LinkSetupStats::Record(const LinkTimes& times) {
+  for (int i = PHASE_FIRST_CANDIDATE; i < PHASE_COUNT; i++) {
+    LinkPhase phase = static_cast<LinkPhase>(i);
+    if (times.has(phase)) phases_[i].Add(times.Elapsed(phase));
+  }
+}
+
+void LinkSetupStats::RecordFailure(const LinkTimes& times) {
+  for (int i = PHASE_FIRST_CANDIDATE; i < PHASE_COUNT; i++) {
+    LinkPhase phase = static_cast<LinkPhase>(i);
+    if (times.has(phase)) failed_phases_[i].Add(times.Elapsed(phase));
+  }
+  failed_age_.Add(times.Age());
+  stalled_[times.last()]++;
+}
+
+Json::Value LinkSetupStats::ToJson() const {
+  Json::Value stats(Json::objectValue);
+  for (int i = PHASE_FIRST_CANDIDATE; i < PHASE_COUNT; i++) {
+    stats[kPhaseNames[i]] = phases_[i].ToJson();
+  }
+  Json::Value failed(Json::objectValue);
+  failed["removed"] = failed_age_.ToJson();
+  Json::Value stalled(Json::objectValue);
+  for (int i = PHASE_CREATE_LINK; i < PHASE_COUNT; i++) {
+    if (stalled_[i] != 0) stalled[kPhaseNames[i]] = stalled_[i];
+    if (i > PHASE_CREATE_LINK && failed_phases_[i].count != 0) {
+      failed[kPhaseNames[i]] = failed_phases_[i].ToJson();
+    }
+  }
+  failed["stalled_after"] = stalled;
+  stats["failed"] = failed;
+  return stats;
+}
+
+}  // namespace tincan
@@ -0,0 +1,115 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_LINKSTATS_H_
+#define TINCAN_LINKSTATS_H_
+#pragma once
+
+#include "talk/base/basictypes.h"
+#include "talk/base/json.h"
+
+namespace tincan {
+
+// phases of link establishment in the order they normally happen
+enum LinkPhase {
+  PHASE_CREATE_LINK = 0,
+  PHASE_FIRST_CANDIDATE,
+  PHASE_ALLOCATION_DONE,
+  PHASE_CON_RESP_SENT,
+  PHASE_REMOTE_CANDIDATES,
+  PHASE_STUN_SUCCESS,
+  PHASE_ICE_WRITABLE,
+  PHASE_DTLS_DONE,
+  PHASE_ONLINE,
+  PHASE_COUNT,
+};
+
+// LinkTimes keeps the time at which a single link first reached each phase
+class LinkTimes {
+ public:
+  LinkTimes();
+
+  void Reset();
+
+  // only the first occurrence of a phase is recorded
+  void Mark(LinkPhase phase);
+  void Mark(LinkPhase phase, uint32 time);
+
+  bool has(LinkPhase phase) const { return recorded_[phase]; }
+
+  // ms elapsed between create_link and the given phase
+  uint32 Elapsed(LinkPhase phase) const;
+
+  // ms since create_link
+  uint32 Age() const;
+
+  // the latest phase that was reached
+  LinkPhase last() const;
+
+  Json::Value ToJson() const;
+
+ private:
+  uint32 times_[PHASE_COUNT];
+  bool recorded_[PHASE_COUNT];
+};
+
+// LinkSetupStats aggregates the phase times of all links into log2
+// histograms so slow STUN servers or DTLS stalls stand out at scale. Links
+// removed before they came online are kept apart with the phase they
+// stalled after.
+class LinkSetupStats {
+ public:
+  LinkSetupStats();
+
+  void Record(const LinkTimes& times);
+
+  void RecordFailure(const LinkTimes& times);
+
+  void Clear();
+
+  Json::Value ToJson() const;
+
+ private:
+  static const int kBuckets = 18;
+
+  struct Histogram {
+    uint32 buckets[kBuckets];
+    uint32 count;
+    uint32 max;
+    double sum;
+    void Add(uint32 value);
+    uint32 Percentile(double fraction) const;
+    Json::Value ToJson() const;
+  };
+
+  Histogram phases_[PHASE_COUNT];
+  Histogram failed_phases_[PHASE_COUNT];
+  Histogram failed_age_;
+  uint32 stalled_[PHASE_COUNT];
+};
+
+const char* LinkPhaseName(LinkPhase phase);
+
+}  // namespace tincan
+
+#endif  // TINCAN_LINKSTATS_H_
@@ -0,0 +1,155 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "talk/base/gunit.h"
+
+#include "linkstats.h"
+
+namespace tincan {
+
+TEST(LinkStatsTest, MarksFirstOccurrence) {
+  LinkTimes times;
+  EXPECT_FALSE(times.has(PHASE_CREATE_LINK));
+  EXPECT_EQ(0U, times.Elapsed(PHASE_ONLINE));
+
+  times.Mark(PHASE_CREATE_LINK);
+  times.Mark(PHASE_FIRST_CANDIDATE);
+  EXPECT_TRUE(times.has(PHASE_CREATE_LINK));
+  EXPECT_TRUE(times.has(PHASE_FIRST_CANDIDATE));
+  EXPECT_FALSE(times.has(PHASE_ONLINE));
+  // a phase that was not reached has no elapsed time
+  EXPECT_EQ(0U, times.Elapsed(PHASE_ONLINE));
+  EXPECT_GT(1000U, times.Elapsed(PHASE_FIRST_CANDIDATE));
+
+  times.Reset();
+  EXPECT_FALSE(times.has(PHASE_CREATE_LINK));
+  EXPECT_FALSE(times.has(PHASE_FIRST_CANDIDATE));
+}
+
+TEST(LinkStatsTest, ElapsedNeedsCreateLink) {
+  LinkTimes times;
+  times.Mark(PHASE_STUN_SUCCESS);
+  EXPECT_TRUE(times.has(PHASE_STUN_SUCCESS));
+  EXPECT_EQ(0U, times.Elapsed(PHASE_STUN_SUCCESS));
+}
+
+TEST(LinkStatsTest, TimesToJson) {
+  LinkTimes times;
+  times.Mark(PHASE_CREATE_LINK);
+  times.Mark(PHASE_ALLOCATION_DONE);
+  times.Mark(PHASE_ONLINE);
+  Json::Value json = times.ToJson();
+  // create_link is the reference point and is not reported
+  EXPECT_FALSE(json.isMember(LinkPhaseName(PHASE_CREATE_LINK)));
+  EXPECT_FALSE(json.isMember(LinkPhaseName(PHASE_FIRST_CANDIDATE)));
+  EXPECT_TRUE(json.isMember("allocation_done"));
+  EXPECT_TRUE(json.isMember("online"));
+  EXPECT_EQ(2U, json.size());
+}
+
+TEST(LinkStatsTest, RecordAndClear) {
+  LinkSetupStats stats;
+  LinkTimes times;
+  times.Mark(PHASE_CREATE_LINK);
+  times.Mark(PHASE_FIRST_CANDIDATE);
+  times.Mark(PHASE_ONLINE);
+  for (int i = 0; i < 4; i++) stats.Record(times);
+
+  Json::Value json = stats.ToJson();
+  EXPECT_EQ(4U, json["online"]["count"].asUInt());
+  EXPECT_EQ(4U, json["first_candidate"]["count"].asUInt());
+  EXPECT_EQ(0U, json["dtls_done"]["count"].asUInt());
+  EXPECT_FALSE(json["dtls_done"].isMember("p50"));
+  EXPECT_EQ(static_cast<Json::UInt>(18),
+            json["online"]["buckets"].size());
+
+  stats.Clear();
+  json = stats.ToJson();
+  EXPECT_EQ(0U, json["online"]["count"].asUInt());
+}
+TEST(LinkStatsTest, Percentiles) {
+  LinkSetupStats stats;
+  // 90 links come online after 100 ms and 10 after 3000 ms
+  for (int i = 0; i < 100; i++) {
+    LinkTimes times;
+    times.Mark(PHASE_CREATE_LINK, 1000);
+    times.Mark(PHASE_ONLINE, i < 90 ? 1100 : 4000);
+    stats.Record(times);
+  }
+  Json::Value online = stats.ToJson()["online"];
+  EXPECT_EQ(100U, online["count"].asUInt());
+  EXPECT_EQ(3000U, online["max"].asUInt());
+  EXPECT_DOUBLE_EQ(390.0, online["mean"].asDouble());
+  // the upper bound of the bucket is reported, [64, 128) and [2048, 4096)
+  EXPECT_EQ(128U, online["p50"].asUInt());
+  EXPECT_EQ(4096U, online["p90"].asUInt());
+  EXPECT_EQ(4096U, online["p99"].asUInt());
+  EXPECT_EQ(90U, online["buckets"][7].asUInt());
+  EXPECT_EQ(10U, online["buckets"][12].asUInt());
+}
+
+TEST(LinkStatsTest, LastPhaseByTime) {
+  LinkTimes times;
+  EXPECT_EQ(PHASE_CREATE_LINK, times.last());
+  times.Mark(PHASE_CREATE_LINK, 1000);
+  times.Mark(PHASE_REMOTE_CANDIDATES, 1200);
+  // our candidates went out after the remote ones arrived
+  times.Mark(PHASE_FIRST_CANDIDATE, 1300);
+  EXPECT_EQ(PHASE_FIRST_CANDIDATE, times.last());
+  times.Mark(PHASE_STUN_SUCCESS, 1500);
+  EXPECT_EQ(PHASE_STUN_SUCCESS, times.last());
+  // a later mark of a recorded phase is ignored
+  times.Mark(PHASE_FIRST_CANDIDATE, 2000);
+  EXPECT_EQ(300U, times.Elapsed(PHASE_FIRST_CANDIDATE));
+  EXPECT_EQ(PHASE_STUN_SUCCESS, times.last());
+}
+
+TEST(LinkStatsTest, RecordFailure) {
+  LinkSetupStats stats;
+  LinkTimes times;
+  times.Mark(PHASE_CREATE_LINK);
+  times.Mark(PHASE_STUN_SUCCESS);
+  stats.RecordFailure(times);
+  stats.RecordFailure(times);
+  LinkTimes created;
+  created.Mark(PHASE_CREATE_LINK);
+  stats.RecordFailure(created);
+
+  Json::Value json = stats.ToJson();
+  // failed links stay out of the setup histograms
+  EXPECT_EQ(0U, json["stun_success"]["count"].asUInt());
+  Json::Value failed = json["failed"];
+  EXPECT_EQ(3U, failed["removed"]["count"].asUInt());
+  EXPECT_EQ(2U, failed["stun_success"]["count"].asUInt());
+  EXPECT_FALSE(failed.isMember("dtls_done"));
+  EXPECT_EQ(2U, failed["stalled_after"]["stun_success"].asUInt());
+  EXPECT_EQ(1U, failed["stalled_after"]["create_link"].asUInt());
+  EXPECT_FALSE(failed["stalled_after"].isMember("ice_writable"));
+
+  stats.Clear();
+  failed = stats.ToJson()["failed"];
+  EXPECT_EQ(0U, failed["removed"]["count"].asUInt());
+  EXPECT_EQ(0U, failed["stalled_after"].size());
+}
+
+}  // namespace tincan
@@ -0,0 +1,299 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/timeutils.h"
+
+#include "neighborcache.h"
+
+namespace tincan {
+
+// default lifetime of entries learned from traffic (ms)
+static const uint32 kNeighborTtl = 300000;
+// default minimum time between two floods for one target (ms)
+static const uint32 kFloodInterval = 1000;
+static const size_t kMaxEntries = 4096;
+
+static const size_t kUidLen = 20;
+static const size_t kMacLen = 6;
+// offsets within the frame, the ethernet frame follows the ipop header
+static const size_t kEthOffset = 2 * kUidLen;
+static const size_t kEthDstOffset = kEthOffset;
+static const size_t kEthSrcOffset = kEthOffset + 6;
+static const size_t kEthTypeOffset = kEthOffset + 12;
+static const size_t kPayloadOffset = kEthOffset + 14;
+
+static const uint16 kEthTypeIpv4 = 0x0800;
+static const uint16 kEthTypeArp = 0x0806;
+static const uint16 kEthTypeIpv6 = 0x86dd;
+
+// ARP for IPv4 over ethernet
+static const size_t kArpOpOffset = kPayloadOffset + 6;
+static const size_t kArpShaOffset = kPayloadOffset + 8;
+static const size_t kArpSpaOffset = kPayloadOffset + 14;
+static const size_t kArpThaOffset = kPayloadOffset + 18;
+static const size_t kArpTpaOffset = kPayloadOffset + 24;
+static const size_t kArpLen = kPayloadOffset + 28;
+static const uint16 kArpRequest = 1;
+static const uint16 kArpReply = 2;
+
+static const size_t kIpv4SrcOffset = kPayloadOffset + 12;
+static const size_t kIpv4Len = kPayloadOffset + 20;
+
+// IPv6 header followed by an ICMPv6 neighbor solicitation/advertisement
+static const size_t kIpv6NextOffset = kPayloadOffset + 6;
+static const size_t kIpv6SrcOffset = kPayloadOffset + 8;
+static const size_t kIpv6DstOffset = kPayloadOffset + 24;
+static const size_t kIcmpOffset = kPayloadOffset + 40;
+static const size_t kNdTargetOffset = kIcmpOffset + 8;
+static const size_t kNdOptionOffset = kIcmpOffset + 24;
+static const size_t kNsLen = kNdOptionOffset;
+static const size_t kNaLen = kNdOptionOffset + 8;
+static const uint8 kIpProtoIcmpv6 = 58;
+static const uint8 kNeighborSolicit = 135;
+static const uint8 kNeighborAdvert = 136;
+// solicited and override flags
+static const uint8 kNaFlags = 0x60;
+static const uint8 kOptTargetLinkAddr = 2;
+
+static uint16 GetUint16(const char* data) {
+  return (static_cast<uint8>(data[0]) << 8) | static_cast<uint8>(data[1]);
+}
+
+static void SetUint16(char* data, uint16 value) {
+  data[0] = static_cast<char>(value >> 8);
+  data[1] = static_cast<char>(value & 0xff);
+}
+
+static bool IsZero(const char* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] != 0) return false;
+  }
+  return true;
+}
+
+// ICMPv6 checksum over the pseudo header and the message
+static uint16 Icmpv6Checksum(const char* src, const char* dst,
+                             const char* msg, size_t len) {
+  uint32 sum = 0;
+  for (size_t i = 0; i < 16; i += 2) {
+    sum += GetUint16(src + i) + GetUint16(dst + i);
+  }
+  sum += static_cast<uint32>(len) + kIpProtoIcmpv6;
+  for (size_t i = 0; i + 1 < len; i += 2) sum += GetUint16(msg + i);
+  if (len & 1) sum += static_cast<uint8>(msg[len - 1]) << 8;
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16>(~sum);
+}
+
+NeighborCache::NeighborCache()
+    : ttl_(kNeighborTtl),
+      flood_interval_(kFloodInterval) {
+}
+
+void NeighborCache::Learn(const char* data, size_t len) {
+  if (len < kPayloadOffset) return;
+  // group addresses are never the sender
+  if (data[kEthSrcOffset] & 0x01) return;
+  uint16 type = GetUint16(data + kEthTypeOffset);
+  if (type == kEthTypeArp && len >= kArpLen) {
+    if (IsZero(data + kArpSpaOffset, 4)) return;
+    Update(std::string(data + kArpSpaOffset, 4), data,
+           data + kArpShaOffset);
+  }
+  else if (type == kEthTypeIpv4 && len >= kIpv4Len) {
+    Update(std::string(data + kIpv4SrcOffset, 4), data,
+           data + kEthSrcOffset);
+  }
+  else if (type == kEthTypeIpv6 && len >= kIcmpOffset) {
+    if (IsZero(data + kIpv6SrcOffset, 16)) return;
+    Update(std::string(data + kIpv6SrcOffset, 16), data,
+           data + kEthSrcOffset);
+  }
+}
+
+void NeighborCache::Update(const std::string& ip, const char* uid,
+                           const char* mac) {
+  std::map<std::string, Entry>::iterator it = entries_.find(ip);
+  uint32 now = talk_base::Time();
+  if (it == entries_.end()) {
+    if (entries_.size() >= kMaxEntries) {
+      for (std::map<std::string, Entry>::iterator eit = entries_.begin();
+           eit != entries_.end();) {
+        if (!eit->second.fixed &&
+            talk_base::TimeDiff(now, eit->second.time) >
+            static_cast<int>(ttl_)) {
+          entries_.erase(eit++);
+        }
+        else {
+          ++eit;
+        }
+      }
+      if (entries_.size() >= kMaxEntries) return;
+    }
+    it = entries_.insert(std::make_pair(ip, Entry())).first;
+    it->second.fixed = false;
+  }
+  Entry& entry = it->second;
+  // the same (uid, mac) is seen on every frame, only refresh the time
+  if (entry.mac.size() != kMacLen ||
+      memcmp(entry.mac.data(), mac, kMacLen) != 0 ||
+      memcmp(entry.uid.data(), uid, kUidLen) != 0) {
+    entry.uid.assign(uid, kUidLen);
+    entry.mac.assign(mac, kMacLen);
+  }
+  entry.time = now;
+}
+
+void NeighborCache::AddMapping(const std::string& ip, const std::string& uid) {
+  if ((ip.size() != 4 && ip.size() != 16) || uid.size() != kUidLen) return;
+  Entry& entry = entries_[ip];
+  if (entry.uid != uid) {
+    entry.uid = uid;
+    entry.mac.clear();
+  }
+  entry.time = talk_base::Time();
+  entry.fixed = true;
+}
+
+void NeighborCache::Clear() {
+  entries_.clear();
+  floods_.clear();
+}
+
+const NeighborCache::Entry* NeighborCache::Find(const std::string& ip) {
+  std::map<std::string, Entry>::iterator it = entries_.find(ip);
+  if (it == entries_.end()) return NULL;
+  if (!it->second.fixed &&
+      talk_base::TimeSince(it->second.time) > static_cast<int>(ttl_)) {
+    entries_.erase(it);
+    return NULL;
+  }
+  return &it->second;
+}
+
+NeighborCache::Action NeighborCache::Miss(const std::string& ip) {
+  uint32 now = talk_base::Time();
+  std::map<std::string, uint32>::iterator it = floods_.find(ip);
+  if (it != floods_.end() &&
+      talk_base::TimeDiff(now, it->second) <
+      static_cast<int>(flood_interval_)) {
+    stats_.drops++;
+    return DROP;
+  }
+  if (it == floods_.end() && floods_.size() >= kMaxEntries) floods_.clear();
+  floods_[ip] = now;
+  stats_.floods++;
+  return PASS;
+}
+
+NeighborCache::Action NeighborCache::Resolve(const char* data, size_t len,
+                                             std::string* out) {
+  if (len < kPayloadOffset) return PASS;
+  uint16 type = GetUint16(data + kEthTypeOffset);
+  std::string target;
+  if (type == kEthTypeArp && len >= kArpLen) {
+    if (GetUint16(data + kArpOpOffset) != kArpRequest) return PASS;
+    // gratuitous ARP announces the sender, there is nothing to answer
+    if (memcmp(data + kArpSpaOffset, data + kArpTpaOffset, 4) == 0) {
+      return PASS;
+    }
+    target.assign(data + kArpTpaOffset, 4);
+  }
+  else if (type == kEthTypeIpv6 && len >= kNsLen) {
+    if (static_cast<uint8>(data[kIpv6NextOffset]) != kIpProtoIcmpv6 ||
+        static_cast<uint8>(data[kIcmpOffset]) != kNeighborSolicit) {
+      return PASS;
+    }
+    // duplicate address detection must reach the real owner
+    if (IsZero(data + kIpv6SrcOffset, 16)) return PASS;
+    target.assign(data + kNdTargetOffset, 16);
+  }
+  else {
+    return PASS;
+  }
+
+  stats_.requests++;
+  const Entry* entry = Find(target);
+  if (entry == NULL) return Miss(target);
+  if (entry->mac.empty()) {
+    stats_.unicasts++;
+    *out = entry->uid;
+    return UNICAST;
+  }
+  stats_.replies++;
+  if (type == kEthTypeArp) ReplyArp(data, *entry, out);
+  else ReplyNeighbor(data, *entry, out);
+  return REPLY;
+}
+
+void NeighborCache::ReplyArp(const char* data, const Entry& entry,
+                             std::string* out) {
+  out->assign(kArpLen, 0);
+  char* reply = &(*out)[0];
+  // the answer looks like it came from the owner of the address
+  memcpy(reply, entry.uid.data(), kUidLen);
+  memcpy(reply + kUidLen, data, kUidLen);
+  memcpy(reply + kEthDstOffset, data + kEthSrcOffset, kMacLen);
+  memcpy(reply + kEthSrcOffset, entry.mac.data(), kMacLen);
+  SetUint16(reply + kEthTypeOffset, kEthTypeArp);
+  // hardware and protocol type and sizes are those of the request
+  memcpy(reply + kPayloadOffset, data + kPayloadOffset, 6);
+  SetUint16(reply + kArpOpOffset, kArpReply);
+  memcpy(reply + kArpShaOffset, entry.mac.data(), kMacLen);
+  memcpy(reply + kArpSpaOffset, data + kArpTpaOffset, 4);
+  memcpy(reply + kArpThaOffset, data + kArpShaOffset, kMacLen);
+  memcpy(reply + kArpTpaOffset, data + kArpSpaOffset, 4);
+}
+
+void NeighborCache::ReplyNeighbor(const char* data, const Entry& entry,
+                                  std::string* out) {
+  out->assign(kNaLen, 0);
+  char* reply = &(*out)[0];
+  memcpy(reply, entry.uid.data(), kUidLen);
+  memcpy(reply + kUidLen, data, kUidLen);
+  memcpy(reply + kEthDstOffset, data + kEthSrcOffset, kMacLen);
+  memcpy(reply + kEthSrcOffset, entry.mac.data(), kMacLen);
+  SetUint16(reply + kEthTypeOffset, kEthTypeIpv6);
+
+  // IPv6 header, the advertisement goes from the target to the solicitor
+  reply[kPayloadOffset] = 0x60;
+  SetUint16(reply + kPayloadOffset + 4, kNaLen - kIcmpOffset);
+  reply[kIpv6NextOffset] = kIpProtoIcmpv6;
+  reply[kPayloadOffset + 7] = static_cast<char>(255);
+  memcpy(reply + kIpv6SrcOffset, data + kNdTargetOffset, 16);
+  memcpy(reply + kIpv6DstOffset, data + kIpv6SrcOffset, 16);
+
+  reply[kIcmpOffset] = kNeighborAdvert;
+  reply[kIcmpOffset + 4] = kNaFlags;
+  memcpy(reply + kNdTargetOffset, data + kNdTargetOffset, 16);
+  reply[kNdOptionOffset] = kOptTargetLinkAddr;
+  reply[kNdOptionOffset + 1] = 1;
+  memcpy(reply + kNdOptionOffset + 2, entry.mac.data(), kMacLen);
+  SetUint16(reply + kIcmpOffset + 2,
+            Icmpv6Checksum(reply + kIpv6SrcOffset, reply + kIpv6DstOffset,
+                           reply + kIcmpOffset, kNaLen - kIcmpOffset));
+}
+
+}  // namespace tincan
@@ -0,0 +1,112 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_NEIGHBORCACHE_H_
+#define TINCAN_NEIGHBORCACHE_H_
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "talk/base/basictypes.h"
+
+namespace tincan {
+
+// NeighborCache maps overlay IP addresses to the MAC address and uid of the
+// peer that owns them. In switch mode it answers ARP requests and IPv6
+// neighbor solicitations from the tap, so that they do not have to be
+// flooded to every peer. All frames start with the 40 byte ipop header
+// (source and destination uid) followed by the ethernet frame. It must only
+// be used on the packet handling thread.
+class NeighborCache {
+ public:
+  enum Action {
+    // not a resolution request or a cache miss, send the frame as usual
+    PASS,
+    // *out holds the answer for the tap
+    REPLY,
+    // *out holds the uid of the peer that owns the target address
+    UNICAST,
+    // a miss for a target that was flooded too recently
+    DROP,
+  };
+
+  struct Stats {
+    Stats() : requests(0), replies(0), unicasts(0), floods(0), drops(0) {}
+    uint32 requests;
+    uint32 replies;
+    uint32 unicasts;
+    uint32 floods;
+    uint32 drops;
+  };
+
+  NeighborCache();
+
+  // ttl of learned entries and the minimum time between two floods for
+  // the same target, both in ms
+  void set_ttl(uint32 ttl) { ttl_ = ttl; }
+  void set_flood_interval(uint32 interval) { flood_interval_ = interval; }
+
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+  size_t size() const { return entries_.size(); }
+
+  // learns the sender of a frame received from a peer
+  void Learn(const char* data, size_t len);
+
+  // ip is 4 or 16 bytes in network order and uid is 20 bytes, the entry
+  // has no MAC address so requests for it are unicast to the owner
+  void AddMapping(const std::string& ip, const std::string& uid);
+
+  void Clear();
+
+  // data is a frame read from the tap
+  Action Resolve(const char* data, size_t len, std::string* out);
+
+ private:
+  struct Entry {
+    std::string uid;
+    std::string mac;
+    uint32 time;
+    // set_remote_ip mappings do not expire
+    bool fixed;
+  };
+
+  void Update(const std::string& ip, const char* uid, const char* mac);
+  const Entry* Find(const std::string& ip);
+  Action Miss(const std::string& ip);
+  void ReplyArp(const char* data, const Entry& entry, std::string* out);
+  void ReplyNeighbor(const char* data, const Entry& entry, std::string* out);
+
+  uint32 ttl_;
+  uint32 flood_interval_;
+  Stats stats_;
+  // IP address bytes to entry
+  std::map<std::string, Entry> entries_;
+  // IP address bytes to time of the last flood for it
+  std::map<std::string, uint32> floods_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_NEIGHBORCACHE_H_
@@ -0,0 +1,197 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include <string>
+
+#include "talk/base/gunit.h"
+
+#include "neighborcache.h"
+
+namespace tincan {
+
+static const size_t kUidLen = 20;
+static const size_t kEthOffset = 2 * kUidLen;
+static const size_t kPayloadOffset = kEthOffset + 14;
+static const size_t kArpFrameLen = kPayloadOffset + 28;
+static const size_t kNsFrameLen = kPayloadOffset + 40 + 24;
+
+static const uint8 kMacA[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+static const uint8 kMacB[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+static const uint8 kIpA[4] = { 10, 0, 0, 1 };
+static const uint8 kIpB[4] = { 10, 0, 0, 2 };
+
+static void SetHeader(char* frame, char src_uid, char dst_uid,
+                      const uint8* src_mac, uint16 type) {
+  memset(frame, src_uid, kUidLen);
+  memset(frame + kUidLen, dst_uid, kUidLen);
+  memset(frame + kEthOffset, 0xff, 6);
+  memcpy(frame + kEthOffset + 6, src_mac, 6);
+  frame[kEthOffset + 12] = static_cast<char>(type >> 8);
+  frame[kEthOffset + 13] = static_cast<char>(type & 0xff);
+}
+
+// IPv4 frame sent by B to A as received from B's link
+static void MakeIpv4(char* frame, size_t len) {
+  memset(frame, 0, len);
+  SetHeader(frame, 'B', 'A', kMacB, 0x0800);
+  frame[kPayloadOffset] = 0x45;
+  memcpy(frame + kPayloadOffset + 12, kIpB, 4);
+  memcpy(frame + kPayloadOffset + 16, kIpA, 4);
+}
+
+// ARP request from A read from the tap
+static void MakeArpRequest(char* frame, const uint8* target) {
+  memset(frame, 0, kArpFrameLen);
+  SetHeader(frame, 'A', 0, kMacA, 0x0806);
+  char* arp = frame + kPayloadOffset;
+  arp[1] = 1;
+  arp[2] = 0x08;
+  arp[4] = 6;
+  arp[5] = 4;
+  arp[7] = 1;
+  memcpy(arp + 8, kMacA, 6);
+  memcpy(arp + 14, kIpA, 4);
+  memcpy(arp + 24, target, 4);
+}
+
+static uint16 Sum16(const char* data, size_t len, uint32 sum) {
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (static_cast<uint8>(data[i]) << 8) | static_cast<uint8>(data[i + 1]);
+  }
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16>(sum);
+}
+
+TEST(NeighborCacheTest, AnswersArpForLearnedAddress) {
+  NeighborCache cache;
+  char frame[kPayloadOffset + 20];
+  MakeIpv4(frame, sizeof(frame));
+  cache.Learn(frame, sizeof(frame));
+  EXPECT_EQ(1U, cache.size());
+
+  char request[kArpFrameLen];
+  MakeArpRequest(request, kIpB);
+  std::string reply;
+  ASSERT_EQ(NeighborCache::REPLY,
+            cache.Resolve(request, sizeof(request), &reply));
+  ASSERT_EQ(kArpFrameLen, reply.size());
+  // the reply comes from B's uid and MAC and answers A
+  EXPECT_EQ(std::string(kUidLen, 'B'), reply.substr(0, kUidLen));
+  EXPECT_EQ(0, memcmp(reply.data() + kEthOffset, kMacA, 6));
+  EXPECT_EQ(0, memcmp(reply.data() + kEthOffset + 6, kMacB, 6));
+  const char* arp = reply.data() + kPayloadOffset;
+  EXPECT_EQ(2, arp[7]);
+  EXPECT_EQ(0, memcmp(arp + 8, kMacB, 6));
+  EXPECT_EQ(0, memcmp(arp + 14, kIpB, 4));
+  EXPECT_EQ(0, memcmp(arp + 18, kMacA, 6));
+  EXPECT_EQ(0, memcmp(arp + 24, kIpA, 4));
+  EXPECT_EQ(1U, cache.stats().replies);
+}
+
+TEST(NeighborCacheTest, UnicastsToMappedOwner) {
+  NeighborCache cache;
+  std::string uid(kUidLen, 'C');
+  cache.AddMapping(std::string(reinterpret_cast<const char*>(kIpB), 4), uid);
+  char request[kArpFrameLen];
+  MakeArpRequest(request, kIpB);
+  std::string out;
+  EXPECT_EQ(NeighborCache::UNICAST,
+            cache.Resolve(request, sizeof(request), &out));
+  EXPECT_EQ(uid, out);
+  EXPECT_EQ(1U, cache.stats().unicasts);
+}
+
+TEST(NeighborCacheTest, LimitsFloodsOnMiss) {
+  NeighborCache cache;
+  cache.set_flood_interval(60000);
+  char request[kArpFrameLen];
+  MakeArpRequest(request, kIpB);
+  std::string out;
+  EXPECT_EQ(NeighborCache::PASS,
+            cache.Resolve(request, sizeof(request), &out));
+  EXPECT_EQ(NeighborCache::DROP,
+            cache.Resolve(request, sizeof(request), &out));
+  EXPECT_EQ(1U, cache.stats().floods);
+  EXPECT_EQ(1U, cache.stats().drops);
+
+  cache.set_flood_interval(0);
+  EXPECT_EQ(NeighborCache::PASS,
+            cache.Resolve(request, sizeof(request), &out));
+}
+
+TEST(NeighborCacheTest, PassesGratuitousArpAndReplies) {
+  NeighborCache cache;
+  char request[kArpFrameLen];
+  MakeArpRequest(request, kIpA);
+  std::string out;
+  EXPECT_EQ(NeighborCache::PASS,
+            cache.Resolve(request, sizeof(request), &out));
+  MakeArpRequest(request, kIpB);
+  request[kPayloadOffset + 7] = 2;
+  EXPECT_EQ(NeighborCache::PASS,
+            cache.Resolve(request, sizeof(request), &out));
+  EXPECT_EQ(0U, cache.stats().requests);
+}
+
+TEST(NeighborCacheTest, AnswersNeighborSolicitation) {
+  NeighborCache cache;
+  const uint8 ip_a[16] = { 0xfd, 0x50, 0, 0, 0, 0, 0, 0,
+                           0, 0, 0, 0, 0, 0, 0, 0x01 };
+  const uint8 ip_b[16] = { 0xfd, 0x50, 0, 0, 0, 0, 0, 0,
+                           0, 0, 0, 0, 0, 0, 0, 0x02 };
+  // any IPv6 frame from B teaches its address
+  char frame[kPayloadOffset + 40];
+  memset(frame, 0, sizeof(frame));
+  SetHeader(frame, 'B', 'A', kMacB, 0x86dd);
+  frame[kPayloadOffset] = 0x60;
+  memcpy(frame + kPayloadOffset + 8, ip_b, 16);
+  cache.Learn(frame, sizeof(frame));
+
+  char request[kNsFrameLen];
+  memset(request, 0, sizeof(request));
+  SetHeader(request, 'A', 0, kMacA, 0x86dd);
+  request[kPayloadOffset] = 0x60;
+  request[kPayloadOffset + 6] = 58;
+  memcpy(request + kPayloadOffset + 8, ip_a, 16);
+  request[kPayloadOffset + 40] = static_cast<char>(135);
+  memcpy(request + kPayloadOffset + 48, ip_b, 16);
+
+  std::string reply;
+  ASSERT_EQ(NeighborCache::REPLY,
+            cache.Resolve(request, sizeof(request), &reply));
+  ASSERT_EQ(kNsFrameLen + 8, reply.size());
+  const char* ip = reply.data() + kPayloadOffset;
+  const char* icmp = ip + 40;
+  EXPECT_EQ(136, static_cast<uint8>(icmp[0]));
+  EXPECT_EQ(0, memcmp(ip + 8, ip_b, 16));
+  EXPECT_EQ(0, memcmp(ip + 24, ip_a, 16));
+  EXPECT_EQ(0, memcmp(icmp + 26, kMacB, 6));
+  // the checksum over the pseudo header and the message adds up to ones
+  size_t icmp_len = reply.size() - kPayloadOffset - 40;
+  uint32 sum = Sum16(ip + 8, 32, static_cast<uint32>(icmp_len) + 58);
+  EXPECT_EQ(0xffff, Sum16(icmp, icmp_len, sum));
+}
+
+}  // namespace tincan
@@ -0,0 +1,444 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "talk/base/ipaddress.h"
+
+#include "packetclassifier.h"
+
+namespace tincan {
+
+static const size_t kUidLen = 20;
+static const size_t kShortUidLen = 16;
+static const size_t kEthOffset = 2 * kUidLen;
+static const size_t kEthTypeOffset = kEthOffset + 12;
+static const size_t kPayloadOffset = kEthOffset + 14;
+static const size_t kIccTypeOffset = kEthOffset + 5;
+static const uint32 kMaxPort = 0xffff;
+static const int kNonIp = 256;
+
+static const uint16 kEthTypeIpv4 = 0x0800;
+static const uint16 kEthTypeIpv6 = 0x86dd;
+static const uint8 kIpProtoTcp = 6;
+static const uint8 kIpProtoUdp = 17;
+static const uint8 kIpProtoSctp = 132;
+
+// ICC frames are marked with the MAC address 00:69:70:6f:70:0x
+static const char kIccMac[] = { 0x00, 0x69, 0x70, 0x6f, 0x70 };
+static const char kIccControl = 0x03;
+static const char kIccPacket = 0x04;
+
+static uint16 GetUint16(const char* data) {
+  return (static_cast<uint8>(data[0]) << 8) | static_cast<uint8>(data[1]);
+}
+
+static bool HasPorts(uint8 proto) {
+  return proto == kIpProtoTcp || proto == kIpProtoUdp ||
+         proto == kIpProtoSctp;
+}
+
+static void MapIpv4(const char* ip, PacketClassifier::Address* address) {
+  memset(address->bytes, 0, 10);
+  address->bytes[10] = 0xff;
+  address->bytes[11] = 0xff;
+  memcpy(address->bytes + 12, ip, 4);
+}
+
+static bool Increment(PacketClassifier::Address* key) {
+  return key->Increment();
+}
+
+static bool Increment(uint32* key) {
+  if (*key >= kMaxPort) return false;
+  ++*key;
+  return true;
+}
+
+template <class Key>
+static bool KeyEqual(const Key& a, const Key& b) {
+  return !(a < b) && !(b < a);
+}
+
+#if defined(__GNUC__)
+static int LowestBit(uint64 word) {
+  return __builtin_ctzll(word);
+}
+#else
+static int LowestBit(uint64 word) {
+  int bit = 0;
+  while (!(word & 1)) {
+    word >>= 1;
+    bit++;
+  }
+  return bit;
+}
+#endif
+
+bool PacketClassifier::Address::operator<(const Address& other) const {
+  return memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+}
+
+bool PacketClassifier::Address::Increment() {
+  for (int i = sizeof(bytes) - 1; i >= 0; i--) {
+    if (++bytes[i] != 0) return true;
+  }
+  return false;
+}
+
+PacketClassifier::Rule::Rule()
+    : action(ALLOW),
+      direction(-1),
+      proto(-1),
+      icc(-1),
+      sport_lo(0),
+      sport_hi(kMaxPort),
+      dport_lo(0),
+      dport_hi(kMaxPort) {
+  memset(src_lo.bytes, 0, sizeof(src_lo.bytes));
+  memset(src_hi.bytes, 0xff, sizeof(src_hi.bytes));
+  dst_lo = src_lo;
+  dst_hi = src_hi;
+}
+
+static bool ParsePrefix(const std::string& text,
+                        PacketClassifier::Address* lo,
+                        PacketClassifier::Address* hi) {
+  size_t slash = text.find('/');
+  talk_base::IPAddress ip;
+  if (!talk_base::IPFromString(text.substr(0, slash), &ip)) return false;
+  PacketClassifier::Address base;
+  int offset = 0;
+  int max_len = 128;
+  if (ip.family() == AF_INET) {
+    in_addr addr = ip.ipv4_address();
+    MapIpv4(reinterpret_cast<const char*>(&addr), &base);
+    offset = 96;
+    max_len = 32;
+  }
+  else {
+    in6_addr addr = ip.ipv6_address();
+    memcpy(base.bytes, &addr, sizeof(base.bytes));
+  }
+  int prefix_len = max_len;
+  if (slash != std::string::npos) {
+    char extra;
+    if (sscanf(text.c_str() + slash + 1, "%d%c", &prefix_len, &extra) != 1 ||
+        prefix_len < 0 || prefix_len > max_len) return false;
+  }
+  int bits = offset + prefix_len;
+  for (int i = 0; i < 16; i++) {
+    int keep = bits - i * 8;
+    uint8 mask = keep >= 8 ? 0xff : (keep <= 0 ? 0 : 0xff << (8 - keep));
+    lo->bytes[i] = base.bytes[i] & mask;
+    hi->bytes[i] = base.bytes[i] | static_cast<uint8>(~mask);
+  }
+  return true;
+}
+
+static bool ParsePorts(const Json::Value& value, uint32* lo, uint32* hi) {
+  int first = 0;
+  int last = 0;
+  if (value.isInt()) {
+    first = last = value.asInt();
+  }
+  else if (value.isString()) {
+    char extra;
+    int count = sscanf(value.asCString(), "%d-%d%c", &first, &last, &extra);
+    if (count == 1) last = first;
+    else if (count != 2) return false;
+  }
+  else {
+    return false;
+  }
+  if (first < 0 || last < first || last > static_cast<int>(kMaxPort)) {
+    return false;
+  }
+  *lo = first;
+  *hi = last;
+  return true;
+}
+
+bool PacketClassifier::ParseRule(const Json::Value& value, Rule* rule,
+                                 std::string* error) {
+  if (!value.isObject()) {
+    *error = "rule is not an object";
+    return false;
+  }
+  rule->id = value["id"].asString();
+  *error = "rule " + rule->id + ": ";
+
+  std::string action = value["action"].asString();
+  if (action == "deny" || action == "drop") rule->action = DENY;
+  else if (action.empty() || action == "allow") rule->action = ALLOW;
+  else {
+    *error += "bad action";
+    return false;
+  }
+
+  std::string direction = value["dir"].asString();
+  if (direction == "in") rule->direction = IN;
+  else if (direction == "out") rule->direction = OUT;
+  else if (!direction.empty() && direction != "any") {
+    *error += "bad dir";
+    return false;
+  }
+
+  std::string peer = value["peer"].asString();
+  if (!peer.empty()) {
+    if (peer.size() < kShortUidLen) {
+      *error += "bad peer";
+      return false;
+    }
+    // packets are matched by the short uid in lower case hex
+    rule->peer = peer.substr(0, kShortUidLen);
+    std::transform(rule->peer.begin(), rule->peer.end(), rule->peer.begin(),
+                   ::tolower);
+  }
+
+  if (value.isMember("proto")) {
+    const Json::Value& proto = value["proto"];
+    std::string name = proto.isString() ? proto.asString() : "";
+    if (proto.isInt() && proto.asInt() >= 0 && proto.asInt() < kNonIp) {
+      rule->proto = proto.asInt();
+    }
+    else if (name == "tcp") rule->proto = kIpProtoTcp;
+    else if (name == "udp") rule->proto = kIpProtoUdp;
+    else if (name == "icmp") rule->proto = 1;
+    else if (name == "icmpv6") rule->proto = 58;
+    else {
+      *error += "bad proto";
+      return false;
+    }
+  }
+
+  if (value.isMember("src") &&
+      !ParsePrefix(value["src"].asString(), &rule->src_lo, &rule->src_hi)) {
+    *error += "bad src";
+    return false;
+  }
+  if (value.isMember("dst") &&
+      !ParsePrefix(value["dst"].asString(), &rule->dst_lo, &rule->dst_hi)) {
+    *error += "bad dst";
+    return false;
+  }
+  if (value.isMember("sport") &&
+      !ParsePorts(value["sport"], &rule->sport_lo, &rule->sport_hi)) {
+    *error += "bad sport";
+    return false;
+  }
+  if (value.isMember("dport") &&
+      !ParsePorts(value["dport"], &rule->dport_lo, &rule->dport_hi)) {
+    *error += "bad dport";
+    return false;
+  }
+
+  std::string icc = value["icc"].asString();
+  if (icc == "none") rule->icc = ICC_NONE;
+  else if (icc == "packet") rule->icc = ICC_PACKET;
+  else if (icc == "control") rule->icc = ICC_CONTROL;
+  else if (!icc.empty() && icc != "any") {
+    *error += "bad icc";
+    return false;
+  }
+  error->clear();
+  return true;
+}
+
+template <class Key>
+void PacketClassifier::Index<Key>::Build(
+    const std::vector<std::pair<Key, Key> >& ranges, const Key& min_key,
+    size_t words) {
+  // every range start and the key after every range end begin a new
+  // elementary interval, within one the matching rules do not change
+  starts.clear();
+  starts.push_back(min_key);
+  for (size_t i = 0; i < ranges.size(); i++) {
+    starts.push_back(ranges[i].first);
+    Key next = ranges[i].second;
+    if (Increment(&next)) starts.push_back(next);
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end(), KeyEqual<Key>),
+               starts.end());
+
+  bits.assign(starts.size(), Bits(words, 0));
+  for (size_t r = 0; r < ranges.size(); r++) {
+    size_t i = std::lower_bound(starts.begin(), starts.end(),
+                                ranges[r].first) - starts.begin();
+    uint64 bit = static_cast<uint64>(1) << (r % 64);
+    for (; i < starts.size() && !(ranges[r].second < starts[i]); i++) {
+      bits[i][r / 64] |= bit;
+    }
+  }
+}
+
+template <class Key>
+const PacketClassifier::Bits& PacketClassifier::Index<Key>::Lookup(
+    const Key& key) const {
+  // starts[0] is the smallest key so the interval always exists
+  size_t i = std::upper_bound(starts.begin(), starts.end(), key) -
+             starts.begin();
+  return bits[i - 1];
+}
+
+PacketClassifier::PacketClassifier(const std::vector<Rule>& rules,
+                                   Action default_action)
+    : rules_(rules),
+      default_action_(default_action),
+      words_((rules.size() + 63) / 64),
+      proto_bits_(kNonIp + 1, Bits((rules.size() + 63) / 64, 0)),
+      any_peer_bits_(words_, 0),
+      hits_(rules.size(), 0),
+      default_hits_(0) {
+  for (int i = 0; i < 2; i++) direction_bits_[i].assign(words_, 0);
+  for (int i = 0; i < 3; i++) icc_bits_[i].assign(words_, 0);
+
+  std::vector<std::pair<Address, Address> > src_ranges, dst_ranges;
+  std::vector<std::pair<uint32, uint32> > sport_ranges, dport_ranges;
+  for (size_t r = 0; r < rules_.size(); r++) {
+    const Rule& rule = rules_[r];
+    size_t word = r / 64;
+    uint64 bit = static_cast<uint64>(1) << (r % 64);
+    for (int i = 0; i < 2; i++) {
+      if (rule.direction < 0 || rule.direction == i) {
+        direction_bits_[i][word] |= bit;
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      if (rule.icc < 0 || rule.icc == i) icc_bits_[i][word] |= bit;
+    }
+
+    // a rule with an address or port only applies to IP packets
+    Address any_lo = Rule().src_lo;
+    Address any_hi = Rule().src_hi;
+    bool ip_only = !KeyEqual(rule.src_lo, any_lo) ||
+        !KeyEqual(rule.src_hi, any_hi) || !KeyEqual(rule.dst_lo, any_lo) ||
+        !KeyEqual(rule.dst_hi, any_hi) || rule.sport_lo != 0 ||
+        rule.sport_hi != kMaxPort || rule.dport_lo != 0 ||
+        rule.dport_hi != kMaxPort;
+    for (int i = 0; i <= kNonIp; i++) {
+      if (rule.proto == i || (rule.proto < 0 && (i < kNonIp || !ip_only))) {
+        proto_bits_[i][word] |= bit;
+      }
+    }
+
+    if (rule.peer.empty()) any_peer_bits_[word] |= bit;
+    else {
+      Bits& peer_bits = peer_bits_[rule.peer];
+      if (peer_bits.empty()) peer_bits.assign(words_, 0);
+      peer_bits[word] |= bit;
+    }
+    src_ranges.push_back(std::make_pair(rule.src_lo, rule.src_hi));
+    dst_ranges.push_back(std::make_pair(rule.dst_lo, rule.dst_hi));
+    sport_ranges.push_back(std::make_pair(rule.sport_lo, rule.sport_hi));
+    dport_ranges.push_back(std::make_pair(rule.dport_lo, rule.dport_hi));
+  }
+  for (std::map<std::string, Bits>::iterator it = peer_bits_.begin();
+       it != peer_bits_.end(); ++it) {
+    for (size_t w = 0; w < words_; w++) it->second[w] |= any_peer_bits_[w];
+  }
+
+  Address min_address = Rule().src_lo;
+  src_index_.Build(src_ranges, min_address, words_);
+  dst_index_.Build(dst_ranges, min_address, words_);
+  sport_index_.Build(sport_ranges, 0, words_);
+  dport_index_.Build(dport_ranges, 0, words_);
+}
+
+void PacketClassifier::ResetHits() {
+  std::fill(hits_.begin(), hits_.end(), 0);
+  default_hits_ = 0;
+}
+
+PacketClassifier::Action PacketClassifier::Classify(const char* data,
+                                                    size_t len,
+                                                    const std::string& peer,
+                                                    Direction direction) {
+  int icc = ICC_NONE;
+  if (len > kIccTypeOffset &&
+      memcmp(data + kEthOffset, kIccMac, sizeof(kIccMac)) == 0) {
+    if (data[kIccTypeOffset] == kIccPacket) icc = ICC_PACKET;
+    else if (data[kIccTypeOffset] == kIccControl) icc = ICC_CONTROL;
+  }
+
+  int proto = kNonIp;
+  Address src, dst;
+  memset(src.bytes, 0, sizeof(src.bytes));
+  memset(dst.bytes, 0, sizeof(dst.bytes));
+  uint32 sport = 0;
+  uint32 dport = 0;
+  uint16 type = len >= kPayloadOffset ? GetUint16(data + kEthTypeOffset) : 0;
+  const char* ip = data + kPayloadOffset;
+  if (type == kEthTypeIpv4 && len >= kPayloadOffset + 20) {
+    size_t header_len = (ip[0] & 0x0f) * 4;
+    proto = static_cast<uint8>(ip[9]);
+    MapIpv4(ip + 12, &src);
+    MapIpv4(ip + 16, &dst);
+    // only the first fragment carries the ports
+    bool first_fragment = (GetUint16(ip + 6) & 0x1fff) == 0;
+    if (first_fragment && HasPorts(proto) &&
+        len >= kPayloadOffset + header_len + 4) {
+      sport = GetUint16(ip + header_len);
+      dport = GetUint16(ip + header_len + 2);
+    }
+  }
+  else if (type == kEthTypeIpv6 && len >= kPayloadOffset + 40) {
+    proto = static_cast<uint8>(ip[6]);
+    memcpy(src.bytes, ip + 8, sizeof(src.bytes));
+    memcpy(dst.bytes, ip + 24, sizeof(dst.bytes));
+    if (HasPorts(proto) && len >= kPayloadOffset + 44) {
+      sport = GetUint16(ip + 40);
+      dport = GetUint16(ip + 42);
+    }
+  }
+
+  std::map<std::string, Bits>::const_iterator pit = peer_bits_.find(peer);
+  const Bits* sets[] = {
+    &direction_bits_[direction],
+    &icc_bits_[icc],
+    &proto_bits_[proto],
+    pit != peer_bits_.end() ? &pit->second : &any_peer_bits_,
+    &src_index_.Lookup(src),
+    &dst_index_.Lookup(dst),
+    &sport_index_.Lookup(sport),
+    &dport_index_.Lookup(dport),
+  };
+  const size_t count = sizeof(sets) / sizeof(sets[0]);
+  for (size_t w = 0; w < words_; w++) {
+    uint64 match = ~static_cast<uint64>(0);
+    for (size_t i = 0; i < count && match != 0; i++) match &= (*sets[i])[w];
+    if (match != 0) {
+      size_t r = w * 64 + LowestBit(match);
+      hits_[r]++;
+      return rules_[r].action;
+    }
+  }
+  default_hits_++;
+  return default_action_;
+}
+
+}  // namespace tincan
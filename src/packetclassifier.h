@@ -0,0 +1,140 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_PACKETCLASSIFIER_H_
+#define TINCAN_PACKETCLASSIFIER_H_
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "talk/base/basictypes.h"
+#include "talk/base/json.h"
+
+namespace tincan {
+
+// PacketClassifier matches frames against an ordered list of ACL rules, the
+// first matching rule decides. Rules are compiled into one table of
+// elementary intervals per field, each holding the bitmap of the rules
+// that match there. A lookup is a binary search per field and an AND of
+// the bitmaps, so its cost hardly grows with the number of rules. A
+// compiled classifier is never changed, a new rule set replaces it.
+// Frames start with the 40 byte ipop header followed by the ethernet frame.
+class PacketClassifier {
+ public:
+  enum Direction {
+    IN = 0,
+    OUT = 1,
+  };
+
+  enum Action {
+    ALLOW,
+    DENY,
+  };
+
+  enum IccType {
+    ICC_NONE = 0,
+    ICC_PACKET = 1,
+    ICC_CONTROL = 2,
+  };
+
+  // IPv6 address, IPv4 addresses are mapped to ::ffff:0:0/96
+  struct Address {
+    uint8 bytes[16];
+    bool operator<(const Address& other) const;
+    // returns false when the address wraps around
+    bool Increment();
+  };
+
+  struct Rule {
+    Rule();
+    std::string id;
+    Action action;
+    // -1 matches any value
+    int direction;
+    int proto;
+    int icc;
+    // short uid of the peer, empty matches any peer
+    std::string peer;
+    // inclusive ranges, the defaults match everything
+    Address src_lo, src_hi;
+    Address dst_lo, dst_hi;
+    uint32 sport_lo, sport_hi;
+    uint32 dport_lo, dport_hi;
+  };
+
+  // parses {"id", "action": "allow"|"deny", "dir": "in"|"out", "peer",
+  // "proto", "src", "dst", "sport", "dport", "icc": "none"|"packet"|
+  // "control"}, missing fields match anything
+  static bool ParseRule(const Json::Value& value, Rule* rule,
+                        std::string* error);
+
+  PacketClassifier(const std::vector<Rule>& rules, Action default_action);
+
+  // peer is the short uid of the other end of the link
+  Action Classify(const char* data, size_t len, const std::string& peer,
+                  Direction direction);
+
+  size_t size() const { return rules_.size(); }
+  Action default_action() const { return default_action_; }
+  const Rule& rule(size_t i) const { return rules_[i]; }
+  uint64 hits(size_t i) const { return hits_[i]; }
+  uint64 default_hits() const { return default_hits_; }
+  void ResetHits();
+
+ private:
+  typedef std::vector<uint64> Bits;
+
+  // elementary intervals of one field, starts is sorted
+  template <class Key>
+  struct Index {
+    std::vector<Key> starts;
+    std::vector<Bits> bits;
+    // ranges holds the inclusive range of every rule in rule order
+    void Build(const std::vector<std::pair<Key, Key> >& ranges,
+               const Key& min_key, size_t words);
+    const Bits& Lookup(const Key& key) const;
+  };
+
+  std::vector<Rule> rules_;
+  Action default_action_;
+  size_t words_;
+  Bits direction_bits_[2];
+  Bits icc_bits_[3];
+  // protocols 0-255 and 256 for frames that are not IP
+  std::vector<Bits> proto_bits_;
+  // rules for a peer also hold the rules for any peer
+  std::map<std::string, Bits> peer_bits_;
+  Bits any_peer_bits_;
+  Index<Address> src_index_;
+  Index<Address> dst_index_;
+  Index<uint32> sport_index_;
+  Index<uint32> dport_index_;
+  std::vector<uint64> hits_;
+  uint64 default_hits_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_PACKETCLASSIFIER_H_
@@ -0,0 +1,246 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "talk/base/gunit.h"
+#include "talk/base/json.h"
+
+#include "packetclassifier.h"
+
+namespace tincan {
+
+static const size_t kEthOffset = 40;
+static const size_t kPayloadOffset = kEthOffset + 14;
+static const size_t kFrameLen = kPayloadOffset + 60;
+static const char kPeer[] = "0123456789abcdef";
+
+// IPv4 frame from 10.0.0.1 to dst with the given ports
+static void MakeIpv4(char* frame, uint8 proto, const uint8* dst,
+                     uint16 sport, uint16 dport) {
+  memset(frame, 0, kFrameLen);
+  frame[kEthOffset + 12] = 0x08;
+  char* ip = frame + kPayloadOffset;
+  ip[0] = 0x45;
+  ip[9] = proto;
+  ip[12] = 10;
+  ip[15] = 1;
+  memcpy(ip + 16, dst, 4);
+  ip[20] = static_cast<char>(sport >> 8);
+  ip[21] = static_cast<char>(sport & 0xff);
+  ip[22] = static_cast<char>(dport >> 8);
+  ip[23] = static_cast<char>(dport & 0xff);
+}
+
+static PacketClassifier::Rule ParseOrDie(const Json::Value& value) {
+  PacketClassifier::Rule rule;
+  std::string error;
+  EXPECT_TRUE(PacketClassifier::ParseRule(value, &rule, &error)) << error;
+  return rule;
+}
+
+TEST(PacketClassifierTest, ParseRule) {
+  Json::Value value(Json::objectValue);
+  value["id"] = "web";
+  value["action"] = "deny";
+  value["dir"] = "out";
+  value["proto"] = "tcp";
+  value["dst"] = "10.1.0.0/16";
+  value["dport"] = "80-443";
+  PacketClassifier::Rule rule = ParseOrDie(value);
+  EXPECT_EQ("web", rule.id);
+  EXPECT_EQ(PacketClassifier::DENY, rule.action);
+  EXPECT_EQ(PacketClassifier::OUT, rule.direction);
+  EXPECT_EQ(6, rule.proto);
+  EXPECT_EQ(80U, rule.dport_lo);
+  EXPECT_EQ(443U, rule.dport_hi);
+  EXPECT_EQ(10, rule.dst_lo.bytes[12]);
+  EXPECT_EQ(1, rule.dst_lo.bytes[13]);
+  EXPECT_EQ(0, rule.dst_lo.bytes[14]);
+  EXPECT_EQ(0xff, rule.dst_hi.bytes[14]);
+  EXPECT_EQ(0xff, rule.dst_hi.bytes[15]);
+
+  std::string error;
+  Json::Value bad(Json::objectValue);
+  bad["action"] = "reject";
+  EXPECT_FALSE(PacketClassifier::ParseRule(bad, &rule, &error));
+  bad = Json::Value(Json::objectValue);
+  bad["dst"] = "10.0.0.0/33";
+  EXPECT_FALSE(PacketClassifier::ParseRule(bad, &rule, &error));
+  bad = Json::Value(Json::objectValue);
+  bad["dport"] = "443-80";
+  EXPECT_FALSE(PacketClassifier::ParseRule(bad, &rule, &error));
+  bad = Json::Value(Json::objectValue);
+  bad["peer"] = "abc";
+  EXPECT_FALSE(PacketClassifier::ParseRule(bad, &rule, &error));
+  EXPECT_FALSE(PacketClassifier::ParseRule(Json::Value("x"), &rule, &error));
+}
+
+TEST(PacketClassifierTest, FirstMatchWins) {
+  std::vector<PacketClassifier::Rule> rules;
+  Json::Value value(Json::objectValue);
+  value["action"] = "allow";
+  value["proto"] = "tcp";
+  value["dport"] = 22;
+  rules.push_back(ParseOrDie(value));
+  value = Json::Value(Json::objectValue);
+  value["action"] = "deny";
+  value["dst"] = "10.2.0.0/16";
+  rules.push_back(ParseOrDie(value));
+  PacketClassifier classifier(rules, PacketClassifier::ALLOW);
+
+  const uint8 blocked[4] = { 10, 2, 5, 9 };
+  const uint8 open[4] = { 10, 3, 5, 9 };
+  char frame[kFrameLen];
+  MakeIpv4(frame, 6, blocked, 40000, 22);
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  MakeIpv4(frame, 6, blocked, 40000, 80);
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  MakeIpv4(frame, 17, open, 40000, 53);
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  EXPECT_EQ(1U, classifier.hits(0));
+  EXPECT_EQ(1U, classifier.hits(1));
+  EXPECT_EQ(1U, classifier.default_hits());
+
+  classifier.ResetHits();
+  EXPECT_EQ(0U, classifier.hits(0));
+  EXPECT_EQ(0U, classifier.default_hits());
+}
+
+TEST(PacketClassifierTest, DirectionAndPeer) {
+  std::vector<PacketClassifier::Rule> rules;
+  Json::Value value(Json::objectValue);
+  value["action"] = "deny";
+  value["dir"] = "in";
+  value["peer"] = "0123456789ABCDEF0123";
+  rules.push_back(ParseOrDie(value));
+  PacketClassifier classifier(rules, PacketClassifier::ALLOW);
+
+  const uint8 dst[4] = { 10, 0, 0, 2 };
+  char frame[kFrameLen];
+  MakeIpv4(frame, 17, dst, 1000, 2000);
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::IN));
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), "fedcba9876543210", PacketClassifier::IN));
+}
+
+TEST(PacketClassifierTest, Ipv6AndNonIp) {
+  std::vector<PacketClassifier::Rule> rules;
+  Json::Value value(Json::objectValue);
+  value["action"] = "allow";
+  value["src"] = "fd50::/16";
+  rules.push_back(ParseOrDie(value));
+  value = Json::Value(Json::objectValue);
+  value["action"] = "allow";
+  value["proto"] = "udp";
+  rules.push_back(ParseOrDie(value));
+  PacketClassifier classifier(rules, PacketClassifier::DENY);
+
+  char frame[kFrameLen];
+  memset(frame, 0, sizeof(frame));
+  frame[kEthOffset + 12] = static_cast<char>(0x86);
+  frame[kEthOffset + 13] = static_cast<char>(0xdd);
+  char* ip = frame + kPayloadOffset;
+  ip[0] = 0x60;
+  ip[6] = 6;
+  ip[8] = static_cast<char>(0xfd);
+  ip[9] = 0x50;
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  ip[9] = 0x51;
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+
+  // an ARP frame has no protocol, only rules without one match it
+  memset(frame, 0, sizeof(frame));
+  frame[kEthOffset + 12] = 0x08;
+  frame[kEthOffset + 13] = 0x06;
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+}
+
+TEST(PacketClassifierTest, IccFrames) {
+  std::vector<PacketClassifier::Rule> rules;
+  Json::Value value(Json::objectValue);
+  value["action"] = "allow";
+  value["icc"] = "control";
+  rules.push_back(ParseOrDie(value));
+  PacketClassifier classifier(rules, PacketClassifier::DENY);
+
+  char frame[kFrameLen];
+  memset(frame, 0, sizeof(frame));
+  const char icc_mac[] = { 0x00, 0x69, 0x70, 0x6f, 0x70, 0x03 };
+  memcpy(frame + kEthOffset, icc_mac, sizeof(icc_mac));
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::IN));
+  frame[kEthOffset + 5] = 0x04;
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::IN));
+}
+
+TEST(PacketClassifierTest, ManyRules) {
+  // 300 /24 denies spread the rules over several bitmap words, the allow
+  // for port 22 comes last
+  std::vector<PacketClassifier::Rule> rules;
+  for (int i = 0; i < 300; i++) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "10.%d.%d.0/24", i / 256, i % 256);
+    Json::Value value(Json::objectValue);
+    value["action"] = "deny";
+    value["proto"] = "tcp";
+    value["dst"] = prefix;
+    value["dport"] = 80;
+    rules.push_back(ParseOrDie(value));
+  }
+  Json::Value value(Json::objectValue);
+  value["action"] = "allow";
+  value["dport"] = 22;
+  value["proto"] = "tcp";
+  rules.push_back(ParseOrDie(value));
+  PacketClassifier classifier(rules, PacketClassifier::DENY);
+  ASSERT_EQ(301U, classifier.size());
+
+  const uint8 dst[4] = { 10, 1, 20, 9 };
+  char frame[kFrameLen];
+  MakeIpv4(frame, 6, dst, 40000, 80);
+  EXPECT_EQ(PacketClassifier::DENY, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  EXPECT_EQ(1U, classifier.hits(256 + 20));
+  MakeIpv4(frame, 6, dst, 40000, 22);
+  EXPECT_EQ(PacketClassifier::ALLOW, classifier.Classify(
+      frame, sizeof(frame), kPeer, PacketClassifier::OUT));
+  EXPECT_EQ(0U, classifier.default_hits());
+  EXPECT_EQ(1U, classifier.hits(300));
+}
+
+}  // namespace tincan
@@ -0,0 +1,73 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "peerdirectory.h"
+
+namespace tincan {
+
+const char* LinkStateName(LinkState state) {
+  switch (state) {
+    case LINK_CONNECTING:
+      return "connecting";
+    case LINK_ONLINE:
+      return "online";
+    case LINK_OFFLINE:
+      return "offline";
+    default:
+      return "none";
+  }
+}
+
+void PeerDirectory::RemovePresence(const std::string& uid) {
+  RecordMap::iterator it = records_.find(uid);
+  if (it == records_.end()) return;
+  if (it->second.link_state == LINK_NONE) {
+    records_.erase(it);
+    return;
+  }
+  it->second.presence_time = 0;
+}
+
+void PeerDirectory::UpdateLinkState(const std::string& uid, LinkState state) {
+  // links that go away do not add records for peers we never heard of,
+  // and take the record with them once the peer has left XMPP
+  if (state == LINK_NONE) {
+    RecordMap::iterator it = records_.find(uid);
+    if (it == records_.end()) return;
+    if (it->second.presence_time == 0) {
+      records_.erase(it);
+      return;
+    }
+    it->second.link_state = state;
+    return;
+  }
+  records_[uid].link_state = state;
+}
+
+const PeerRecord* PeerDirectory::Find(const std::string& uid) const {
+  RecordMap::const_iterator it = records_.find(uid);
+  if (it == records_.end()) return NULL;
+  return &it->second;
+}
+
+}  // namespace tincan
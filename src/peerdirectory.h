@@ -0,0 +1,94 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_PEERDIRECTORY_H_
+#define TINCAN_PEERDIRECTORY_H_
+#pragma once
+
+#include <string>
+
+#if defined(WIN32)
+#include <unordered_map>
+#else
+#include <tr1/unordered_map>
+#endif
+
+#include "talk/base/basictypes.h"
+
+namespace tincan {
+
+enum LinkState {
+  LINK_NONE = 0,
+  LINK_CONNECTING = 1,
+  LINK_ONLINE = 2,
+  LINK_OFFLINE = 3,
+};
+
+// name of the state as reported in peer_state, "none" for unknown values
+const char* LinkStateName(LinkState state);
+
+struct PeerRecord {
+  PeerRecord() : presence_time(0), link_state(LINK_NONE) {}
+  // full jid the peer signals from, empty until it has sent us a stanza
+  std::string jid;
+  // time of the last presence, 0 if the peer was never seen on XMPP
+  uint32 presence_time;
+  LinkState link_state;
+};
+
+// PeerDirectory holds one record per peer, keyed by the 40 character uid.
+// XmppNetwork fills in jids and presence and TinCanConnectionManager the
+// link state. Both use it on the link setup thread only. A record is
+// dropped once the peer has left XMPP and has no link left.
+class PeerDirectory {
+ public:
+  typedef std::tr1::unordered_map<std::string, PeerRecord> RecordMap;
+  typedef RecordMap::const_iterator const_iterator;
+
+  void UpdateJid(const std::string& uid, const std::string& jid) {
+    records_[uid].jid = jid;
+  }
+
+  void UpdatePresence(const std::string& uid, uint32 time) {
+    records_[uid].presence_time = time;
+  }
+
+  // clears the presence of a peer that went unavailable
+  void RemovePresence(const std::string& uid);
+
+  void UpdateLinkState(const std::string& uid, LinkState state);
+
+  // NULL if the peer is unknown
+  const PeerRecord* Find(const std::string& uid) const;
+
+  const_iterator begin() const { return records_.begin(); }
+  const_iterator end() const { return records_.end(); }
+  size_t size() const { return records_.size(); }
+
+ private:
+  RecordMap records_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_PEERDIRECTORY_H_
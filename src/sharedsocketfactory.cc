@@ -0,0 +1,341 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "talk/base/byteorder.h"
+#include "talk/base/logging.h"
+
+#include "sharedsocketfactory.h"
+#include "tincan_utils.h"
+
+namespace tincan {
+
+static const size_t kStunHeaderSize = 20;
+static const size_t kStunTxidOffset = 8;
+static const size_t kStunTxidSize = 12;
+static const uint32 kStunMagicCookie = 0x2112A442;
+static const uint16 kStunAttrUsername = 0x0006;
+
+// STUN message classes as encoded in the C1/C0 bits of the message type
+enum {
+  STUN_CLASS_REQUEST = 0,
+  STUN_CLASS_INDICATION = 1,
+  STUN_CLASS_SUCCESS = 2,
+  STUN_CLASS_ERROR = 3,
+};
+
+// upper bound of outstanding STUN transactions remembered per socket,
+// transactions that never get a response are dropped oldest first
+static const size_t kMaxTransactions = 4096;
+
+static bool IsStunPacket(const char* data, size_t len) {
+  if (len < kStunHeaderSize || (data[0] & 0xC0) != 0) return false;
+  return talk_base::GetBE32(data + 4) == kStunMagicCookie;
+}
+
+static int GetStunClass(const char* data) {
+  uint16 type = talk_base::GetBE16(data);
+  return ((type & 0x0100) >> 7) | ((type & 0x0010) >> 4);
+}
+
+// returns the ufrag of the receiver from the USERNAME attribute of a STUN
+// request, for ICE the attribute is formatted as "RFRAG:LFRAG"
+static bool GetStunLocalUfrag(const char* data, size_t len,
+                              std::string* ufrag) {
+  size_t end = kStunHeaderSize + talk_base::GetBE16(data + 2);
+  if (end > len) end = len;
+  size_t pos = kStunHeaderSize;
+  while (pos + 4 <= end) {
+    uint16 attr_type = talk_base::GetBE16(data + pos);
+    size_t attr_len = talk_base::GetBE16(data + pos + 2);
+    pos += 4;
+    if (pos + attr_len > end) return false;
+    if (attr_type == kStunAttrUsername) {
+      std::string username(data + pos, attr_len);
+      *ufrag = username.substr(0, username.find(':'));
+      return true;
+    }
+    // attributes are padded to a multiple of 4 bytes
+    pos += (attr_len + 3) & ~3;
+  }
+  return false;
+}
+
+SharedUdpSocket::SharedUdpSocket(talk_base::AsyncPacketSocket* socket)
+    : socket_(socket) {
+  socket_->SignalReadPacket.connect(this, &SharedUdpSocket::OnReadPacket);
+  socket_->SignalReadyToSend.connect(this, &SharedUdpSocket::OnReadyToSend);
+}
+
+void SharedUdpSocket::Register(MuxedUdpSocket* muxed) {
+  // a new allocator session for the same peer replaces the old one
+  ufrag_map_[muxed->ufrag()] = muxed;
+}
+
+void SharedUdpSocket::Unregister(MuxedUdpSocket* muxed) {
+  std::map<std::string, MuxedUdpSocket*>::iterator uit =
+      ufrag_map_.find(muxed->ufrag());
+  if (uit != ufrag_map_.end() && uit->second == muxed) {
+    ufrag_map_.erase(uit);
+  }
+  for (std::map<talk_base::SocketAddress, MuxedUdpSocket*>::iterator it =
+       addr_map_.begin(); it != addr_map_.end();) {
+    if (it->second == muxed) {
+      addr_map_.erase(it++);
+    }
+    else {
+      ++it;
+    }
+  }
+  for (std::map<std::string, MuxedUdpSocket*>::iterator it =
+       txn_map_.begin(); it != txn_map_.end();) {
+    if (it->second == muxed) {
+      txn_map_.erase(it++);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void SharedUdpSocket::AddTransaction(const std::string& txid,
+                                     MuxedUdpSocket* muxed) {
+  txn_map_[txid] = muxed;
+  txn_order_.push_back(txid);
+  while (txn_order_.size() > kMaxTransactions) {
+    txn_map_.erase(txn_order_.front());
+    txn_order_.pop_front();
+  }
+}
+
+int SharedUdpSocket::SendTo(MuxedUdpSocket* muxed, const void* data,
+                            size_t len, const talk_base::SocketAddress& addr,
+                            const talk_base::PacketOptions& options) {
+  const char* buf = static_cast<const char*>(data);
+  if (IsStunPacket(buf, len) &&
+      GetStunClass(buf) == STUN_CLASS_REQUEST) {
+    AddTransaction(std::string(buf + kStunTxidOffset, kStunTxidSize), muxed);
+  }
+
+  std::map<talk_base::SocketAddress, MuxedUdpSocket*>::iterator it =
+      addr_map_.find(addr);
+  if (it == addr_map_.end()) {
+    addr_map_[addr] = muxed;
+  }
+  else if (it->second != muxed) {
+    it->second = NULL;
+  }
+  return socket_->SendTo(data, len, addr, options);
+}
+
+MuxedUdpSocket* SharedUdpSocket::Lookup(const char* data, size_t len,
+                                        const talk_base::SocketAddress& addr) {
+  if (IsStunPacket(data, len)) {
+    int stun_class = GetStunClass(data);
+    if (stun_class == STUN_CLASS_SUCCESS || stun_class == STUN_CLASS_ERROR) {
+      std::map<std::string, MuxedUdpSocket*>::iterator it =
+          txn_map_.find(std::string(data + kStunTxidOffset, kStunTxidSize));
+      if (it != txn_map_.end()) {
+        MuxedUdpSocket* muxed = it->second;
+        txn_map_.erase(it);
+        return muxed;
+      }
+    }
+    std::string ufrag;
+    if (stun_class == STUN_CLASS_REQUEST &&
+        GetStunLocalUfrag(data, len, &ufrag)) {
+      std::map<std::string, MuxedUdpSocket*>::iterator it =
+          ufrag_map_.find(ufrag);
+      if (it != ufrag_map_.end()) {
+        // a connectivity check tells us which peer this address belongs to
+        addr_map_[addr] = it->second;
+        return it->second;
+      }
+    }
+  }
+  std::map<talk_base::SocketAddress, MuxedUdpSocket*>::iterator it =
+      addr_map_.find(addr);
+  if (it != addr_map_.end()) return it->second;
+  return NULL;
+}
+
+void SharedUdpSocket::OnReadPacket(talk_base::AsyncPacketSocket* socket,
+                                   const char* data, size_t len,
+                                   const talk_base::SocketAddress& addr,
+                                   const talk_base::PacketTime& ptime) {
+  MuxedUdpSocket* muxed = Lookup(data, len, addr);
+  if (muxed == NULL) {
+    LOG_TS(LS_VERBOSE) << "dropping unmatched packet from " << addr.ToString();
+    return;
+  }
+  muxed->Deliver(data, len, addr, ptime);
+}
+
+void SharedUdpSocket::OnReadyToSend(talk_base::AsyncPacketSocket* socket) {
+  std::map<std::string, MuxedUdpSocket*>::iterator it;
+  for (it = ufrag_map_.begin(); it != ufrag_map_.end(); ++it) {
+    it->second->SignalReadyToSend(it->second);
+  }
+}
+
+MuxedUdpSocket::MuxedUdpSocket(SharedUdpSocket* shared,
+                               const std::string& ufrag)
+    : shared_(shared),
+      ufrag_(ufrag),
+      state_(STATE_BOUND) {
+  shared_->Register(this);
+}
+
+MuxedUdpSocket::~MuxedUdpSocket() {
+  shared_->Unregister(this);
+}
+
+void MuxedUdpSocket::Deliver(const char* data, size_t len,
+                             const talk_base::SocketAddress& addr,
+                             const talk_base::PacketTime& ptime) {
+  if (state_ == STATE_CLOSED) return;
+  SignalReadPacket(this, data, len, addr, ptime);
+}
+
+talk_base::SocketAddress MuxedUdpSocket::GetLocalAddress() const {
+  return shared_->socket()->GetLocalAddress();
+}
+
+talk_base::SocketAddress MuxedUdpSocket::GetRemoteAddress() const {
+  return talk_base::SocketAddress();
+}
+
+int MuxedUdpSocket::Send(const void* data, size_t len,
+                         const talk_base::PacketOptions& options) {
+  // the shared socket is never connected
+  return -1;
+}
+
+int MuxedUdpSocket::SendTo(const void* data, size_t len,
+                           const talk_base::SocketAddress& addr,
+                           const talk_base::PacketOptions& options) {
+  if (state_ == STATE_CLOSED) return -1;
+  return shared_->SendTo(this, data, len, addr, options);
+}
+
+int MuxedUdpSocket::Close() {
+  state_ = STATE_CLOSED;
+  return 0;
+}
+
+talk_base::AsyncPacketSocket::State MuxedUdpSocket::GetState() const {
+  return state_;
+}
+
+int MuxedUdpSocket::GetOption(talk_base::Socket::Option opt, int* value) {
+  return shared_->socket()->GetOption(opt, value);
+}
+
+int MuxedUdpSocket::SetOption(talk_base::Socket::Option opt, int value) {
+  return shared_->socket()->SetOption(opt, value);
+}
+
+int MuxedUdpSocket::GetError() const {
+  return shared_->socket()->GetError();
+}
+
+void MuxedUdpSocket::SetError(int error) {
+  shared_->socket()->SetError(error);
+}
+
+SharedSocketPool::SharedSocketPool(talk_base::PacketSocketFactory* factory)
+    : factory_(factory),
+      port_(0) {
+}
+
+SharedSocketPool::~SharedSocketPool() {
+  std::map<talk_base::IPAddress, SharedUdpSocket*>::iterator it;
+  for (it = sockets_.begin(); it != sockets_.end(); ++it) {
+    delete it->second;
+  }
+}
+
+SharedUdpSocket* SharedSocketPool::GetSocket(const talk_base::IPAddress& ip,
+                                             int min_port, int max_port) {
+  std::map<talk_base::IPAddress, SharedUdpSocket*>::iterator it =
+      sockets_.find(ip);
+  if (it != sockets_.end()) return it->second;
+
+  // a fixed port makes the shared socket easy to firewall, otherwise we
+  // honour the port range requested by the allocator
+  talk_base::AsyncPacketSocket* socket = NULL;
+  if (port_ != 0) {
+    socket = factory_->CreateUdpSocket(
+        talk_base::SocketAddress(ip, port_), 0, 0);
+  }
+  else {
+    socket = factory_->CreateUdpSocket(
+        talk_base::SocketAddress(ip, 0), min_port, max_port);
+  }
+  if (socket == NULL) {
+    LOG_TS(LERROR) << "failed to bind shared socket on " << ip.ToString();
+    return NULL;
+  }
+  SharedUdpSocket* shared = new SharedUdpSocket(socket);
+  sockets_[ip] = shared;
+  LOG_TS(INFO) << "SHARED SOCKET " << socket->GetLocalAddress().ToString();
+  return shared;
+}
+
+MuxedPacketSocketFactory::MuxedPacketSocketFactory(
+    SharedSocketPool* pool, talk_base::PacketSocketFactory* factory,
+    const std::string& ufrag)
+    : pool_(pool),
+      factory_(factory),
+      ufrag_(ufrag) {
+}
+
+talk_base::AsyncPacketSocket* MuxedPacketSocketFactory::CreateUdpSocket(
+    const talk_base::SocketAddress& address, int min_port, int max_port) {
+  SharedUdpSocket* shared =
+      pool_->GetSocket(address.ipaddr(), min_port, max_port);
+  if (shared == NULL) return NULL;
+  return new MuxedUdpSocket(shared, ufrag_);
+}
+
+talk_base::AsyncPacketSocket* MuxedPacketSocketFactory::CreateServerTcpSocket(
+    const talk_base::SocketAddress& local_address, int min_port,
+    int max_port, int opts) {
+  return factory_->CreateServerTcpSocket(local_address, min_port, max_port,
+                                         opts);
+}
+
+talk_base::AsyncPacketSocket* MuxedPacketSocketFactory::CreateClientTcpSocket(
+    const talk_base::SocketAddress& local_address,
+    const talk_base::SocketAddress& remote_address,
+    const talk_base::ProxyInfo& proxy_info,
+    const std::string& user_agent, int opts) {
+  return factory_->CreateClientTcpSocket(local_address, remote_address,
+                                         proxy_info, user_agent, opts);
+}
+
+talk_base::AsyncResolverInterface*
+MuxedPacketSocketFactory::CreateAsyncResolver() {
+  return factory_->CreateAsyncResolver();
+}
+
+}  // namespace tincan
@@ -0,0 +1,162 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_SHAREDSOCKETFACTORY_H_
+#define TINCAN_SHAREDSOCKETFACTORY_H_
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "talk/base/asyncpacketsocket.h"
+#include "talk/base/ipaddress.h"
+#include "talk/base/scoped_ptr.h"
+#include "talk/base/sigslot.h"
+#include "talk/base/socketaddress.h"
+#include "talk/p2p/base/packetsocketfactory.h"
+
+namespace tincan {
+
+class MuxedUdpSocket;
+
+// SharedUdpSocket owns the single UDP socket bound on a local address and
+// demultiplexes incoming packets to the MuxedUdpSocket of the peer they
+// belong to. STUN responses are matched by transaction id, STUN requests by
+// the local ICE ufrag and everything else by remote address.
+class SharedUdpSocket : public sigslot::has_slots<> {
+ public:
+  explicit SharedUdpSocket(talk_base::AsyncPacketSocket* socket);
+
+  talk_base::AsyncPacketSocket* socket() const { return socket_.get(); }
+
+  void Register(MuxedUdpSocket* muxed);
+  void Unregister(MuxedUdpSocket* muxed);
+
+  int SendTo(MuxedUdpSocket* muxed, const void* data, size_t len,
+             const talk_base::SocketAddress& addr,
+             const talk_base::PacketOptions& options);
+
+ private:
+  void OnReadPacket(talk_base::AsyncPacketSocket* socket, const char* data,
+                    size_t len, const talk_base::SocketAddress& addr,
+                    const talk_base::PacketTime& ptime);
+  void OnReadyToSend(talk_base::AsyncPacketSocket* socket);
+  MuxedUdpSocket* Lookup(const char* data, size_t len,
+                         const talk_base::SocketAddress& addr);
+  void AddTransaction(const std::string& txid, MuxedUdpSocket* muxed);
+
+  talk_base::scoped_ptr<talk_base::AsyncPacketSocket> socket_;
+  std::map<std::string, MuxedUdpSocket*> ufrag_map_;
+  // a NULL entry means that more than one peer sends to this address
+  // (e.g. the STUN server) so it cannot be used for demultiplexing
+  std::map<talk_base::SocketAddress, MuxedUdpSocket*> addr_map_;
+  std::map<std::string, MuxedUdpSocket*> txn_map_;
+  std::deque<std::string> txn_order_;
+};
+
+// MuxedUdpSocket is the per-peer view of a SharedUdpSocket handed out to
+// libjingle ports, it looks like an unconnected UDP socket to them
+class MuxedUdpSocket : public talk_base::AsyncPacketSocket {
+ public:
+  MuxedUdpSocket(SharedUdpSocket* shared, const std::string& ufrag);
+  virtual ~MuxedUdpSocket();
+
+  const std::string& ufrag() const { return ufrag_; }
+
+  void Deliver(const char* data, size_t len,
+               const talk_base::SocketAddress& addr,
+               const talk_base::PacketTime& ptime);
+
+  // Inherited from AsyncPacketSocket
+  virtual talk_base::SocketAddress GetLocalAddress() const;
+  virtual talk_base::SocketAddress GetRemoteAddress() const;
+  virtual int Send(const void* data, size_t len,
+                   const talk_base::PacketOptions& options);
+  virtual int SendTo(const void* data, size_t len,
+                     const talk_base::SocketAddress& addr,
+                     const talk_base::PacketOptions& options);
+  virtual int Close();
+  virtual State GetState() const;
+  virtual int GetOption(talk_base::Socket::Option opt, int* value);
+  virtual int SetOption(talk_base::Socket::Option opt, int value);
+  virtual int GetError() const;
+  virtual void SetError(int error);
+
+ private:
+  SharedUdpSocket* shared_;
+  std::string ufrag_;
+  State state_;
+};
+
+// SharedSocketPool keeps one SharedUdpSocket per local IP address, it must
+// only be used on the packet handling thread
+class SharedSocketPool {
+ public:
+  explicit SharedSocketPool(talk_base::PacketSocketFactory* factory);
+  ~SharedSocketPool();
+
+  SharedUdpSocket* GetSocket(const talk_base::IPAddress& ip, int min_port,
+                             int max_port);
+
+  void set_port(int port) { port_ = port; }
+
+  size_t size() const { return sockets_.size(); }
+
+ private:
+  talk_base::PacketSocketFactory* factory_;
+  int port_;
+  std::map<talk_base::IPAddress, SharedUdpSocket*> sockets_;
+};
+
+// MuxedPacketSocketFactory is created for each peer, UDP sockets come from
+// the shared pool and are tagged with the peer's local ICE ufrag, TCP
+// sockets are created by the regular factory
+class MuxedPacketSocketFactory : public talk_base::PacketSocketFactory {
+ public:
+  MuxedPacketSocketFactory(SharedSocketPool* pool,
+                           talk_base::PacketSocketFactory* factory,
+                           const std::string& ufrag);
+
+  // Inherited from PacketSocketFactory
+  virtual talk_base::AsyncPacketSocket* CreateUdpSocket(
+      const talk_base::SocketAddress& address, int min_port, int max_port);
+  virtual talk_base::AsyncPacketSocket* CreateServerTcpSocket(
+      const talk_base::SocketAddress& local_address, int min_port,
+      int max_port, int opts);
+  virtual talk_base::AsyncPacketSocket* CreateClientTcpSocket(
+      const talk_base::SocketAddress& local_address,
+      const talk_base::SocketAddress& remote_address,
+      const talk_base::ProxyInfo& proxy_info,
+      const std::string& user_agent, int opts);
+  virtual talk_base::AsyncResolverInterface* CreateAsyncResolver();
+
+ private:
+  SharedSocketPool* pool_;
+  talk_base::PacketSocketFactory* factory_;
+  std::string ufrag_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_SHAREDSOCKETFACTORY_H_
@@ -0,0 +1,114 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "talk/base/base64.h"
+#include "zlib.h"
+
+#include "signalcompression.h"
+
+namespace tincan {
+
+// inflated bodies are bounded so that a peer cannot make us allocate
+// without limit
+static const size_t kMaxBodySize = 64 * 1024;
+
+// deflate finds matches in the dictionary as if it preceded the body, the
+// most common tokens go last where the distances are shortest
+static const char kDictionary[] =
+    "fe80::192.168.10.0.172.16.:tcp:stun:relay:prflx:"
+    ":wlan0:eth0:0:1:udp:pwd:local:sha-256 ";
+
+bool CompressBody(const std::string& data, std::string* out) {
+  if (data.size() < kMinCompressSize || data.size() > kMaxBodySize) {
+    return false;
+  }
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK) return false;
+  if (deflateSetDictionary(&stream,
+          reinterpret_cast<const Bytef*>(kDictionary),
+          sizeof(kDictionary) - 1) != Z_OK) {
+    deflateEnd(&stream);
+    return false;
+  }
+  std::string deflated(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&deflated[0]);
+  stream.avail_out = deflated.size();
+  int res = deflate(&stream, Z_FINISH);
+  size_t len = stream.total_out;
+  deflateEnd(&stream);
+  if (res != Z_STREAM_END) return false;
+
+  std::string encoded;
+  talk_base::Base64::EncodeFromArray(deflated.data(), len, &encoded);
+  if (encoded.size() >= data.size()) return false;
+  out->swap(encoded);
+  return true;
+}
+
+bool DecompressBody(const std::string& body, std::string* out) {
+  std::string deflated;
+  if (!talk_base::Base64::DecodeFromArray(body.data(), body.size(),
+          talk_base::Base64::DO_STRICT, &deflated, NULL)) return false;
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) return false;
+  stream.next_in = reinterpret_cast<Bytef*>(&deflated[0]);
+  stream.avail_in = deflated.size();
+  std::string result;
+  char buffer[4096];
+  int res = Z_OK;
+  while (res != Z_STREAM_END) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    res = inflate(&stream, Z_NO_FLUSH);
+    if (res == Z_NEED_DICT) {
+      res = inflateSetDictionary(&stream,
+                reinterpret_cast<const Bytef*>(kDictionary),
+                sizeof(kDictionary) - 1);
+      continue;
+    }
+    if (res != Z_OK && res != Z_STREAM_END) break;
+    result.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (result.size() > kMaxBodySize) {
+      res = Z_DATA_ERROR;
+      break;
+    }
+    // truncated input, inflate cannot make progress
+    if (res == Z_OK && stream.avail_in == 0 && stream.avail_out != 0) {
+      res = Z_DATA_ERROR;
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  if (res != Z_STREAM_END) return false;
+  out->swap(result);
+  return true;
+}
+
+}  // namespace tincan
@@ -0,0 +1,47 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_SIGNALCOMPRESSION_H_
+#define TINCAN_SIGNALCOMPRESSION_H_
+#pragma once
+
+#include <string>
+
+namespace tincan {
+
+// Signaling bodies (fingerprints and candidate lists) are deflated with a
+// preset dictionary of the tokens they usually contain and sent in base64.
+// Bodies shorter than kMinCompressSize are left alone, the base64 overhead
+// eats the gain.
+static const size_t kMinCompressSize = 128;
+
+// returns false if the compressed body would not be shorter than data
+bool CompressBody(const std::string& data, std::string* out);
+
+// returns false if body is not valid base64 or deflate data or would
+// inflate to more than 64 KB
+bool DecompressBody(const std::string& body, std::string* out);
+
+}  // namespace tincan
+
+#endif  // TINCAN_SIGNALCOMPRESSION_H_
@@ -0,0 +1,100 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string>
+
+#include "talk/base/base64.h"
+#include "talk/base/basictypes.h"
+#include "talk/base/gunit.h"
+#include "zlib.h"
+
+#include "signalcompression.h"
+
+namespace tincan {
+
+static const char kFingerprint[] =
+    "sha-256 4A:1B:22:9C:DE:10:FF:93:A2:77:0C:5D:E1:34:8B:6F:90:2A:C3:44:"
+    "19:7E:D0:B5:68:3F:A9:12:4C:E7:81:2D";
+static const char kCandidates[] =
+    " udp1:1:udp:192.168.1.23:51234:2130706431:a1b2c3d4e5f6g7h8:pwd:local:"
+    "eth0:0:1234567890"
+    " udp2:1:udp:73.12.201.45:51234:1694498815:a1b2c3d4e5f6g7h8:pwd:stun:"
+    "eth0:0:2345678901"
+    " udp3:1:udp:10.0.3.15:51236:2130706431:a1b2c3d4e5f6g7h8:pwd:local:"
+    "wlan0:0:4567890123";
+
+TEST(SignalCompressionTest, RoundTrip) {
+  std::string body = std::string(kFingerprint) + kCandidates;
+  std::string compressed;
+  ASSERT_TRUE(CompressBody(body, &compressed));
+  EXPECT_GT(body.size(), compressed.size());
+  std::string inflated;
+  ASSERT_TRUE(DecompressBody(compressed, &inflated));
+  EXPECT_EQ(body, inflated);
+}
+
+TEST(SignalCompressionTest, LeavesShortBodies) {
+  std::string compressed;
+  EXPECT_FALSE(CompressBody(kFingerprint, &compressed));
+  EXPECT_TRUE(compressed.empty());
+}
+
+TEST(SignalCompressionTest, LeavesIncompressibleBodies) {
+  std::string body;
+  uint32 seed = 12345;
+  for (int i = 0; i < 512; i++) {
+    seed = seed * 1103515245 + 12345;
+    body += static_cast<char>(seed >> 16);
+  }
+  std::string compressed;
+  EXPECT_FALSE(CompressBody(body, &compressed));
+}
+
+TEST(SignalCompressionTest, RejectsBadInput) {
+  std::string out;
+  EXPECT_FALSE(DecompressBody("not base64!", &out));
+  EXPECT_FALSE(DecompressBody("AAAAAAAA", &out));
+
+  std::string body = std::string(kFingerprint) + kCandidates;
+  std::string compressed;
+  ASSERT_TRUE(CompressBody(body, &compressed));
+  // cut on a base64 quantum so that only the deflate stream is truncated
+  std::string truncated = compressed.substr(0, compressed.size() / 8 * 4);
+  EXPECT_FALSE(DecompressBody(truncated, &out));
+}
+
+TEST(SignalCompressionTest, BoundsInflatedSize) {
+  // 100 KB of zeros deflate to a few hundred bytes
+  std::string zeros(100 * 1024, '\0');
+  uLongf len = compressBound(zeros.size());
+  std::string deflated(len, '\0');
+  ASSERT_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(&deflated[0]), &len,
+                            reinterpret_cast<const Bytef*>(zeros.data()),
+                            zeros.size(), Z_BEST_COMPRESSION));
+  std::string body;
+  talk_base::Base64::EncodeFromArray(deflated.data(), len, &body);
+  std::string out;
+  EXPECT_FALSE(DecompressBody(body, &out));
+}
+
+}  // namespace tincan
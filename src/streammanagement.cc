@@ -0,0 +1,278 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+
+#include "talk/base/logging.h"
+#include "talk/base/stringencode.h"
+#include "talk/xmpp/constants.h"
+
+#include "streammanagement.h"
+#include "tincan_utils.h"
+
+namespace tincan {
+
+static const char kSmNamespace[] = "urn:xmpp:sm:3";
+static const buzz::StaticQName QN_SM_ENABLE = { kSmNamespace, "enable" };
+static const buzz::StaticQName QN_SM_ENABLED = { kSmNamespace, "enabled" };
+static const buzz::StaticQName QN_SM_FAILED = { kSmNamespace, "failed" };
+static const buzz::StaticQName QN_SM_R = { kSmNamespace, "r" };
+static const buzz::StaticQName QN_SM_A = { kSmNamespace, "a" };
+static const buzz::StaticQName QN_SM_H = { "", "h" };
+// unacknowledged stanzas kept for a replay, the oldest are dropped first
+static const size_t kMaxUnacked = 256;
+
+// true if a top level element with this name counts as a stanza
+static bool IsStanzaName(const std::string& name) {
+  return name == "iq" || name == "message" || name == "presence";
+}
+
+StreamManagement::StreamManagement()
+    : counting_(false),
+      enabled_(false),
+      offered_(false),
+      outbound_(0),
+      inbound_(0),
+      scan_state_(SCAN_TEXT),
+      depth_(1),
+      quote_(0),
+      slash_(false) {
+}
+
+StreamManagement::~StreamManagement() {
+  for (size_t i = 0; i < unacked_.size(); i++) delete unacked_[i].second;
+  for (size_t i = 0; i < replay_.size(); i++) delete replay_[i];
+}
+
+void StreamManagement::Reset() {
+  // their numbers belong to the old stream
+  for (size_t i = 0; i < unacked_.size(); i++) {
+    replay_.push_back(unacked_[i].second);
+  }
+  unacked_.clear();
+  counting_ = true;
+  enabled_ = false;
+  outbound_ = 0;
+  scan_state_ = SCAN_TEXT;
+  depth_ = 1;
+  slash_ = false;
+  tag_name_.clear();
+}
+
+void StreamManagement::Stop() {
+  counting_ = false;
+  enabled_ = false;
+}
+
+void StreamManagement::ClearFeatures() {
+  offered_ = false;
+  feature_tail_.clear();
+}
+
+void StreamManagement::ScanFeatures(const char* data, size_t len) {
+  if (offered_) return;
+  feature_tail_.append(data, len);
+  if (feature_tail_.find(kSmNamespace) != std::string::npos) {
+    offered_ = true;
+    feature_tail_.clear();
+    return;
+  }
+  size_t keep = sizeof(kSmNamespace) - 2;
+  if (feature_tail_.size() > keep) {
+    feature_tail_.erase(0, feature_tail_.size() - keep);
+  }
+}
+
+void StreamManagement::EndTagName() {
+  // stanzas are the children of the stream element
+  if (depth_ == 2 && IsStanzaName(tag_name_)) outbound_++;
+  tag_name_.clear();
+  scan_state_ = SCAN_TAG;
+}
+
+void StreamManagement::CountOutput(const char* data, size_t len) {
+  if (!counting_) return;
+  // the printer escapes markup in text and attribute values, so tags can
+  // be found without parsing the stanzas
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (scan_state_) {
+      case SCAN_TEXT:
+        if (c == '<') scan_state_ = SCAN_TAG_START;
+        break;
+      case SCAN_TAG_START:
+        if (c == '/') {
+          depth_--;
+          scan_state_ = SCAN_SKIP;
+        }
+        else if (c == '?' || c == '!') {
+          scan_state_ = SCAN_SKIP;
+        }
+        else {
+          depth_++;
+          slash_ = false;
+          tag_name_ = c;
+          scan_state_ = SCAN_TAG_NAME;
+        }
+        break;
+      case SCAN_TAG_NAME:
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != '/' &&
+            c != '>') {
+          tag_name_ += c;
+          break;
+        }
+        EndTagName();
+        // fall through, the character may end the tag
+      case SCAN_TAG:
+        if (c == '"' || c == '\'') {
+          quote_ = c;
+          scan_state_ = SCAN_QUOTE;
+        }
+        else if (c == '>') {
+          if (slash_) depth_--;
+          scan_state_ = SCAN_TEXT;
+        }
+        slash_ = c == '/';
+        break;
+      case SCAN_QUOTE:
+        if (c == quote_) scan_state_ = SCAN_TAG;
+        break;
+      case SCAN_SKIP:
+        if (c == '>') scan_state_ = SCAN_TEXT;
+        break;
+    }
+  }
+}
+
+void StreamManagement::Track(const buzz::XmlElement* stanza) {
+  // before <enabled/> the server may not count, nothing could be acked
+  if (!counting_ || !enabled_) return;
+  if (unacked_.size() >= kMaxUnacked) {
+    delete unacked_.front().second;
+    unacked_.pop_front();
+  }
+  unacked_.push_back(
+      std::make_pair(outbound_, new buzz::XmlElement(*stanza)));
+}
+
+void StreamManagement::Ack(uint32 handled) {
+  // the counters wrap at 2^32
+  while (!unacked_.empty() &&
+         static_cast<int32>(unacked_.front().first - handled) <= 0) {
+    delete unacked_.front().second;
+    unacked_.pop_front();
+  }
+}
+
+void StreamManagement::TakeReplay(std::vector<buzz::XmlElement*>* stanzas) {
+  stanzas->insert(stanzas->end(), replay_.begin(), replay_.end());
+  replay_.clear();
+}
+
+void StreamManagement::TakeUnacked(std::vector<buzz::XmlElement*>* stanzas) {
+  TakeReplay(stanzas);
+  for (size_t i = 0; i < unacked_.size(); i++) {
+    stanzas->push_back(unacked_[i].second);
+  }
+  unacked_.clear();
+}
+
+StreamManagementTask::StreamManagementTask(
+    buzz::XmppTaskParentInterface* parent, StreamManagement* sm)
+  : XmppTask(parent, buzz::XmppEngine::HL_PEEK),
+    sm_(sm) {
+}
+
+void StreamManagementTask::Enable() {
+  if (!sm_->offered()) {
+    LOG_TS(INFO) << "XMPP STREAM MANAGEMENT NOT OFFERED";
+    std::vector<buzz::XmlElement*> stanzas;
+    sm_->TakeUnacked(&stanzas);
+    for (size_t i = 0; i < stanzas.size(); i++) {
+      SendStanza(stanzas[i]);
+      delete stanzas[i];
+    }
+    return;
+  }
+  // stanzas are counted from the enable request on
+  sm_->Reset();
+  buzz::XmlElement enable(QN_SM_ENABLE, true);
+  SendStanza(&enable);
+}
+
+void StreamManagementTask::Replay() {
+  // the replayed stanzas are tracked again under their new numbers
+  std::vector<buzz::XmlElement*> stanzas;
+  sm_->TakeReplay(&stanzas);
+  for (size_t i = 0; i < stanzas.size(); i++) {
+    SendStanza(stanzas[i]);
+    sm_->Track(stanzas[i]);
+    delete stanzas[i];
+  }
+  if (!stanzas.empty()) {
+    LOG_TS(INFO) << "XMPP REPLAY " << stanzas.size();
+    RequestAck();
+  }
+}
+
+void StreamManagementTask::RequestAck() {
+  buzz::XmlElement request(QN_SM_R, true);
+  SendStanza(&request);
+}
+
+int StreamManagementTask::ProcessStart() {
+  // all the work is done in HandleStanza
+  return STATE_BLOCKED;
+}
+
+bool StreamManagementTask::HandleStanza(const buzz::XmlElement* stanza) {
+  if (stanza->Name() == QN_SM_R) {
+    buzz::XmlElement answer(QN_SM_A, true);
+    answer.AddAttr(QN_SM_H, talk_base::ToString(sm_->inbound()));
+    SendStanza(&answer);
+  }
+  else if (stanza->Name() == QN_SM_A) {
+    sm_->Ack(strtoul(stanza->Attr(QN_SM_H).c_str(), NULL, 10));
+  }
+  else if (stanza->Name() == QN_SM_ENABLED) {
+    sm_->set_enabled(true);
+    sm_->ResetInbound();
+    LOG_TS(INFO) << "XMPP STREAM MANAGEMENT ENABLED";
+    SignalEnabled();
+  }
+  else if (stanza->Name() == QN_SM_FAILED) {
+    // nothing sent on this stream can be confirmed
+    LOG_TS(LERROR) << "XMPP STREAM MANAGEMENT FAILED";
+    sm_->Stop();
+    std::vector<buzz::XmlElement*> stanzas;
+    sm_->TakeUnacked(&stanzas);
+    for (size_t i = 0; i < stanzas.size(); i++) delete stanzas[i];
+  }
+  else if (IsStanzaName(stanza->Name().LocalPart())) {
+    sm_->CountInput();
+  }
+  // peek handlers only watch, the stanza goes on to the other tasks
+  return false;
+}
+
+}  // namespace tincan
@@ -0,0 +1,160 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_STREAMMANAGEMENT_H_
+#define TINCAN_STREAMMANAGEMENT_H_
+#pragma once
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "talk/base/basictypes.h"
+#include "talk/base/sigslot.h"
+#include "talk/xmllite/xmlelement.h"
+#include "talk/xmpp/xmpptask.h"
+
+namespace tincan {
+
+// StreamManagement keeps the counters of XEP-0198 acknowledgements for one
+// XMPP stream and the stanzas the server has not acknowledged yet. libjingle
+// has no hook for outgoing stanzas so they are counted from the serialized
+// output stream. Stanzas are only tracked once the server has enabled
+// acknowledgements, the queue is capped and outlives the stream, stanzas
+// left in it are replayed after the next login.
+class StreamManagement {
+ public:
+  StreamManagement();
+  ~StreamManagement();
+
+  bool enabled() const { return enabled_; }
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  // true if the stream features of the server named urn:xmpp:sm:3
+  bool offered() const { return offered_; }
+  uint32 inbound() const { return inbound_; }
+  size_t unacked() const { return unacked_.size(); }
+
+  // starts counting on a new stream, called right before <enable/> is sent.
+  // The stanzas still unacknowledged are put aside for TakeReplay.
+  void Reset();
+
+  // stops counting, the stream is gone or the server refused to enable
+  void Stop();
+
+  // forgets the features of the last stream, called before connecting
+  void ClearFeatures();
+
+  // feeds the input of the client until the stream is open, the features
+  // offer stream management when they carry its namespace
+  void ScanFeatures(const char* data, size_t len);
+
+  // feeds the serialized output of the client, which must have passed the
+  // stream header already
+  void CountOutput(const char* data, size_t len);
+
+  void CountInput() { if (counting_) inbound_++; }
+
+  // the server counts its stanzas from <enabled/> on, the stanzas it sent
+  // before that must not be acknowledged
+  void ResetInbound() { inbound_ = 0; }
+
+  // keeps a copy of a stanza that was just sent until it is acknowledged,
+  // the oldest copy is dropped when the queue is full
+  void Track(const buzz::XmlElement* stanza);
+
+  // the server has handled this many stanzas of the stream
+  void Ack(uint32 handled);
+
+  // moves the stanzas put aside by Reset to stanzas, oldest first, the
+  // caller owns them
+  void TakeReplay(std::vector<buzz::XmlElement*>* stanzas);
+
+  // moves every stanza that was not acknowledged, including those put
+  // aside, to stanzas, oldest first, the caller owns them
+  void TakeUnacked(std::vector<buzz::XmlElement*>* stanzas);
+
+ private:
+  enum ScanState {
+    SCAN_TEXT,
+    SCAN_TAG_START,
+    SCAN_TAG_NAME,
+    SCAN_TAG,
+    SCAN_QUOTE,
+    SCAN_SKIP,
+  };
+
+  void EndTagName();
+
+  bool counting_;
+  bool enabled_;
+  bool offered_;
+  // the end of the input seen so far, the namespace may span two reads
+  std::string feature_tail_;
+  uint32 outbound_;
+  uint32 inbound_;
+  // state of the output scanner, depth 1 is the stream element
+  ScanState scan_state_;
+  int depth_;
+  char quote_;
+  bool slash_;
+  std::string tag_name_;
+  // stanza number within the stream and a copy of the stanza
+  std::deque<std::pair<uint32, buzz::XmlElement*> > unacked_;
+  // stanzas of an earlier stream waiting to be sent again
+  std::vector<buzz::XmlElement*> replay_;
+};
+
+// StreamManagementTask enables acknowledgements on the stream, answers ack
+// requests of the server and counts incoming stanzas. It sees every stanza
+// before the other tasks.
+class StreamManagementTask : public buzz::XmppTask {
+ public:
+  StreamManagementTask(buzz::XmppTaskParentInterface* parent,
+                       StreamManagement* sm);
+
+  // sends <enable/> when the server offers stream management, without it
+  // the stanzas left from the last stream are sent once more untracked
+  void Enable();
+
+  // sends and tracks the stanzas left from the last stream, called from the
+  // message loop after SignalEnabled
+  void Replay();
+
+  // asks the server to acknowledge what was sent so far
+  void RequestAck();
+
+  // the server answered <enabled/>, fired while the client handles input
+  sigslot::signal0<> SignalEnabled;
+
+ protected:
+  virtual int ProcessStart();
+  virtual bool HandleStanza(const buzz::XmlElement* stanza);
+
+ private:
+  StreamManagement* sm_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_STREAMMANAGEMENT_H_
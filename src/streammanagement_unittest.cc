@@ -0,0 +1,167 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "talk/base/gunit.h"
+#include "talk/xmllite/xmlelement.h"
+#include "talk/xmpp/constants.h"
+
+#include "streammanagement.h"
+
+namespace tincan {
+
+static const char kIq[] = "<iq type=\"get\" id=\"1\"><query/></iq>";
+
+class StreamManagementTest : public testing::Test {
+ protected:
+  // serializes and tracks one stanza like the client does
+  void Send(const std::string& output, const buzz::XmlElement& stanza) {
+    sm_.CountOutput(output.data(), output.size());
+    sm_.Track(&stanza);
+  }
+
+  void Output(const char* output) {
+    sm_.CountOutput(output, strlen(output));
+  }
+
+  void Free(std::vector<buzz::XmlElement*>* stanzas) {
+    for (size_t i = 0; i < stanzas->size(); i++) delete (*stanzas)[i];
+    stanzas->clear();
+  }
+
+  StreamManagement sm_;
+};
+
+TEST_F(StreamManagementTest, ScansFeatures) {
+  EXPECT_FALSE(sm_.offered());
+  // the namespace may be split over two reads
+  const char first[] = "<stream:features><sm xmlns='urn:xm";
+  const char second[] = "pp:sm:3'/></stream:features>";
+  sm_.ScanFeatures(first, strlen(first));
+  EXPECT_FALSE(sm_.offered());
+  sm_.ScanFeatures(second, strlen(second));
+  EXPECT_TRUE(sm_.offered());
+  sm_.ClearFeatures();
+  EXPECT_FALSE(sm_.offered());
+}
+
+TEST_F(StreamManagementTest, TracksOnlyOnceEnabled) {
+  buzz::XmlElement iq(buzz::QN_IQ);
+  sm_.Reset();
+  Send(kIq, iq);
+  EXPECT_EQ(0U, sm_.unacked());
+  sm_.set_enabled(true);
+  Send(kIq, iq);
+  EXPECT_EQ(1U, sm_.unacked());
+  sm_.Stop();
+  Send(kIq, iq);
+  EXPECT_EQ(1U, sm_.unacked());
+}
+
+TEST_F(StreamManagementTest, CountsStanzasInOutput) {
+  buzz::XmlElement iq(buzz::QN_IQ);
+  sm_.Reset();
+  sm_.set_enabled(true);
+  // nonzas and escaped markup are not counted, stanzas may be split
+  Output("<enable xmlns='urn:xmpp:sm:3'/>");
+  Send("<iq id='a>b' type=\"get\"><data>x/&gt;&lt;y</data></iq>", iq);
+  Output("<r xmlns='urn:xmpp:sm:3'/>");
+  Output("<pres");
+  Send("ence><show>chat</show></presence>", iq);
+  Send("<message><body>hi</body></message>", iq);
+  EXPECT_EQ(3U, sm_.unacked());
+  sm_.Ack(1);
+  EXPECT_EQ(2U, sm_.unacked());
+  sm_.Ack(3);
+  EXPECT_EQ(0U, sm_.unacked());
+}
+
+TEST_F(StreamManagementTest, CapsQueue) {
+  buzz::XmlElement iq(buzz::QN_IQ);
+  sm_.Reset();
+  sm_.set_enabled(true);
+  for (int i = 0; i < 300; i++) Send(kIq, iq);
+  EXPECT_EQ(256U, sm_.unacked());
+  // the oldest were dropped, an ack for them changes nothing
+  sm_.Ack(44);
+  EXPECT_EQ(256U, sm_.unacked());
+  sm_.Ack(45);
+  EXPECT_EQ(255U, sm_.unacked());
+}
+
+TEST_F(StreamManagementTest, CountsInputFromEnabled) {
+  sm_.CountInput();
+  EXPECT_EQ(0U, sm_.inbound());
+  sm_.Reset();
+  sm_.CountInput();
+  sm_.CountInput();
+  // the stanzas the server sent before <enabled/> are not counted
+  sm_.set_enabled(true);
+  sm_.ResetInbound();
+  EXPECT_EQ(0U, sm_.inbound());
+  sm_.CountInput();
+  EXPECT_EQ(1U, sm_.inbound());
+  sm_.Stop();
+  sm_.CountInput();
+  EXPECT_EQ(1U, sm_.inbound());
+}
+
+TEST_F(StreamManagementTest, ReplaysAfterReset) {
+  buzz::XmlElement iq(buzz::QN_IQ);
+  buzz::XmlElement message(buzz::QN_MESSAGE);
+  sm_.Reset();
+  sm_.set_enabled(true);
+  Send(kIq, iq);
+  Send("<message/>", message);
+  sm_.Ack(1);
+
+  // a new stream puts the message aside, new stanzas are tracked apart
+  sm_.Reset();
+  EXPECT_EQ(0U, sm_.unacked());
+  sm_.set_enabled(true);
+  Send(kIq, iq);
+  std::vector<buzz::XmlElement*> stanzas;
+  sm_.TakeReplay(&stanzas);
+  ASSERT_EQ(1U, stanzas.size());
+  EXPECT_TRUE(stanzas[0]->Name() == buzz::QN_MESSAGE);
+  Free(&stanzas);
+  sm_.TakeReplay(&stanzas);
+  EXPECT_TRUE(stanzas.empty());
+
+  // TakeUnacked returns the replay before the stanzas of this stream
+  sm_.Reset();
+  sm_.set_enabled(true);
+  Send("<message/>", message);
+  sm_.TakeUnacked(&stanzas);
+  ASSERT_EQ(2U, stanzas.size());
+  EXPECT_TRUE(stanzas[0]->Name() == buzz::QN_IQ);
+  EXPECT_TRUE(stanzas[1]->Name() == buzz::QN_MESSAGE);
+  Free(&stanzas);
+  EXPECT_EQ(0U, sm_.unacked());
+}
+
+}  // namespace tincan
@@ -41,10 +41,8 @@
 #define SEGMENT_OFFSET 4
 #define CMP_SIZE 7
 
-namespace tincan {
-int kUdpPort = 5800;
-string kTapName ("ipop");
-}
+static const int kDefaultUdpPort = 5800;
+static const char kDefaultTapName[] = "ipop";
 
 class SendRunnable : public talk_base::Runnable {
  public:
@@ -104,7 +102,7 @@ bool SSLVerificationCallback(void* cert) {
 }
 
 /* The below method parses the arguments supplied to tincan*/
-void parse_args(int argc,char **args) {
+void parse_args(int argc,char **args, std::string* tap_name, int* port) {
   if (argc == 2 && strncmp(args[1], "-v", 2)==0)
     {
       std::cout<<endl
@@ -123,23 +121,25 @@ void parse_args(int argc,char **args) {
     }
   if (argc == 3)
     {
-      tincan::kTapName = args[1];
-      tincan::kUdpPort = atoi(args[2]);
+      *tap_name = args[1];
+      *port = atoi(args[2]);
     }
   
 }
 
 int main(int argc, char **argv) {
   // Parse arguments
-  parse_args(argc,argv);
+  std::string tap_name(kDefaultTapName);
+  int port = kDefaultUdpPort;
+  parse_args(argc,argv, &tap_name, &port);
   talk_base::InitializeSSL();
   peerlist_init();
   thread_opts_t opts;
 #if defined(LINUX) || defined(ANDROID)
-  opts.tap = tap_open(tincan::kTapName.c_str(), opts.mac);
+  opts.tap = tap_open(tap_name.c_str(), opts.mac);
   if (opts.tap < 0) return -1;
 #elif defined(WIN32)
-  opts.win32_tap = open_tap(tincan::kTapName.c_str(), opts.mac);
+  opts.win32_tap = open_tap(tap_name.c_str(), opts.mac);
   if (opts.win32_tap < 0) return -1;
 #endif
   opts.translate = 0;
@@ -151,12 +151,15 @@ int main(int argc, char **argv) {
 
   tincan::PeerSignalSender signal_sender;
   tincan::TinCanConnectionManager manager(&signal_sender, &link_setup_thread,
-                                         &packet_handling_thread, &opts);
+                                         &packet_handling_thread, &opts,
+                                         tap_name);
   tincan::XmppNetwork xmpp(&link_setup_thread);
+  manager.set_peer_directory(xmpp.directory());
   xmpp.HandlePeer.connect(&manager,
       &tincan::TinCanConnectionManager::HandlePeer);
   talk_base::BasicPacketSocketFactory packet_factory;
-  tincan::ControllerAccess controller(manager, xmpp, &packet_factory, &opts);
+  tincan::ControllerAccess controller(manager, xmpp, &packet_factory, &opts,
+                                      port);
   signal_sender.add_service(0, &controller);
   signal_sender.add_service(1, &xmpp);
   opts.send_func = &tincan::TinCanConnectionManager::DoPacketSend;
@@ -21,9 +21,13 @@
  * THE SOFTWARE.
 */
 
-#if defined(LINUX)
 #include "tincan_utils.h"
 
+#if defined(LINUX)
+#include <dirent.h>
+#include <stdio.h>
+#include <unistd.h>
+
 namespace tincan {
 
   std::ostream & operator << (std::ostream & out, const CurrentTime & ct) {
@@ -44,5 +48,37 @@ namespace tincan {
     return out;
   }
 
+  int OpenFileCount() {
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) return -1;
+    int count = 0;
+    while (readdir(dir) != NULL) count++;
+    closedir(dir);
+    // do not count ".", ".." and the descriptor of dir itself
+    return count - 3;
+  }
+
+  long ResidentMemoryKb() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == NULL) return -1;
+    long size = 0, resident = 0;
+    int fields = fscanf(file, "%ld %ld", &size, &resident);
+    fclose(file);
+    if (fields != 2) return -1;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+
+} //namespace tincan
+#else
+namespace tincan {
+
+  int OpenFileCount() {
+    return -1;
+  }
+
+  long ResidentMemoryKb() {
+    return -1;
+  }
+
 } //namespace tincan
 #endif //if defined(LINUX)
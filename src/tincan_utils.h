@@ -69,6 +69,12 @@ class CurrentTime {
   friend std::ostream & operator << (std::ostream &, const CurrentTime &);
 };
 
+// number of open file descriptors of this process, -1 if unknown
+int OpenFileCount();
+
+// resident memory of this process in kB, -1 if unknown
+long ResidentMemoryKb();
+
 } //namespace tincan
 
 #endif //ifndef TINCAN_UTILS_H_
@@ -0,0 +1,353 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <algorithm>
+
+#include "talk/base/logging.h"
+#include "talk/base/timeutils.h"
+#include "talk/p2p/base/port.h"
+
+#include "tincan_utils.h"
+
+#include "tincanchannel.h"
+
+namespace tincan {
+
+// weights are inversely proportional to the rtt, rtts below the minimum
+// are treated as equal
+static const uint32 kWeightScale = 1 << 16;
+static const int kMinRtt = 1;
+
+// paths are compared once a second while packets are sent, a faster path
+// has to beat the current one by 20% in three rounds in a row
+static const uint32 kEvaluateInterval = 1000;
+static const int kSwitchPercent = 80;
+static const int kSwitchRounds = 3;
+// libjingle does not signal new connections, the ports are scanned for
+// them this often while packets are sent
+static const uint32 kScanInterval = 1000;
+// relayed paths count as this much slower so direct paths win ties
+static const int kRelayPenalty = 2;
+
+static const size_t kEthHeaderLen = 14;
+static const size_t kEthTypeOffset = 12;
+static const uint16 kEthTypeIp4 = 0x0800;
+static const uint16 kEthTypeIp6 = 0x86DD;
+static const uint8 kProtoTcp = 6;
+static const uint8 kProtoUdp = 17;
+static const uint32 kFnvOffset = 2166136261U;
+static const uint32 kFnvPrime = 16777619U;
+
+static uint32 FnvAdd(uint32 hash, const uint8* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+uint32 FlowHash(const char* frame, size_t len) {
+  const uint8* data = reinterpret_cast<const uint8*>(frame);
+  uint32 hash = kFnvOffset;
+  if (len < kEthHeaderLen) return FnvAdd(hash, data, len);
+  uint16 type = (data[kEthTypeOffset] << 8) | data[kEthTypeOffset + 1];
+  const uint8* ip = data + kEthHeaderLen;
+  size_t ip_len = len - kEthHeaderLen;
+  uint8 proto = 0;
+  const uint8* ports = NULL;
+
+  if (type == kEthTypeIp4 && ip_len >= 20) {
+    size_t ihl = (ip[0] & 0x0F) * 4;
+    proto = ip[9];
+    // source and destination address
+    hash = FnvAdd(hash, ip + 12, 8);
+    if (ip_len >= ihl + 4) ports = ip + ihl;
+  }
+  else if (type == kEthTypeIp6 && ip_len >= 40) {
+    proto = ip[6];
+    hash = FnvAdd(hash, ip + 8, 32);
+    if (ip_len >= 44) ports = ip + 40;
+  }
+  else {
+    // not IP, the MAC addresses identify the flow
+    return FnvAdd(hash, data, kEthTypeOffset);
+  }
+
+  hash = FnvAdd(hash, &proto, 1);
+  if (ports != NULL && (proto == kProtoTcp || proto == kProtoUdp)) {
+    hash = FnvAdd(hash, ports, 4);
+  }
+  return hash;
+}
+
+static bool IsRelayed(const cricket::Connection* connection) {
+  return connection->local_candidate().type() == cricket::RELAY_PORT_TYPE ||
+         connection->remote_candidate().type() == cricket::RELAY_PORT_TYPE;
+}
+
+static int PathCost(const cricket::Connection* connection) {
+  int cost = std::max(connection->rtt(), kMinRtt);
+  return IsRelayed(connection) ? cost * kRelayPenalty : cost;
+}
+
+void ConnectionRef::Set(cricket::Connection* connection) {
+  if (connection_ == connection) return;
+  if (connection_ != NULL) connection_->SignalDestroyed.disconnect(this);
+  connection_ = connection;
+  if (connection_ != NULL) {
+    connection_->SignalDestroyed.connect(this, &ConnectionRef::OnDestroyed);
+  }
+}
+
+void ConnectionRef::OnDestroyed(cricket::Connection* connection) {
+  if (connection == connection_) connection_ = NULL;
+}
+
+TinCanTransportChannel::TinCanTransportChannel(
+    const std::string& content_name, int component,
+    TinCanP2PTransport* transport, cricket::PortAllocator* allocator)
+    : cricket::P2PTransportChannel(content_name, component, transport,
+                                   allocator),
+      owner_(transport),
+      challenger_(NULL),
+      challenger_rounds_(0),
+      last_evaluation_(0),
+      path_switches_(0),
+      paths_dirty_(true),
+      last_scan_(0) {
+  SignalRouteChange.connect(this, &TinCanTransportChannel::OnRouteChange);
+  SignalReadableState.connect(this,
+                              &TinCanTransportChannel::OnChannelStateChange);
+  SignalWritableState.connect(this,
+                              &TinCanTransportChannel::OnChannelStateChange);
+}
+
+TinCanTransportChannel::~TinCanTransportChannel() {
+  // the base class destroys the connections after our members are gone
+  for (std::set<cricket::Connection*>::iterator it = watched_.begin();
+       it != watched_.end(); ++it) {
+    (*it)->SignalStateChange.disconnect(this);
+    (*it)->SignalDestroyed.disconnect(this);
+  }
+}
+
+void TinCanTransportChannel::OnRouteChange(
+    cricket::TransportChannel* channel, const cricket::Candidate& candidate) {
+  paths_dirty_ = true;
+}
+
+void TinCanTransportChannel::OnChannelStateChange(
+    cricket::TransportChannel* channel) {
+  paths_dirty_ = true;
+}
+
+void TinCanTransportChannel::OnPathStateChange(
+    cricket::Connection* connection) {
+  paths_dirty_ = true;
+}
+
+void TinCanTransportChannel::OnPathDestroyed(
+    cricket::Connection* connection) {
+  watched_.erase(connection);
+  pruned_.erase(connection);
+  paths_dirty_ = true;
+}
+
+void TinCanTransportChannel::PrunePath(cricket::Connection* connection) {
+  LOG_TS(LS_VERBOSE) << "TRIMMING " << connection->ToString();
+  pruned_.insert(connection);
+  connection->Prune();
+  paths_dirty_ = true;
+}
+
+bool TinCanTransportChannel::HasPath(cricket::Connection* connection) const {
+  for (size_t i = 0; i < paths_.size(); i++) {
+    if (paths_[i] == connection) return true;
+  }
+  return false;
+}
+
+void TinCanTransportChannel::EvaluatePaths(uint32 now) {
+  last_evaluation_ = now;
+  UpdatePaths(now);
+  if (preferred_.get() != NULL && !HasPath(preferred_.get())) {
+    preferred_.Set(NULL);
+  }
+  if (paths_.empty()) return;
+
+  cricket::Connection* fastest = paths_[0];
+  for (size_t i = 1; i < paths_.size(); i++) {
+    if (PathCost(paths_[i]) < PathCost(fastest)) fastest = paths_[i];
+  }
+  // without a usable preferred path libjingle's choice is the start point
+  if (preferred_.get() == NULL) {
+    cricket::Connection* best = best_connection();
+    preferred_.Set(HasPath(best) ? best : fastest);
+  }
+
+  cricket::Connection* preferred = preferred_.get();
+  if (fastest != preferred &&
+      PathCost(fastest) * 100 < PathCost(preferred) * kSwitchPercent) {
+    if (fastest == challenger_) {
+      challenger_rounds_++;
+    }
+    else {
+      challenger_ = fastest;
+      challenger_rounds_ = 1;
+    }
+    if (challenger_rounds_ >= kSwitchRounds) {
+      LOG_TS(INFO) << "PATH SWITCH " << preferred->ToString() << " -> "
+                   << fastest->ToString();
+      preferred_.Set(fastest);
+      preferred = fastest;
+      path_switches_++;
+      challenger_ = NULL;
+      challenger_rounds_ = 0;
+    }
+    else {
+      // probe the challenger so its rtt reflects the current conditions
+      fastest->Ping(now);
+    }
+  }
+  else {
+    challenger_ = NULL;
+    challenger_rounds_ = 0;
+  }
+
+  // libjingle may have pruned our path in favour of a higher priority one,
+  // keep probing it so a dead path drops out of the writable set
+  if (preferred != best_connection()) preferred->Ping(now);
+
+  // a working direct path makes the relay unnecessary, as trimming does
+  // for links that came up over a relay
+  if (owner_->prune_relay() && !IsRelayed(preferred)) {
+    for (size_t i = 0; i < paths_.size(); i++) {
+      if (IsRelayed(paths_[i])) PrunePath(paths_[i]);
+    }
+  }
+}
+
+void TinCanTransportChannel::UpdatePaths(uint32 now) {
+  paths_.clear();
+  paths_dirty_ = false;
+  last_scan_ = now;
+  const std::vector<cricket::PortInterface*>& ports = this->ports();
+  for (size_t i = 0; i < ports.size(); i++) {
+    cricket::Port* port = static_cast<cricket::Port*>(ports[i]);
+    const cricket::Port::AddressMap& connections = port->connections();
+    for (cricket::Port::AddressMap::const_iterator it = connections.begin();
+         it != connections.end(); ++it) {
+      cricket::Connection* connection = it->second;
+      if (watched_.insert(connection).second) {
+        connection->SignalStateChange.connect(
+            this, &TinCanTransportChannel::OnPathStateChange);
+        connection->SignalDestroyed.connect(
+            this, &TinCanTransportChannel::OnPathDestroyed);
+      }
+      // pruned connections stay out even if a late response makes them
+      // writable again. Pruning by trimming times out the write state so
+      // the check below drops those as well. Unreliable connections are
+      // losing pings, they are left out until they recover
+      if (pruned_.find(connection) != pruned_.end()) continue;
+      if (connection->connected() &&
+          connection->write_state() == cricket::Connection::STATE_WRITABLE) {
+        paths_.push_back(connection);
+      }
+    }
+  }
+}
+
+int TinCanTransportChannel::SendPacket(const char* data, size_t len,
+                                       const talk_base::PacketOptions& options,
+                                       int flags) {
+  if (flags != 0) {
+    return P2PTransportChannel::SendPacket(data, len, options, flags);
+  }
+  if (!owner_->multipath()) {
+    if (!owner_->path_selection()) {
+      return P2PTransportChannel::SendPacket(data, len, options, flags);
+    }
+    uint32 now = talk_base::Time();
+    if (talk_base::TimeDiff(now, last_evaluation_) >=
+        static_cast<int32>(kEvaluateInterval)) {
+      EvaluatePaths(now);
+    }
+    cricket::Connection* preferred = preferred_.get();
+    if (preferred == NULL || preferred == best_connection()) {
+      return P2PTransportChannel::SendPacket(data, len, options, flags);
+    }
+    int sent = preferred->Send(data, len, options);
+    if (sent <= 0) {
+      return P2PTransportChannel::SendPacket(data, len, options, flags);
+    }
+    return sent;
+  }
+  uint32 now = talk_base::Time();
+  if (paths_dirty_ || talk_base::TimeDiff(now, last_scan_) >=
+                          static_cast<int32>(kScanInterval)) {
+    UpdatePaths(now);
+  }
+  if (paths_.size() < 2) {
+    return P2PTransportChannel::SendPacket(data, len, options, flags);
+  }
+
+  // the flow hint picks a path with a probability proportional to its
+  // weight, so faster paths carry more flows
+  weights_.resize(paths_.size());
+  uint32 total = 0;
+  for (size_t i = 0; i < paths_.size(); i++) {
+    int rtt = std::max(paths_[i]->rtt(), kMinRtt);
+    weights_[i] = kWeightScale / rtt;
+    total += weights_[i];
+  }
+  uint32 slot = owner_->flow_hint() % total;
+  size_t index = 0;
+  while (slot >= weights_[index]) {
+    slot -= weights_[index];
+    index++;
+  }
+  int sent = paths_[index]->Send(data, len, options);
+  if (sent <= 0) {
+    return P2PTransportChannel::SendPacket(data, len, options, flags);
+  }
+  return sent;
+}
+
+TinCanP2PTransport::TinCanP2PTransport(talk_base::Thread* signaling_thread,
+                                       talk_base::Thread* worker_thread,
+                                       const std::string& content_name,
+                                       cricket::PortAllocator* allocator)
+    : cricket::P2PTransport(signaling_thread, worker_thread, content_name,
+                            allocator),
+      multipath_(false),
+      path_selection_(false),
+      prune_relay_(false),
+      flow_hint_(0) {
+}
+
+cricket::TransportChannelImpl* TinCanP2PTransport::CreateTransportChannel(
+    int component) {
+  return new TinCanTransportChannel(content_name(), component, this,
+                                    port_allocator());
+}
+
+}  // namespace tincan
@@ -0,0 +1,152 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_TINCANCHANNEL_H_
+#define TINCAN_TINCANCHANNEL_H_
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "talk/base/basictypes.h"
+#include "talk/base/sigslot.h"
+#include "talk/p2p/base/p2ptransport.h"
+#include "talk/p2p/base/p2ptransportchannel.h"
+
+namespace tincan {
+
+class TinCanP2PTransport;
+
+// ConnectionRef holds a connection pointer that is cleared when libjingle
+// destroys the connection
+class ConnectionRef : public sigslot::has_slots<> {
+ public:
+  ConnectionRef() : connection_(NULL) {}
+
+  cricket::Connection* get() const { return connection_; }
+  void Set(cricket::Connection* connection);
+
+ private:
+  void OnDestroyed(cricket::Connection* connection);
+
+  cricket::Connection* connection_;
+};
+
+// TinCanTransportChannel is the P2PTransportChannel used by all tincan
+// links. In multipath mode packets are spread over every writable
+// connection instead of only the best one, each flow stays on one path so
+// packets of a flow are not reordered. With path selection the channel
+// sends on the connection with the lowest rtt instead of the one with the
+// highest ICE priority, switching only when another path stays clearly
+// faster.
+class TinCanTransportChannel : public cricket::P2PTransportChannel {
+ public:
+  TinCanTransportChannel(const std::string& content_name, int component,
+                         TinCanP2PTransport* transport,
+                         cricket::PortAllocator* allocator);
+  virtual ~TinCanTransportChannel();
+
+  // Inherited from P2PTransportChannel
+  virtual int SendPacket(const char* data, size_t len,
+                         const talk_base::PacketOptions& options, int flags);
+
+  // connection used for sending when path selection is on, may be NULL
+  cricket::Connection* preferred() const { return preferred_.get(); }
+
+  uint32 path_switches() const { return path_switches_; }
+
+ private:
+  void UpdatePaths(uint32 now);
+  void EvaluatePaths(uint32 now);
+  bool HasPath(cricket::Connection* connection) const;
+  void PrunePath(cricket::Connection* connection);
+  void OnRouteChange(cricket::TransportChannel* channel,
+                     const cricket::Candidate& candidate);
+  void OnChannelStateChange(cricket::TransportChannel* channel);
+  void OnPathStateChange(cricket::Connection* connection);
+  void OnPathDestroyed(cricket::Connection* connection);
+
+  TinCanP2PTransport* owner_;
+  ConnectionRef preferred_;
+  // only compared against the current paths, never dereferenced
+  cricket::Connection* challenger_;
+  int challenger_rounds_;
+  uint32 last_evaluation_;
+  uint32 path_switches_;
+  // writable connections, rebuilt when a route or connection state changes
+  // and on a periodic scan for connections created since
+  std::vector<cricket::Connection*> paths_;
+  bool paths_dirty_;
+  uint32 last_scan_;
+  // connections whose state changes we are connected to
+  std::set<cricket::Connection*> watched_;
+  // connections pruned by path selection, never used again
+  std::set<cricket::Connection*> pruned_;
+  std::vector<uint32> weights_;
+};
+
+// TinCanP2PTransport creates TinCanTransportChannels, it is also the base
+// of the DTLS transport so the channel sees the encrypted records. The flow
+// hint is therefore computed from the plain packet by the caller right
+// before it is handed to the transport.
+class TinCanP2PTransport : public cricket::P2PTransport {
+ public:
+  TinCanP2PTransport(talk_base::Thread* signaling_thread,
+                     talk_base::Thread* worker_thread,
+                     const std::string& content_name,
+                     cricket::PortAllocator* allocator);
+
+  bool multipath() const { return multipath_; }
+  void set_multipath(bool multipath) { multipath_ = multipath; }
+
+  bool path_selection() const { return path_selection_; }
+  void set_path_selection(bool path_selection) {
+    path_selection_ = path_selection;
+  }
+
+  // prune relay connections once the selected path is direct
+  bool prune_relay() const { return prune_relay_; }
+  void set_prune_relay(bool prune_relay) { prune_relay_ = prune_relay; }
+
+  uint32 flow_hint() const { return flow_hint_; }
+  void set_flow_hint(uint32 flow_hint) { flow_hint_ = flow_hint; }
+
+ protected:
+  // Inherited from P2PTransport
+  virtual cricket::TransportChannelImpl* CreateTransportChannel(int component);
+
+ private:
+  bool multipath_;
+  bool path_selection_;
+  bool prune_relay_;
+  uint32 flow_hint_;
+};
+
+// hashes the addresses, protocol and ports of the IP packet carried in an
+// ethernet frame, other frames are hashed by their MAC addresses
+uint32 FlowHash(const char* frame, size_t len);
+
+}  // namespace tincan
+
+#endif  // TINCAN_TINCANCHANNEL_H_
@@ -21,11 +21,14 @@
  * THE SOFTWARE.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
 #include "talk/base/logging.h"
 #include "talk/base/bind.h"
+#include "talk/base/byteorder.h"
+#include "talk/base/ipaddress.h"
 #include "talk/base/stringencode.h"
 #include "tincan_utils.h"
 #include "tincanconnectionmanager.h"
@@ -44,25 +47,42 @@ static const int kBufferSize = 1500;
 static const size_t kIdBytesLen = 20;
 static const uint32 kFlags = 0;
 static const uint32 kLocalControllerId = 0;
+// default lifetime of cached reflexive candidates (ms)
+static const uint32 kCandidateCacheTtl = 300000;
+// idle links are looked for at a quarter of the idle timeout but not more
+// often than this (ms)
+static const uint32 kMinIdleCheckInterval = 5000;
+// a revival without con_resp after this long (ms) is armed again for the
+// next packet
+static const uint32 kReviveTimeout = 30000;
+// links that have not switched to a new route this long (ms) after a
+// network change go back to sending directly
+static const uint32 kRestartTimeout = 10000;
+// a destination that triggered an on-demand link is not triggered again
+// for this long (ms), the con_req may still be in flight. A con_resp that
+// comes later than this no longer creates the link.
+static const uint32 kOnDemandHoldoff = 30000;
+// bounds the per destination packet counters on the packet thread
+static const size_t kMaxDemandEntries = 1024;
+// frames wait at most about this long (ms) for tokens, a link that is paced
+// further behind drops instead of adding latency
+static const uint32 kMaxPaceDelay = 200;
+// a partial FEC group gets its parity after this long (ms) so that a slow
+// flow is protected without waiting for the group to fill
+static const int kFecFlushDelay = 20;
+// how often (ms) a receiver reports the loss it measured to the sender
+static const uint32 kFecFeedbackInterval = 1000;
 
 // this is an optimization for decode 20-byte hearders, we only
 // decode 8 bytes instead of 20-bytes because hex_decode is
 // costly operation and 8 bytes is enough entropy for small
 // networks to avoid collisions (birthday problem)
 static const size_t kShortLen = 8;
-// this is a hack because we are depending on a global variable
-// to set the pointer for instance of this same class
-// sadly this is necessary for communication with ipop-tap
-// TODO - Replace this ugly hack with something smarter
+// ipop-tap is written in C and calls back through plain function pointers,
+// so the manager that owns the tap is kept here. ipop-tap has a single
+// tap and peerlist per process, so there is only one manager.
 static TinCanConnectionManager* g_manager = 0;
 
-// these blocking queues used to communicate with ipop-tap,
-// these are required to be static global variables because
-// ipop-tap is written in C and uses function pointers to access
-// this portion of the code, this can probably be done in a smarter way
-static wqueue<talk_base::Buffer*> g_recv_queue;
-static wqueue<talk_base::Buffer*> g_send_queue;
-
 // when the destination uid of a packet is set to this constant it means
 // that a P2P connection does not exist and this packet is sent to
 // a forwarder (i.e. the controller)
@@ -76,19 +96,63 @@ static const char kCandidateDelim[] = ":";
 static const char kConStat[] = "con_stat";
 static const char kConReq[] = "con_req";
 static const char kConResp[] = "con_resp";
+static const char kHibernated[] = "hibernated";
+// con_stat data on a trigger and the token after the fingerprint of an
+// on-demand con_req
+static const char kOnDemand[] = "ondemand";
+
+// offsets into a frame after the 40 byte uid header
+static const size_t kEthTypeOffset = kHeaderSize + 12;
+static const size_t kIpOffset = kHeaderSize + 14;
+static const uint16 kEthTypeIpv4 = 0x0800;
+static const uint16 kEthTypeIpv6 = 0x86dd;
+
+// takes one from the IPv4 TTL or IPv6 hop limit of a frame that is relayed
+// over a route, so that a loop between the routes of several peers ends.
+// Returns false if the frame has no hop limit or it ran out.
+static bool DecrementHopLimit(char* frame, size_t len) {
+  if (len < kIpOffset + 20) return false;
+  uint8* ip = reinterpret_cast<uint8*>(frame + kIpOffset);
+  uint16 type = talk_base::GetBE16(frame + kEthTypeOffset);
+  if (type == kEthTypeIpv4 && (ip[0] >> 4) == 4) {
+    if (ip[8] <= 1) return false;
+    ip[8]--;
+    // incremental update of the header checksum (RFC 1624), the TTL is
+    // the high byte of its 16 bit word
+    uint32 check = talk_base::GetBE16(ip + 10) + 0x0100;
+    check += check >= 0xffff;
+    talk_base::SetBE16(ip + 10, static_cast<uint16>(check));
+    return true;
+  }
+  if (type == kEthTypeIpv6 && len >= kIpOffset + 40 && (ip[0] >> 4) == 6) {
+    if (ip[7] <= 1) return false;
+    ip[7]--;
+    return true;
+  }
+  return false;
+}
 
 // enumeration used by OnMessage function
 enum {
   MSG_QUEUESIGNAL = 0,
+  MSG_IDLECHECK = 1,
+  MSG_REVIVE = 2,
+  MSG_NETWORKCHANGE = 3,
+  MSG_RESTARTTIMEOUT = 4,
+  MSG_ONDEMAND = 5,
+  MSG_PACE = 6,
+  MSG_FECFLUSH = 7,
+  MSG_LINKPHASE = 8,
 };
 
 TinCanConnectionManager::TinCanConnectionManager(
     PeerSignalSenderInterface* signal_sender,
     talk_base::Thread* link_setup_thread,
     talk_base::Thread* packet_handling_thread,
-    thread_opts_t* opts)
+    thread_opts_t* opts, const std::string& tap_name)
     : content_name_(kContentName),
       signal_sender_(signal_sender),
+      peer_directory_(NULL),
       packet_factory_(packet_handling_thread),
       uid_map_(),
       short_uid_map_(),
@@ -98,17 +162,62 @@ TinCanConnectionManager::TinCanConnectionManager(
       network_manager_(),
       tincan_id_(),
       identity_(),
+      identity_file_(),
+      key_type_(KEY_RSA),
+      setup_time_(0),
+      first_link_online_(false),
       local_fingerprint_(),
       fingerprint_(kFprNull),
       tiebreaker_(talk_base::CreateRandomId64()),
       tincan_ip4_(kIpv4),
       tincan_ip6_(kIpv6),
-      tap_name_(kTapName),
+      tap_name_(tap_name),
       packet_options_(talk_base::DSCP_DEFAULT),
       trim_enabled_(false),
+      shared_socket_enabled_(false),
+      shared_socket_pool_(new SharedSocketPool(&packet_factory_)),
+      candidate_cache_(kCandidateCacheTtl),
+      trickle_enabled_(false),
+      candidate_format_(CANDIDATE_FORMAT_TEXT),
+      codec_stats_(),
+      idle_timeout_(0),
+      idle_check_scheduled_(false),
+      hibernations_(0),
+      revivals_(0),
+      restarts_(0),
+      recoveries_(0),
+      recover_time_sum_(0),
+      recover_time_max_(0),
+      multipath_enabled_(false),
+      path_selection_enabled_(false),
+      on_demand_(),
+      on_demand_threshold_w_(0),
+      on_demand_window_w_(0),
+      on_demand_started_(0),
+      on_demand_links_(0),
+      on_demand_online_(0),
+      on_demand_time_sum_(0),
+      on_demand_time_max_(0),
+      forwarding_enabled_(false),
+      accept_relayed_enabled_(false),
+      forwarding_w_(false),
+      accept_relayed_w_(false),
+      neighbor_proxy_enabled_(false),
+      neighbor_proxy_w_(false),
+      neighbor_cache_(),
+      replication_enabled_(false),
+      replication_w_(false),
+      group_table_(),
+      classifier_w_(),
+      shaping_w_(false),
+      pace_scheduled_w_(false),
+      fec_all_w_(false),
+      fec_flush_scheduled_w_(false),
       opts_(opts) {
   // we have to set the global point for ipop-tap communication
   g_manager = this;
+  acl_drops_w_[PacketClassifier::IN] = 0;
+  acl_drops_w_[PacketClassifier::OUT] = 0;
 
   // we set event handler for network change in order to disable
   // ipop VNIC from list of devices uses by libjingle
@@ -116,6 +225,10 @@ TinCanConnectionManager::TinCanConnectionManager(
       this, &TinCanConnectionManager::OnNetworksChanged);
 }
 
+TinCanConnectionManager::~TinCanConnectionManager() {
+  if (g_manager == this) g_manager = 0;
+}
+
 void TinCanConnectionManager::Setup(
     const std::string& uid, const std::string& ip4, int ip4_mask,
     const std::string& ip6, int ip6_mask, int subnet_mask, int switchmode) {
@@ -125,9 +238,19 @@ void TinCanConnectionManager::Setup(
 
   // tincan id is uid
   tincan_id_ = uid;
+  setup_time_ = talk_base::Time();
 
-  // we create X509 identity for secure connections
-  identity_.reset(talk_base::SSLIdentity::Generate(tincan_id_));
+  // we create X509 identity for secure connections, when an identity file
+  // is configured the identity is reused across restarts
+  if (identity_file_.empty()) {
+    identity_.reset(GenerateIdentity(tincan_id_, key_type_));
+  }
+  else {
+    identity_.reset(LoadOrCreateIdentity(identity_file_, tincan_id_,
+                                         key_type_));
+  }
+  LOG_TS(INFO) << "IDENTITY ready in "
+               << talk_base::TimeSince(setup_time_) << " ms";
   local_fingerprint_.reset(talk_base::SSLFingerprint::Create(
       talk_base::DIGEST_SHA_1, identity_.get()));
 
@@ -156,24 +279,136 @@ void TinCanConnectionManager::Setup(
   tincan_ip6_ = ip6;
 }
 
+void TinCanConnectionManager::set_shared_socket(bool shared_socket,
+                                                int port) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  shared_socket_enabled_ = shared_socket;
+  // cached reflexive candidates belong to the old shared sockets
+  candidate_cache_.Clear();
+  // the pool is only touched on the packet handling thread
+  packet_handling_thread_->Invoke<void>(
+      Bind(&SharedSocketPool::set_port, shared_socket_pool_.get(), port));
+  LOG_TS(INFO) << "shared_socket:" << shared_socket << " port:" << port;
+}
+
+void TinCanConnectionManager::set_candidate_cache_ttl(int ttl) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  candidate_cache_.set_ttl(ttl * 1000);
+  if (ttl == 0) candidate_cache_.Clear();
+}
+
 void TinCanConnectionManager::OnNetworksChanged() {
   ASSERT(packet_handling_thread_->IsCurrent());
   talk_base::NetworkManager::NetworkList networks;
   talk_base::SocketAddress ip6_addr(tincan_ip6_, 0);
+  std::set<std::string> underlay_ips;
   network_manager_.GetNetworks(&networks);
 
   // We loop through each network interface and we disable ipop tap
   // interface because we don't want libjingle to try to connect
   // over ipop network that can create weird conditions and break things
   for (size_t i = 0; i < networks.size(); ++i) {
-	  if (networks[i]->name().compare(kTapName) == 0 ||
+	  if (networks[i]->name().compare(tap_name_) == 0 ||
 		  networks[i]->description().compare(0, 3, kTapDesc) == 0) {
 		  networks[i]->ClearIPs();
       // Set to a random ipv6 address in order to disable
       networks[i]->AddIP(ip6_addr.ipaddr());
 	  LOG_TS(INFO) << "IPOP TAP Device to be ignored " << networks[i]->name() << ":" << networks[i]->description();
     }
+    else {
+      const std::vector<talk_base::IPAddress>& ips = networks[i]->GetIPs();
+      for (size_t j = 0; j < ips.size(); j++) {
+        underlay_ips.insert(networks[i]->name() + " " + ips[j].ToString());
+      }
+    }
+  }
+
+  // the first enumeration only records the underlay addresses, after that
+  // the links that were using an address that is gone gather again
+  if (underlay_ips == underlay_ips_) return;
+  bool first = underlay_ips_.empty();
+  std::set<std::string> removed;
+  for (std::set<std::string>::const_iterator it = underlay_ips_.begin();
+       it != underlay_ips_.end(); ++it) {
+    if (underlay_ips.find(*it) == underlay_ips.end()) {
+      removed.insert(it->substr(it->find(' ') + 1));
+    }
+  }
+  underlay_ips_.swap(underlay_ips);
+  if (first) return;
+  LOG_TS(INFO) << "UNDERLAY CHANGED " << underlay_ips_.size()
+               << " addresses " << removed.size() << " removed";
+  link_setup_thread_->Post(this, MSG_NETWORKCHANGE,
+      new talk_base::TypedMessageData<std::set<std::string> >(removed));
+}
+
+void TinCanConnectionManager::HandleNetworkChange(
+    const std::set<std::string>& removed) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // reflexive addresses learned on the old underlay are stale
+  candidate_cache_.Clear();
+  if (removed.empty()) return;
+  std::vector<std::string> restarted;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::RestartChannels_w, this, &removed,
+         &restarted));
+  for (size_t i = 0; i < restarted.size(); i++) {
+    PeerState* peer_state = uid_map_[restarted[i]].get();
+    if (peer_state->restart_time == 0) restarts_++;
+    peer_state->restart_time = talk_base::Time();
+    LOG_TS(INFO) << "RESTARTING " << restarted[i];
+  }
+  if (!restarted.empty()) {
+    link_setup_thread_->PostDelayed(kRestartTimeout, this,
+                                    MSG_RESTARTTIMEOUT);
+  }
+}
+
+void TinCanConnectionManager::EndRestart(PeerState* peer_state,
+                                         bool recovered) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (recovered) {
+    uint32 elapsed = talk_base::TimeSince(peer_state->restart_time);
+    recoveries_++;
+    recover_time_sum_ += elapsed;
+    recover_time_max_ = std::max(recover_time_max_, elapsed);
+    LOG_TS(INFO) << "RECOVERED " << peer_state->uid << " in " << elapsed
+                 << " ms";
+  }
+  peer_state->restart_time = 0;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::DeleteRestarting_w, this,
+         peer_state->uid.substr(0, kShortLen * 2)));
+}
+
+void TinCanConnectionManager::CheckRestarts() {
+  ASSERT(link_setup_thread_->IsCurrent());
+  for (std::map<std::string, PeerStatePtr>::iterator it = uid_map_.begin();
+       it != uid_map_.end(); ++it) {
+    PeerState* peer_state = it->second.get();
+    // the old route may have survived the change, then nothing switches
+    if (peer_state->restart_time != 0 &&
+        talk_base::TimeSince(peer_state->restart_time) >=
+        static_cast<int32>(kRestartTimeout)) {
+      EndRestart(peer_state, false);
+    }
+  }
+}
+
+Json::Value TinCanConnectionManager::GetRestartStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  stats["restarts"] = restarts_;
+  stats["recovered"] = recoveries_;
+  stats["recover_ms_avg"] = recoveries_ ? recover_time_sum_ / recoveries_ : 0;
+  stats["recover_ms_max"] = recover_time_max_;
+  if (reset) {
+    restarts_ = 0;
+    recoveries_ = 0;
+    recover_time_sum_ = 0;
+    recover_time_max_ = 0;
   }
+  return stats;
 }
 
 void TinCanConnectionManager::OnRequestSignaling(
@@ -199,15 +434,20 @@ void TinCanConnectionManager::HandleConnectionSignal(
 void TinCanConnectionManager::OnRWChangeState(
     cricket::Transport* transport) {
   ASSERT(link_setup_thread_->IsCurrent());
+  // signals of transports that were already removed are ignored
+  if (transport_map_.find(transport) == transport_map_.end()) return;
   std::string uid = transport_map_[transport];
   std::string status = "unknown";
   if (transport->readable() && transport->writable()) {
     status = "online";
     LOG_TS(INFO) << "ONLINE " << uid << " " << talk_base::Time();
+    RecordOnline(uid_map_[uid].get());
+    SetLinkState(uid, LINK_ONLINE);
   }
   else if (transport->was_writable()) {
     status = "offline";
     LOG_TS(INFO) << "OFFLINE " << uid << " " << talk_base::Time();
+    SetLinkState(uid, LINK_OFFLINE);
   }
   // callback message sent to local controller for connection status
   signal_sender_->SendToPeer(kLocalControllerId, uid, status, kConStat);
@@ -225,64 +465,253 @@ void TinCanConnectionManager::OnRWChangeState(
   }
 }
 
+void TinCanConnectionManager::RecordOnline(PeerState* peer_state) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // a transport is only writable once DTLS is done, so for secure links
+  // both phases complete together
+  LinkTimes& times = peer_state->times;
+  if (times.has(PHASE_ONLINE)) return;
+  times.Mark(PHASE_ONLINE);
+  // the DTLS channel reports the handshake right behind the transport, a
+  // secure link is recorded once both are in, see RecordPhase
+  if (peer_state->connection_security != "dtls" ||
+      times.has(PHASE_DTLS_DONE)) {
+    link_stats_.Record(times);
+  }
+  if (peer_state->on_demand_time != 0) {
+    uint32 elapsed = talk_base::TimeSince(peer_state->on_demand_time);
+    on_demand_online_++;
+    on_demand_time_sum_ += elapsed;
+    on_demand_time_max_ = std::max(on_demand_time_max_, elapsed);
+    peer_state->on_demand_time = 0;
+  }
+  if (!first_link_online_) {
+    first_link_online_ = true;
+    LOG_TS(INFO) << "FIRST LINK online "
+                 << talk_base::TimeSince(setup_time_) << " ms after setup";
+  }
+}
+
+void TinCanConnectionManager::OnChannelWritable_w(
+    cricket::TransportChannel* channel)
+{
+  ASSERT(packet_handling_thread_->IsCurrent());
+  if (!channel->writable()) return;
+  link_setup_thread_->Post(this, MSG_LINKPHASE,
+      new talk_base::TypedMessageData<
+          std::pair<cricket::TransportChannel*, uint32> >(
+              std::make_pair(channel, talk_base::Time())));
+}
+
+void TinCanConnectionManager::RecordPhase(cricket::TransportChannel* channel,
+                                          uint32 time) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  std::map<cricket::TransportChannel*,
+           std::pair<std::string, LinkPhase> >::iterator it =
+      phase_channels_.find(channel);
+  if (it == phase_channels_.end() ||
+      uid_map_.find(it->second.first) == uid_map_.end()) return;
+  LinkTimes& times = uid_map_[it->second.first]->times;
+  LinkPhase phase = it->second.second;
+  if (times.has(phase)) return;
+  times.Mark(phase, time);
+  if (phase == PHASE_DTLS_DONE && times.has(PHASE_ONLINE)) {
+    link_stats_.Record(times);
+  }
+}
+
+void TinCanConnectionManager::OnRouteChange(
+    cricket::Transport* transport, int component,
+    const cricket::Candidate& remote_candidate) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (transport_map_.find(transport) == transport_map_.end()) return;
+  // the first route is selected after the first successful STUN check
+  PeerState* peer_state = uid_map_[transport_map_[transport]].get();
+  peer_state->times.Mark(PHASE_STUN_SUCCESS);
+  // after a network change the switch to a new route ends the restart
+  if (peer_state->restart_time != 0) EndRestart(peer_state, true);
+}
+
+Json::Value TinCanConnectionManager::GetLinkStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats = link_stats_.ToJson();
+  if (reset) link_stats_.Clear();
+  return stats;
+}
+
+void TinCanConnectionManager::set_candidate_format(const std::string& format) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  candidate_format_ = CandidateFormatFromString(format);
+  LOG_TS(INFO) << "candidate_format:" << format;
+}
+
+Json::Value TinCanConnectionManager::GetCodecStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  stats["text_messages"] = codec_stats_.text_messages;
+  stats["text_candidates"] = codec_stats_.text_candidates;
+  stats["text_bytes"] = static_cast<double>(codec_stats_.text_bytes);
+  stats["binary_messages"] = codec_stats_.binary_messages;
+  stats["binary_candidates"] = codec_stats_.binary_candidates;
+  stats["binary_bytes"] = static_cast<double>(codec_stats_.binary_bytes);
+  stats["parsed"] = codec_stats_.parsed;
+  stats["parse_us"] = static_cast<double>(codec_stats_.parse_ns) / 1000;
+  if (reset) codec_stats_ = CodecStats();
+  return stats;
+}
+
+Json::Value TinCanConnectionManager::GetCandidateCacheStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  stats["hits"] = candidate_cache_.hits();
+  stats["misses"] = candidate_cache_.misses();
+  if (reset) candidate_cache_.ResetCounters();
+  return stats;
+}
+
+// here we built a colon delimited set of parameters required by
+// libjingle/ICE protocol to create P2P connections
+static std::string CandidateToString(const cricket::Candidate& candidate) {
+  size_t idx = candidate.network_name().find(' ');
+  std::string interface = candidate.network_name().substr(0, idx);
+  std::string ip_string =
+      talk_base::SocketAddress::IPToString(candidate.address().ip());
+  std::ostringstream oss;
+  oss << candidate.id() << kCandidateDelim << candidate.component()
+      << kCandidateDelim << candidate.protocol()
+      << kCandidateDelim << ip_string
+      << kCandidateDelim << candidate.address().port() 
+      << kCandidateDelim << candidate.priority() 
+      << kCandidateDelim << candidate.username() 
+      << kCandidateDelim << candidate.password() 
+      << kCandidateDelim << candidate.type() 
+      << kCandidateDelim << interface
+      << kCandidateDelim << candidate.generation() 
+      << kCandidateDelim << candidate.foundation(); 
+  return oss.str();
+}
+
 void TinCanConnectionManager::OnCandidatesReady(
     cricket::Transport* transport, const cricket::Candidates& candidates) {
   ASSERT(link_setup_thread_->IsCurrent());
+  if (transport_map_.find(transport) == transport_map_.end()) return;
   std::string uid = transport_map_[transport];
-  std::set<std::string>& candidate_list = uid_map_[uid]->candidate_list;
+  PeerStatePtr peer_state = uid_map_[uid];
+  std::map<std::string, cricket::Candidate>& candidate_list =
+      peer_state->candidate_list;
+  peer_state->times.Mark(PHASE_FIRST_CANDIDATE);
   for (size_t i = 0; i < candidates.size(); i++) {
-    if (candidates[i].network_name().compare(kTapName) == 0) continue;
-    size_t idx = candidates[i].network_name().find(' ');
-    std::string interface = candidates[i].network_name().substr(0, idx);
-    std::string ip_string =
-        talk_base::SocketAddress::IPToString(candidates[i].address().ip());
-
-    // here we built a colon delimited set of parameters required by
-    // libjingle/ICE protocol to create P2P connections
-    std::ostringstream oss;
-    oss << candidates[i].id() << kCandidateDelim << candidates[i].component()
-        << kCandidateDelim << candidates[i].protocol()
-        << kCandidateDelim << ip_string
-        << kCandidateDelim << candidates[i].address().port() 
-        << kCandidateDelim << candidates[i].priority() 
-        << kCandidateDelim << candidates[i].username() 
-        << kCandidateDelim << candidates[i].password() 
-        << kCandidateDelim << candidates[i].type() 
-        << kCandidateDelim << interface
-        << kCandidateDelim << candidates[i].generation() 
-        << kCandidateDelim << candidates[i].foundation(); 
-    candidate_list.insert(oss.str());
+    if (candidates[i].network_name().compare(tap_name_) == 0) continue;
+    candidate_list[CandidateToString(candidates[i])] = candidates[i];
+
+    // reflexive candidates are only the same for other peers when they
+    // were gathered on a shared socket
+    if (peer_state->socket_factory.get()) {
+      candidate_cache_.Add(peer_state->stun_server, candidates[i]);
+    }
+  }
+
+  // with trickling each batch goes out as soon as it is gathered, so host
+  // candidates do not wait for the slowest STUN/TURN server. Candidates
+  // gathered after the first con_resp (e.g. after a network change) are
+  // always sent right away.
+  if (trickle_enabled_ || peer_state->con_resp_sent) {
+    SendCandidates(peer_state.get(), false);
   }
 }
 
-void TinCanConnectionManager::OnCandidatesAllocationDone(
-    cricket::Transport* transport) {
+void TinCanConnectionManager::SendCandidates(PeerState* peer_state,
+                                             bool allocation_done) {
   ASSERT(link_setup_thread_->IsCurrent());
-  std::string uid = transport_map_[transport];
-  std::set<std::string>& candidates = uid_map_[uid]->candidate_list;
-  int overlay_id = uid_map_[uid]->overlay_id;
   std::string data(fingerprint());
+  std::map<std::string, cricket::Candidate>& candidates =
+      peer_state->candidate_list;
+  std::set<std::string>& sent = peer_state->sent_candidates;
 
   // we create a space delimited list of candidate information and
   // then send that information over XMPP to other peer to create
-  // P2P connections
-  for (std::set<std::string>::const_iterator it = candidates.begin();
-       it != candidates.end(); ++it) {
+  // P2P connections, candidates that were already trickled are skipped
+  std::string text;
+  cricket::Candidates unsent;
+  for (std::map<std::string, cricket::Candidate>::const_iterator it =
+       candidates.begin(); it != candidates.end(); ++it) {
+    if (sent.find(it->first) != sent.end()) continue;
+    text += " ";
+    text += it->first;
+    unsent.push_back(it->second);
+    sent.insert(it->first);
+  }
+  int count = unsent.size();
+
+  // the binary batches replace the text list for peers that understand it
+  std::string tokens;
+  if (count > 0 && (candidate_format_ == CANDIDATE_FORMAT_BINARY ||
+      (candidate_format_ == CANDIDATE_FORMAT_AUTO &&
+       peer_state->binary_candidates)) && EncodeCandidates(unsent, &tokens)) {
     data += " ";
-    data += *it;
+    data += tokens;
+    codec_stats_.binary_messages++;
+    codec_stats_.binary_candidates += count;
+    codec_stats_.binary_bytes += tokens.size() + 1;
   }
-  if (transport_map_.find(transport) != transport_map_.end()) {
-    // for now overlay_id is typically 1 meaning send over XMPP if it
-    // is 0 that means send through the controller
-    signal_sender_->SendToPeer(overlay_id, transport_map_[transport],
-                               data, kConResp);
+  else {
+    data += text;
+    if (count > 0) codec_stats_.text_messages++;
+    codec_stats_.text_candidates += count;
+    codec_stats_.text_bytes += text.size();
+    // tells a peer in auto mode that it can answer in binary
+    if (candidate_format_ == CANDIDATE_FORMAT_AUTO) {
+      data += " ";
+      data += kBinaryCapability;
+    }
   }
+  // we always decode FEC, the peer only protects its frames once it knows
+  data += " ";
+  data += kFecCapability;
+
+  // the final message is always sent when nothing went out before so that
+  // the peer at least learns our fingerprint
+  if (count == 0 && !(allocation_done && !peer_state->con_resp_sent)) return;
+  peer_state->con_resp_sent = true;
+  peer_state->times.Mark(PHASE_CON_RESP_SENT);
+
+  // for now overlay_id is typically 1 meaning send over XMPP if it
+  // is 0 that means send through the controller
+  signal_sender_->SendToPeer(peer_state->overlay_id, peer_state->uid,
+                             data, kConResp);
+}
+
+void TinCanConnectionManager::OnCandidatesAllocationDone(
+    cricket::Transport* transport) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (transport_map_.find(transport) == transport_map_.end()) return;
+  std::string uid = transport_map_[transport];
+  uid_map_[uid]->times.Mark(PHASE_ALLOCATION_DONE);
+  SendCandidates(uid_map_[uid].get(), true);
 }
 
 void TinCanConnectionManager::OnReadPacket(cricket::TransportChannel* channel, 
     const char* data, size_t len, const talk_base::PacketTime& ptime,
     int flags) {
   ASSERT(packet_handling_thread_->IsCurrent());
+  // a plain frame starts with the uid of the link peer, everything else
+  // that looks like a shim is FEC
+  if (IsFecPacket(data, len)) {
+    int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+    std::map<std::string, cricket::Transport*>::iterator it =
+        short_uid_map_.find(talk_base::hex_encode(data, kShortLen));
+    if (len < kHeaderSize || it == short_uid_map_.end() ||
+        it->second->GetChannel(component) != channel) {
+      HandleFec_w(channel, data, len);
+      return;
+    }
+  }
+  ReadFrame_w(channel, data, len);
+}
+
+void TinCanConnectionManager::ReadFrame_w(cricket::TransportChannel* channel,
+                                          const char* data, size_t len)
+{
   if (len < kHeaderSize) return;
 
   // we are processing incoming code from the P2P network, first we convert
@@ -294,11 +723,45 @@ void TinCanConnectionManager::OnReadPacket(cricket::TransportChannel* channel,
   // for lookup tables because many lookup tables depend on string as key.
   std::string source = talk_base::hex_encode(data, kShortLen);
   std::string dest = talk_base::hex_encode(data + kIdBytesLen, kShortLen);
+
+  // denied frames are dropped before they are queued for the tap
+  if (classifier_w_.get() != NULL &&
+      classifier_w_->Classify(data, len, source, PacketClassifier::IN) ==
+      PacketClassifier::DENY) {
+    acl_drops_w_[PacketClassifier::IN]++;
+    return;
+  }
+
+  // frames for other peers are relayed without leaving the packet thread
+  if (forwarding_w_ && dest != local_short_w_ &&
+      dest.compare(0, 3, kNullPeerId) != 0) {
+    if (RelayFrame_w(dest, channel, data, len)) {
+      route_stats_w_.relayed++;
+      route_stats_w_.relayed_bytes += len;
+    }
+    else {
+      route_stats_w_.dropped++;
+    }
+    return;
+  }
+
   int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
   if (short_uid_map_.find(source) != short_uid_map_.end() && 
       short_uid_map_[source]->GetChannel(component) == channel) {
     // add to receive for processing by ipop-tap
-    g_recv_queue.add(new talk_base::Buffer(data, len));
+    if (neighbor_proxy_w_) neighbor_cache_.Learn(data, len);
+    if (replication_w_) group_table_.Snoop(data, len, source);
+    recv_queue_.add(new talk_base::Buffer(data, len));
+  }
+  else if (accept_relayed_w_ && dest == local_short_w_) {
+    // relayed frame, the source is not the peer of this link
+    if (!FromNextHop_w(source, channel)) {
+      route_stats_w_.rejected++;
+      return;
+    }
+    route_stats_w_.delivered++;
+    if (neighbor_proxy_w_) neighbor_cache_.Learn(data, len);
+    recv_queue_.add(new talk_base::Buffer(data, len));
   }
 }
 
@@ -310,10 +773,66 @@ const char* data, size_t len, const talk_base::SocketAddress& addr)
       std::string source = talk_base::hex_encode(data, kShortLen);
       std::string dest = talk_base::hex_encode(data + kIdBytesLen, kShortLen);
 
+      // denied frames are dropped before they are encrypted or forwarded
+      if (classifier_w_.get() != NULL &&
+          classifier_w_->Classify(data, len, dest, PacketClassifier::OUT) ==
+          PacketClassifier::DENY) {
+        acl_drops_w_[PacketClassifier::OUT]++;
+        return;
+      }
+
       // forward packet to controller if we do not have a P2P connection for it
       if (dest.compare(0, 3, kNullPeerId) == 0 ||
           short_uid_map_.find(dest) == short_uid_map_.end()) 
           {
+                // address resolution for known peers is answered here or
+                // sent to the owner only, the rest is flooded as before
+                if (neighbor_proxy_w_ && dest.compare(0, 3, kNullPeerId) == 0) {
+                  std::string out;
+                  NeighborCache::Action action =
+                      neighbor_cache_.Resolve(data, len, &out);
+                  if (action == NeighborCache::REPLY) {
+                    recv_queue_.add(
+                        new talk_base::Buffer(out.data(), out.size()));
+                    return;
+                  }
+                  if (action == NeighborCache::DROP) return;
+                  if (action == NeighborCache::UNICAST) {
+                    std::string frame(data, len);
+                    frame.replace(kIdBytesLen, kIdBytesLen, out);
+                    if (SendRouted_w(talk_base::hex_encode(out.data(),
+                                                           kShortLen),
+                                     NULL, frame.data(), len)) return;
+                  }
+                }
+
+                // one pass over the links replaces a controller round
+                // trip per peer
+                if (replication_w_ && len > kHeaderSize &&
+                    dest.compare(0, 3, kNullPeerId) == 0 &&
+                    (data[kHeaderSize] & 0x01)) {
+                  // peers without a writable direct link still get the
+                  // frame through the controller, ARP included
+                  if (Replicate_w(data, len)) return;
+                  replication_stats_w_.forwarded++;
+                }
+
+                // a route to the destination avoids the controller hop
+                if (!route_map_w_.empty() &&
+                    SendRouted_w(dest, NULL, data, len)) {
+                  route_stats_w_.routed++;
+                  return;
+                }
+
+                // traffic to a hibernated peer wakes the link up, until it
+                // is online the packets go through the controller
+                bool woken = !hibernated_short_map_.empty() && WakePeer_w(dest);
+                // busy destinations without a link get one from tincan
+                if (!woken && on_demand_threshold_w_ > 0 &&
+                    dest.compare(0, 3, kNullPeerId) != 0) {
+                  CountDemand_w(dest, data + kIdBytesLen);
+                }
+
                 // forward_addr_ is the address of the forwarder/controller
                 talk_base::scoped_ptr<char[]> msg(new char[len + kTincanHeaderSize]);
 
@@ -349,15 +868,28 @@ const char* data, size_t len, const talk_base::SocketAddress& addr)
      // To improve performance of on-demand links, if the transport is not yet 
     // writable or channels are not yet created we continue forwarding the
     // packets to the controller so that they can be forwarded over ICC.
-      else if (short_uid_map_[dest]->writable()) 
+      // while a link restarts the old route may already be gone, so its
+      // packets take the controller path like those of a new link
+      else if (short_uid_map_[dest]->writable() &&
+               (restarting_short_set_.empty() ||
+                restarting_short_set_.find(dest) ==
+                restarting_short_set_.end()))
       {
         int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
         cricket::TransportChannelImpl* channel = 
             short_uid_map_[dest]->GetChannel(component);
         if (channel != NULL) 
         {
-          // Send packet over Tincan P2P connection
-          int count = channel->SendPacket(data, len, packet_options_, 0);
+          // the DTLS channel hides the packet from the path selection so
+          // its flow is hashed here
+          TinCanP2PTransport* transport =
+              static_cast<TinCanP2PTransport*>(short_uid_map_[dest]);
+          if (transport->multipath()) {
+            transport->set_flow_hint(
+                FlowHash(data + kHeaderSize, len - kHeaderSize));
+          }
+          // Send packet over Tincan P2P connection, paced when limited
+          SendShaped_w(dest, channel, data, len);
         }
         else // if no channel to remote peer yet created
         {   
@@ -417,12 +949,13 @@ void TinCanConnectionManager::SetupTransport(PeerState* peer_state) {
     conn_role_local = cricket::CONNECTIONROLE_ACTIVE;
   }
   peer_state->local_description.reset(new cricket::TransportDescription(
-      cricket::NS_JINGLE_ICE_UDP, std::vector<std::string>(), kIceUfrag,
-      kIcePwd, cricket::ICEMODE_FULL, conn_role_local,
+      cricket::NS_JINGLE_ICE_UDP, std::vector<std::string>(),
+      peer_state->local_ufrag, kIcePwd, cricket::ICEMODE_FULL, conn_role_local,
       local_fingerprint_.get(), peer_state->candidates));
   peer_state->remote_description.reset(new cricket::TransportDescription(
-      cricket::NS_JINGLE_ICE_UDP, std::vector<std::string>(), kIceUfrag, 
-      kIcePwd, cricket::ICEMODE_FULL, cricket::CONNECTIONROLE_NONE,
+      cricket::NS_JINGLE_ICE_UDP, std::vector<std::string>(),
+      peer_state->remote_ufrag, kIcePwd, cricket::ICEMODE_FULL,
+      cricket::CONNECTIONROLE_NONE,
       peer_state->remote_fingerprint.get(), peer_state->candidates));
 
   if (peer_state->uid.compare(tincan_id_) < 0) {
@@ -451,17 +984,66 @@ bool TinCanConnectionManager::CreateTransport(
     return false;
   }
 
+  // the controller recreating the link replaces any hibernated state
+  DropHibernated(uid);
+
   LOG_TS(INFO) << "peer_uid:" << uid << " time:" << talk_base::Time();
   talk_base::SocketAddress stun_addr;
   stun_addr.FromString(stun_server);
   PeerStatePtr peer_state(new talk_base::RefCountedObject<PeerState>);
+  peer_state->times.Mark(PHASE_CREATE_LINK);
   peer_state->uid = uid;
   peer_state->fingerprint = fingerprint;
   peer_state->overlay_id = overlay_id;
   peer_state->last_time = talk_base::Time();
+  peer_state->con_resp_sent = false;
+  peer_state->stun_server = stun_server;
+  peer_state->turn_server = turn_server;
+  peer_state->turn_user = turn_user;
+  peer_state->turn_pass = turn_pass;
+  peer_state->binary_candidates = false;
+  peer_state->fec_capable = false;
+  peer_state->idle_bytes = 0;
+  peer_state->idle_since = talk_base::Time();
+  peer_state->restart_time = 0;
+  peer_state->on_demand_time = 0;
+  peer_state->local_ufrag = kIceUfrag;
+  peer_state->remote_ufrag = kIceUfrag;
+
+  // in shared socket mode all peers use one UDP socket per interface and
+  // the packets are demultiplexed by ICE ufrag, so each link gets a unique
+  // ufrag which both sides derive from the pair of uids. TURN allocations
+  // are bound to their 5-tuple, links using TURN keep their own sockets.
+  talk_base::PacketSocketFactory* socket_factory = &packet_factory_;
+  uint32 flags = kFlags;
+  if (shared_socket_enabled_ && turn_server.empty()) {
+    peer_state->local_ufrag = tincan_id_.substr(0, kShortLen * 2) +
+                              uid.substr(0, kShortLen * 2);
+    peer_state->remote_ufrag = uid.substr(0, kShortLen * 2) +
+                               tincan_id_.substr(0, kShortLen * 2);
+    peer_state->socket_factory.reset(new MuxedPacketSocketFactory(
+        shared_socket_pool_.get(), &packet_factory_,
+        peer_state->local_ufrag));
+    socket_factory = peer_state->socket_factory.get();
+    flags |= cricket::PORTALLOCATOR_ENABLE_SHARED_SOCKET |
+             cricket::PORTALLOCATOR_DISABLE_TCP;
+
+    // with a fresh cached reflexive address we skip the STUN round trip,
+    // the cached candidates are signaled together with the host ones
+    cricket::Candidates cached;
+    if (candidate_cache_.Lookup(stun_server, &cached)) {
+      flags |= cricket::PORTALLOCATOR_DISABLE_STUN;
+      for (size_t i = 0; i < cached.size(); i++) {
+        cached[i].set_username(peer_state->local_ufrag);
+        cached[i].set_password(kIcePwd);
+        peer_state->candidate_list[CandidateToString(cached[i])] = cached[i];
+      }
+      LOG_TS(INFO) << "CACHED " << cached.size() << " candidates for " << uid;
+    }
+  }
   peer_state->port_allocator.reset(new cricket::BasicPortAllocator(
-      &network_manager_, &packet_factory_, stun_addr));
-  peer_state->port_allocator->set_flags(kFlags);
+      &network_manager_, socket_factory, stun_addr));
+  peer_state->port_allocator->set_flags(flags);
   SetRelay(peer_state.get(), turn_server, turn_user, turn_pass);
 
   int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
@@ -481,7 +1063,7 @@ bool TinCanConnectionManager::CreateTransport(
     peer_state->connection_security = "dtls";
   }
   else {
-    peer_state->transport.reset(new cricket::P2PTransport(
+    peer_state->transport.reset(new TinCanP2PTransport(
         link_setup_thread_, packet_handling_thread_, content_name_, 
         peer_state->port_allocator.get()));
     channel = peer_state->transport->CreateChannel(component);
@@ -490,6 +1072,9 @@ bool TinCanConnectionManager::CreateTransport(
     peer_state->connection_security = "none";
   }
 
+  peer_state->transport->set_multipath(multipath_enabled_);
+  peer_state->transport->set_path_selection(path_selection_enabled_);
+  peer_state->transport->set_prune_relay(trim_enabled_);
   channel->SignalReadPacket.connect(
       this, &TinCanConnectionManager::OnReadPacket);
   peer_state->transport->SignalRequestSignaling.connect(
@@ -502,12 +1087,25 @@ bool TinCanConnectionManager::CreateTransport(
       this, &TinCanConnectionManager::OnRWChangeState);
   peer_state->transport->SignalWritableState.connect(
       this, &TinCanConnectionManager::OnRWChangeState);
+  peer_state->transport->SignalRouteChange.connect(
+      this, &TinCanConnectionManager::OnRouteChange);
+  // the channels signal on the packet handling thread
+  peer_state->channel->SignalWritableState.connect(
+      this, &TinCanConnectionManager::OnChannelWritable_w);
+  phase_channels_[peer_state->channel] =
+      std::make_pair(uid, PHASE_ICE_WRITABLE);
+  if (channel != peer_state->channel) {
+    channel->SignalWritableState.connect(
+        this, &TinCanConnectionManager::OnChannelWritable_w);
+    phase_channels_[channel] = std::make_pair(uid, PHASE_DTLS_DONE);
+  }
 
   SetupTransport(peer_state.get());
   peer_state->transport->ConnectChannels();
 
   uid_map_[uid] = peer_state;
   transport_map_[peer_state->transport.get()] = uid;
+  SetLinkState(uid, LINK_CONNECTING);
   // TODO: This is speed hack
   packet_handling_thread_->Invoke<void>(
     Bind(&TinCanConnectionManager::InsertTransportMap_w, this,
@@ -538,6 +1136,27 @@ bool TinCanConnectionManager::AddIPMapping(
 
   // we also store the assigned ip addresses to table for reuse
   ip_map_[uid] = ips;
+
+  // the neighbor cache learns which peer owns the addresses, the MAC
+  // address is only known once the peer sends traffic
+  if (ip4 != "127.0.0.1") {
+    talk_base::IPAddress addr4, addr6;
+    std::string uid_bytes(uid_str, kIdBytesLen);
+    if (talk_base::IPFromString(ip4, &addr4) && addr4.family() == AF_INET) {
+      in_addr in4 = addr4.ipv4_address();
+      packet_handling_thread_->Invoke<void>(
+        Bind(&TinCanConnectionManager::AddNeighbor_w, this,
+             std::string(reinterpret_cast<const char*>(&in4), 4),
+             uid_bytes));
+    }
+    if (talk_base::IPFromString(ip6, &addr6) && addr6.family() == AF_INET6) {
+      in6_addr in6 = addr6.ipv6_address();
+      packet_handling_thread_->Invoke<void>(
+        Bind(&TinCanConnectionManager::AddNeighbor_w, this,
+             std::string(reinterpret_cast<const char*>(&in6), 16),
+             uid_bytes));
+    }
+  }
   return true;
 }
 
@@ -545,35 +1164,89 @@ bool TinCanConnectionManager::CreateConnections(
     const std::string& uid, const std::string& candidates_string) {
   ASSERT(link_setup_thread_->IsCurrent());
   if (uid_map_.find(uid) == uid_map_.end()) return false;
-  cricket::Candidates& candidates = uid_map_[uid]->candidates;
-  if (candidates.size() > 0) return false;
-
-  // this parses the string delimited list of candidates and adds
-  // them to the P2P transport and therefore creating connections
-  std::istringstream iss(candidates_string);
-  do {
-    std::string candidate_string;
-    iss >> candidate_string;
-    std::vector<std::string> fields;
-    size_t len = talk_base::split(candidate_string, ':', &fields);
-    if (len >= 12) {
-      cricket::Candidate candidate(
-          fields[0], atoi(fields[1].c_str()), fields[2],
-          talk_base::SocketAddress(fields[3], atoi(fields[4].c_str())), 
-          atoi(fields[5].c_str()), fields[6], fields[7], fields[8],
-          fields[9], atoi(fields[10].c_str()), fields[11]);
-      candidates.push_back(candidate);
-    }
-  } while (iss);
-  uid_map_[uid]->transport->OnRemoteCandidates(candidates);
+  PeerState* peer_state = uid_map_[uid].get();
+  uint64 start = talk_base::TimeNanos();
+
+  // this parses the space delimited list of candidates and adds
+  // them to the P2P transport and therefore creating connections,
+  // each token is either a text candidate or a binary batch
+  cricket::Candidates new_candidates;
+  const char* data = candidates_string.data();
+  size_t len = candidates_string.size();
+  size_t pos = 0;
+  while (pos < len) {
+    size_t end = candidates_string.find(' ', pos);
+    if (end == std::string::npos) end = len;
+    const char* token = data + pos;
+    size_t token_len = end - pos;
+    pos = end + 1;
+    if (token_len == 0) continue;
+
+    cricket::Candidate candidate;
+    if (IsBinaryCapability(token, token_len)) {
+      peer_state->binary_candidates = true;
+    }
+    else if (IsFecCapability(token, token_len)) {
+      if (!peer_state->fec_capable) {
+        peer_state->fec_capable = true;
+        packet_handling_thread_->Invoke<void>(
+          Bind(&TinCanConnectionManager::SetFecCapable_w, this,
+               uid.substr(0, kShortLen * 2)));
+      }
+    }
+    else if (IsBinaryCandidates(token, token_len)) {
+      CandidateDecoder decoder;
+      if (!decoder.Init(token, token_len)) continue;
+      // the peer understands binary batches so auto mode answers in kind
+      peer_state->binary_candidates = true;
+      CandidateRecord record;
+      while (decoder.Next(&record)) {
+        decoder.ToCandidate(record, &candidate);
+        AddRemoteCandidate(peer_state, candidate, &new_candidates);
+      }
+    }
+    else if (ParseTextCandidate(token, token_len, &candidate)) {
+      AddRemoteCandidate(peer_state, candidate, &new_candidates);
+    }
+  }
+  codec_stats_.parse_ns += talk_base::TimeNanos() - start;
+  codec_stats_.parsed += new_candidates.size();
+  // repeated or fully trickled batches are not an error
+  if (new_candidates.empty()) return true;
+  uid_map_[uid]->times.Mark(PHASE_REMOTE_CANDIDATES);
+  uid_map_[uid]->transport->OnRemoteCandidates(new_candidates);
   return true;
 }
 
+void TinCanConnectionManager::AddRemoteCandidate(
+    PeerState* peer_state, const cricket::Candidate& candidate,
+    cricket::Candidates* new_candidates) {
+  // trickled batches may repeat candidates so known ones are skipped
+  cricket::Candidates& candidates = peer_state->candidates;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (candidates[i].IsEquivalent(candidate)) return;
+  }
+  candidates.push_back(candidate);
+  new_candidates->push_back(candidate);
+}
+
 bool TinCanConnectionManager::DestroyTransport(const std::string& uid) {
   ASSERT(link_setup_thread_->IsCurrent());
-  if (uid_map_.find(uid) == uid_map_.end()) return false;
+  if (DropHibernated(uid)) {
+    LOG_TS(INFO) << "DESTROYED " << uid;
+    return true;
+  }
+  if (!RemoveTransport(uid)) return false;
+  LOG_TS(INFO) << "DESTROYED " << uid;
+  return true;
+}
+
+TinCanConnectionManager::PeerStatePtr TinCanConnectionManager::RemoveTransport(
+    const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (uid_map_.find(uid) == uid_map_.end()) return PeerStatePtr();
 
-  // This call destroys the P2P connection and deletes connection
+  // Once the returned reference is dropped the P2P connection is destroyed
   // because this calls destructor of PeerState which in turn calls the
   // destructors of all internal objects
 
@@ -588,117 +1261,1394 @@ bool TinCanConnectionManager::DestroyTransport(const std::string& uid) {
          uid.substr(0, kShortLen * 2)));
   PeerStatePtr peer = uid_map_[uid];
   transport_map_.erase(peer->transport.get());
+  phase_channels_.erase(peer->channel);
+  phase_channels_.erase(peer->transport->GetChannel(
+      cricket::ICE_CANDIDATE_COMPONENT_DEFAULT));
+  // links that never came online show where setup stalled
+  if (!peer->times.has(PHASE_ONLINE)) link_stats_.RecordFailure(peer->times);
   uid_map_.erase(uid);
-  LOG_TS(INFO) << "DESTROYED " << uid;
-  return true;
+  SetLinkState(uid, LINK_NONE);
+  return peer;
 }
 
-void TinCanConnectionManager::OnMessage(talk_base::Message* msg) {
-  ASSERT(packet_handling_thread_->IsCurrent());
-  switch (msg->message_id) {
-    case MSG_QUEUESIGNAL: {
-        HandleQueueSignal_w();
-      }
-      break;
-  }
+void TinCanConnectionManager::SetLinkState(const std::string& uid,
+                                           LinkState state) {
+  if (peer_directory_ != NULL) peer_directory_->UpdateLinkState(uid, state);
 }
 
-void TinCanConnectionManager::HandlePeer(const std::string& uid, 
-    const std::string& data, const std::string& type) {
+void TinCanConnectionManager::set_trim_connection(bool trim) {
   ASSERT(link_setup_thread_->IsCurrent());
-  signal_sender_->SendToPeer(kLocalControllerId, uid, data, type);
-  LOG_TS(INFO) << "uid:" << uid << " data:" << data << " type:" << type;
+  trim_enabled_ = trim;
+  UpdatePathPolicy();
 }
 
-int TinCanConnectionManager::DoPacketSend(const char* buf, size_t len) {
-  g_send_queue.add(new talk_base::Buffer(buf, len));
-  if (g_manager != 0) {
-    // This is called when main_thread has to process outgoing packet
-    g_manager->packet_handling_thread()->Post(g_manager, MSG_QUEUESIGNAL, 0);
-  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
-  }
-  return len;
+void TinCanConnectionManager::set_multipath(bool multipath) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  multipath_enabled_ = multipath;
+  UpdatePathPolicy();
+  LOG_TS(INFO) << "multipath:" << multipath;
 }
 
-int TinCanConnectionManager::DoPacketRecv(char* buf, size_t len) {
-  talk_base::scoped_ptr<talk_base::Buffer> packet(g_recv_queue.remove());
-  if (packet->length() > len) {
-    return -1;
-  }
-  memcpy(buf, packet->data(), packet->length());
-  return packet->length();
+void TinCanConnectionManager::set_path_selection(bool path_selection) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  path_selection_enabled_ = path_selection;
+  UpdatePathPolicy();
+  LOG_TS(INFO) << "path_selection:" << path_selection;
 }
 
-int TinCanConnectionManager::SendToTap(const char* buf, size_t len) {
-  g_recv_queue.add(new talk_base::Buffer(buf, len));
-  return len;
+void TinCanConnectionManager::UpdatePathPolicy() {
+  // the transports read these flags on the packet thread
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetPathPolicy_w, this, multipath_enabled_,
+         path_selection_enabled_, trim_enabled_));
 }
 
-void TinCanConnectionManager::HandleQueueSignal_w() {
-  ASSERT(packet_handling_thread_->IsCurrent());
-  talk_base::scoped_ptr<talk_base::Buffer> packet(g_send_queue.remove());
-  HandlePacket(0, packet->data(), packet->length(), forward_addr_);
+void TinCanConnectionManager::set_on_demand_policy(
+    const OnDemandPolicy& policy) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  on_demand_ = policy;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetDemandThreshold_w, this,
+         policy.threshold, policy.window));
+  LOG_TS(INFO) << "on_demand threshold:" << policy.threshold
+               << " window:" << policy.window;
 }
 
-void TinCanConnectionManager::GetChannelStats_w(const std::string &uid,
-                                                cricket::ConnectionInfos *infos)
-{
-  cricket::TransportChannelImpl* channel;
-  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+bool TinCanConnectionManager::AddRoute(const std::string& uid,
+                                       const std::string& next_hop) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (uid.size() != kIdSize || next_hop.size() != kIdSize ||
+      uid == next_hop || uid == tincan_id_) return false;
+  routes_[uid] = next_hop;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetRoute_w, this,
+         uid.substr(0, kShortLen * 2), next_hop.substr(0, kShortLen * 2)));
+  LOG_TS(INFO) << "ROUTE " << uid << " via " << next_hop;
+  return true;
+}
 
-  // Invoke by link_setup_thread_, so we are safe to access uid_map_ here
-  channel = uid_map_[uid]->transport->GetChannel(component);
-  channel->GetStats(infos);
+bool TinCanConnectionManager::DelRoute(const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (routes_.erase(uid) == 0) return false;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetRoute_w, this,
+         uid.substr(0, kShortLen * 2), std::string()));
+  return true;
 }
 
-void TinCanConnectionManager::InsertTransportMap_w(const std::string sub_uid,
-                                                   cricket::Transport* transport)
-{
-  if (short_uid_map_.find(sub_uid) != short_uid_map_.end()) {
-    LOG_TS(LERROR) << "uid: " << sub_uid << " already exists" << endl;
-  }
-  short_uid_map_[sub_uid] = transport;
+bool TinCanConnectionManager::set_forwarding(bool forwarding) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // without our own uid every frame would look like one to relay
+  if (tincan_id_.empty()) return false;
+  forwarding_enabled_ = forwarding;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetForwarding_w, this, forwarding,
+         accept_relayed_enabled_, tincan_id_.substr(0, kShortLen * 2)));
+  return true;
 }
 
-void TinCanConnectionManager::DeleteTransportMap_w(const std::string sub_uid)
-{
-  if (short_uid_map_.find(sub_uid) == short_uid_map_.end()) {
-    // There is some bug here. So log it.
-    LOG_TS(LERROR) << "Can't find uid: " << sub_uid;
-  } else {
-    short_uid_map_.erase(sub_uid);
+bool TinCanConnectionManager::set_accept_relayed(bool accept_relayed) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (tincan_id_.empty()) return false;
+  accept_relayed_enabled_ = accept_relayed;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetForwarding_w, this, forwarding_enabled_,
+         accept_relayed, tincan_id_.substr(0, kShortLen * 2)));
+  return true;
+}
+
+Json::Value TinCanConnectionManager::GetRouteStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  RouteStats route_stats;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetRouteStats_w, this, &route_stats,
+         reset));
+  Json::Value stats(Json::objectValue);
+  Json::Value routes(Json::objectValue);
+  for (std::map<std::string, std::string>::const_iterator it =
+       routes_.begin(); it != routes_.end(); ++it) {
+    routes[it->first] = it->second;
   }
+  stats["routes"] = routes;
+  stats["forwarding"] = forwarding_enabled_;
+  stats["accept_relayed"] = accept_relayed_enabled_;
+  stats["routed"] = route_stats.routed;
+  stats["relayed"] = route_stats.relayed;
+  stats["relayed_bytes"] = static_cast<double>(route_stats.relayed_bytes);
+  stats["delivered"] = route_stats.delivered;
+  stats["dropped"] = route_stats.dropped;
+  stats["rejected"] = route_stats.rejected;
+  stats["expired"] = route_stats.expired;
+  return stats;
 }
 
-Json::Value TinCanConnectionManager::StateToJson(const std::string& uid,
-                                                 uint32 xmpp_time,
-                                                 bool get_stats) {
-  Json::Value peer(Json::objectValue);
-  peer["uid"] = uid;
-  peer["status"] = "offline";
+void TinCanConnectionManager::set_neighbor_proxy(bool neighbor_proxy) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  neighbor_proxy_enabled_ = neighbor_proxy;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetNeighborProxy_w, this,
+         neighbor_proxy));
+}
 
-  // time_diff gives the amount of time since last xmpp presense message
-  uint32 time_diff = talk_base::Time() - xmpp_time;
-  peer["xmpp_time"] = time_diff/1000;
+Json::Value TinCanConnectionManager::GetNeighborStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  NeighborCache::Stats neighbor_stats;
+  size_t size = 0;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetNeighborStats_w, this,
+         &neighbor_stats, &size, reset));
+  Json::Value stats(Json::objectValue);
+  stats["enabled"] = neighbor_proxy_enabled_;
+  stats["entries"] = static_cast<uint32>(size);
+  stats["requests"] = neighbor_stats.requests;
+  stats["replies"] = neighbor_stats.replies;
+  stats["unicasts"] = neighbor_stats.unicasts;
+  stats["floods"] = neighbor_stats.floods;
+  stats["drops"] = neighbor_stats.drops;
+  stats["hit_rate"] = neighbor_stats.requests == 0 ? 0.0 :
+      static_cast<double>(neighbor_stats.replies + neighbor_stats.unicasts) /
+      neighbor_stats.requests;
+  return stats;
+}
 
-  if (ip_map_.find(uid) != ip_map_.end()) {
-    peer["ip4"] = ip_map_[uid].ip4;
-    peer["ip6"] = ip_map_[uid].ip6;
+void TinCanConnectionManager::set_replication(bool replication) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  replication_enabled_ = replication;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetReplication_w, this, replication));
+}
+
+Json::Value TinCanConnectionManager::GetReplicationStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  ReplicationStats replication_stats;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetReplicationStats_w, this,
+         &replication_stats, reset));
+  Json::Value stats(Json::objectValue);
+  stats["enabled"] = replication_enabled_;
+  stats["frames"] = replication_stats.frames;
+  stats["copies"] = replication_stats.copies;
+  stats["floods"] = replication_stats.floods;
+  stats["forwarded"] = replication_stats.forwarded;
+  stats["groups"] = replication_stats.groups;
+  stats["joins"] = replication_stats.joins;
+  stats["leaves"] = replication_stats.leaves;
+  return stats;
+}
+
+void TinCanConnectionManager::SetAcl(
+    const std::vector<PacketClassifier::Rule>& rules, bool default_allow) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // compiling thousands of rules takes a while, the packet thread only
+  // swaps the pointer
+  PacketClassifier* classifier = NULL;
+  if (!rules.empty() || !default_allow) {
+    classifier = new PacketClassifier(rules, default_allow ?
+        PacketClassifier::ALLOW : PacketClassifier::DENY);
   }
+  delete packet_handling_thread_->Invoke<PacketClassifier*>(
+    Bind(&TinCanConnectionManager::SwapClassifier_w, this, classifier));
+  LOG_TS(INFO) << "ACL rules:" << rules.size()
+               << " default:" << (default_allow ? "allow" : "deny");
+}
 
-  if (uid_map_.find(uid) != uid_map_.end()) {
-    peer["fpr"] = uid_map_[uid]->fingerprint;
+Json::Value TinCanConnectionManager::GetAclStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetAclStats_w, this, &stats, reset));
+  return stats;
+}
 
-    // time_diff gives the amount of time since connection was created
-    time_diff = talk_base::Time() - uid_map_[uid]->last_time;
-    peer["last_time"] = time_diff/1000;
+bool TinCanConnectionManager::SetRateLimit(const std::string& uid,
+                                           bool global, uint32 rate_kbps,
+                                           uint32 burst) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (!uid.empty() && (uid.size() != kIdSize || global)) return false;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetRateLimit_w, this,
+         uid.substr(0, kShortLen * 2), global, rate_kbps * 125, burst));
+  LOG_TS(INFO) << "RATE LIMIT " << (global ? "global" : uid)
+               << " kbps:" << rate_kbps << " burst:" << burst;
+  return true;
+}
 
-    // if transport is readable and writable that means P2P connection 
-    // is online and ready to send packets
-    if (uid_map_[uid]->transport->readable() && 
+Json::Value TinCanConnectionManager::GetRateLimitState() {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value state(Json::objectValue);
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetRateLimitState_w, this, &state));
+  return state;
+}
+
+bool TinCanConnectionManager::SetFec(const std::string& uid, bool enabled) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (!uid.empty() && uid.size() != kIdSize) return false;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::SetFec_w, this,
+         uid.substr(0, kShortLen * 2), enabled));
+  LOG_TS(INFO) << "FEC " << (uid.empty() ? "all" : uid)
+               << " enabled:" << enabled;
+  return true;
+}
+
+Json::Value TinCanConnectionManager::GetFecStats() {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetFecStats_w, this, &stats));
+  return stats;
+}
+
+void TinCanConnectionManager::StartOnDemand(const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (on_demand_.threshold == 0 || tincan_id_.empty() || uid == tincan_id_ ||
+      uid_map_.find(uid) != uid_map_.end() ||
+      hibernated_.find(uid) != hibernated_.end()) return;
+  ExpireOnDemand();
+  if (on_demand_pending_.find(uid) != on_demand_pending_.end()) return;
+
+  // the peer fingerprint is not known yet, our con_req carries ours and
+  // the link is created when the con_resp comes back. The flag tells the
+  // peer that it may accept the link without its controller, controllers
+  // read it like a candidate and skip it.
+  on_demand_pending_[uid] = talk_base::Time();
+  on_demand_started_++;
+  signal_sender_->SendToPeer(on_demand_.overlay_id, uid,
+                             fingerprint() + " " + kOnDemand, kConReq);
+  signal_sender_->SendToPeer(kLocalControllerId, uid, kOnDemand, kConStat);
+  LOG_TS(INFO) << "ON DEMAND " << uid;
+}
+
+void TinCanConnectionManager::ExpireOnDemand() {
+  std::map<std::string, uint32>::iterator it = on_demand_pending_.begin();
+  while (it != on_demand_pending_.end()) {
+    if (talk_base::TimeSince(it->second) >=
+        static_cast<int32>(kOnDemandHoldoff)) {
+      on_demand_pending_.erase(it++);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+bool TinCanConnectionManager::CreateOnDemandLink(const std::string& uid,
+                                                 const std::string& fpr,
+                                                 uint32 trigger_time) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (!CreateTransport(uid, fpr, on_demand_.overlay_id,
+                       on_demand_.stun_server, on_demand_.turn_server,
+                       on_demand_.turn_user, on_demand_.turn_pass,
+                       on_demand_.sec_enabled)) return false;
+  uid_map_[uid]->on_demand_time = trigger_time;
+  on_demand_links_++;
+  return true;
+}
+
+void TinCanConnectionManager::HandleOnDemandSignal(const std::string& uid,
+                                                   const std::string& data,
+                                                   const std::string& type) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (uid.size() != kIdSize || tincan_id_.empty() || uid == tincan_id_) {
+    return;
+  }
+  // the data is the sender fingerprint, for con_resp followed by the
+  // space delimited candidates
+  size_t idx = data.find(' ');
+  std::string fpr = data.substr(0, idx);
+  std::string cas = idx == std::string::npos ? "" : data.substr(idx + 1);
+  if (fpr.empty()) return;
+
+  if (type == kConReq) {
+    // the peer started an on-demand link towards us, our candidates go
+    // back with the con_resp once they are gathered. Other con_reqs are
+    // left to the controller.
+    if (cas == kOnDemand && uid_map_.find(uid) == uid_map_.end()) {
+      CreateOnDemandLink(uid, fpr, talk_base::Time());
+    }
+  }
+  else if (type == kConResp) {
+    ExpireOnDemand();
+    std::map<std::string, uint32>::iterator it = on_demand_pending_.find(uid);
+    if (it != on_demand_pending_.end()) {
+      uint32 trigger_time = it->second;
+      on_demand_pending_.erase(it);
+      if (uid_map_.find(uid) == uid_map_.end()) {
+        CreateOnDemandLink(uid, fpr, trigger_time);
+      }
+    }
+    // links set up by the controller get their candidates from it
+    if (!cas.empty() && uid_map_.find(uid) != uid_map_.end() &&
+        uid_map_[uid]->on_demand_time != 0) {
+      CreateConnections(uid, cas);
+    }
+  }
+}
+
+Json::Value TinCanConnectionManager::GetOnDemandStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  Json::Value stats(Json::objectValue);
+  stats["threshold"] = on_demand_.threshold;
+  stats["triggered"] = on_demand_started_;
+  stats["links"] = on_demand_links_;
+  stats["online"] = on_demand_online_;
+  stats["online_ms_avg"] =
+      on_demand_online_ ? on_demand_time_sum_ / on_demand_online_ : 0;
+  stats["online_ms_max"] = on_demand_time_max_;
+  if (reset) {
+    on_demand_started_ = 0;
+    on_demand_links_ = 0;
+    on_demand_online_ = 0;
+    on_demand_time_sum_ = 0;
+    on_demand_time_max_ = 0;
+  }
+  return stats;
+}
+
+void TinCanConnectionManager::set_idle_timeout(int idle_timeout) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  idle_timeout_ = idle_timeout * 1000;
+  if (idle_timeout_ > 0 && !idle_check_scheduled_) {
+    idle_check_scheduled_ = true;
+    link_setup_thread_->PostDelayed(
+        std::max(idle_timeout_ / 4, kMinIdleCheckInterval), this,
+        MSG_IDLECHECK);
+  }
+  LOG_TS(INFO) << "idle_timeout:" << idle_timeout;
+}
+
+void TinCanConnectionManager::CheckIdle() {
+  ASSERT(link_setup_thread_->IsCurrent());
+  idle_check_scheduled_ = false;
+  if (idle_timeout_ == 0) return;
+
+  // a link is idle when its data counters have not moved for the idle
+  // timeout, STUN pings are not part of these counters. The counters of
+  // all links are read in one go.
+  std::vector<std::string> uids;
+  for (std::map<std::string, PeerStatePtr>::iterator it = uid_map_.begin();
+       it != uid_map_.end(); ++it) {
+    PeerState* peer_state = it->second.get();
+    if (!peer_state->transport->readable() ||
+        !peer_state->transport->writable()) continue;
+    uids.push_back(it->first);
+  }
+  std::vector<uint64> counters;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::GetDataBytes_w, this, &uids, &counters));
+
+  std::vector<std::string> idle;
+  for (size_t j = 0; j < uids.size(); j++) {
+    PeerState* peer_state = uid_map_[uids[j]].get();
+    uint64 bytes = counters[j];
+    if (bytes != peer_state->idle_bytes) {
+      peer_state->idle_bytes = bytes;
+      peer_state->idle_since = talk_base::Time();
+    }
+    else if (talk_base::TimeSince(peer_state->idle_since) >=
+             static_cast<int32>(idle_timeout_)) {
+      idle.push_back(uids[j]);
+    }
+  }
+  for (size_t i = 0; i < idle.size(); i++) {
+    Hibernate(idle[i]);
+  }
+
+  // a peer that did not answer is woken again by its next packet
+  for (std::map<std::string, HibernatedPeer>::iterator it =
+       hibernated_.begin(); it != hibernated_.end(); ++it) {
+    if (it->second.revive_time != 0 &&
+        talk_base::TimeSince(it->second.revive_time) >=
+        static_cast<int32>(kReviveTimeout)) {
+      it->second.revive_time = 0;
+      packet_handling_thread_->Invoke<void>(
+        Bind(&TinCanConnectionManager::InsertHibernated_w, this,
+             it->first.substr(0, kShortLen * 2), it->first));
+    }
+  }
+
+  idle_check_scheduled_ = true;
+  link_setup_thread_->PostDelayed(
+      std::max(idle_timeout_ / 4, kMinIdleCheckInterval), this,
+      MSG_IDLECHECK);
+}
+
+void TinCanConnectionManager::Hibernate(const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  PeerStatePtr peer_state = uid_map_[uid];
+  HibernatedPeer& hibernated = hibernated_[uid];
+  hibernated.fingerprint = peer_state->fingerprint;
+  hibernated.overlay_id = peer_state->overlay_id;
+  hibernated.stun_server = peer_state->stun_server;
+  hibernated.turn_server = peer_state->turn_server;
+  hibernated.turn_user = peer_state->turn_user;
+  hibernated.turn_pass = peer_state->turn_pass;
+  hibernated.sec_enabled = peer_state->connection_security == "dtls";
+  hibernated.time = talk_base::Time();
+  hibernated.revive_time = 0;
+
+  // destroying the transport closes its sockets and stops its ICE checks,
+  // the ipop-tap ip mapping is left untouched
+  RemoveTransport(uid);
+  peer_state = NULL;
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::InsertHibernated_w, this,
+         uid.substr(0, kShortLen * 2), uid));
+  hibernations_++;
+  signal_sender_->SendToPeer(kLocalControllerId, uid, kHibernated, kConStat);
+  LOG_TS(INFO) << "HIBERNATED " << uid;
+}
+
+void TinCanConnectionManager::Revive(const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (hibernated_.find(uid) == hibernated_.end()) return;
+  // the peer's side of the link may be gone or stale as well, so the link
+  // is set up with the same con_req and con_resp exchange as a new one.
+  // The transport is created when the con_resp brings the peer's current
+  // fingerprint and candidates.
+  hibernated_[uid].revive_time = talk_base::Time();
+  signal_sender_->SendToPeer(hibernated_[uid].overlay_id, uid, fingerprint(),
+                             kConReq);
+  LOG_TS(INFO) << "REVIVING " << uid;
+}
+
+void TinCanConnectionManager::CompleteRevive(const std::string& uid,
+                                             const std::string& data) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  size_t idx = data.find(' ');
+  std::string fpr = data.substr(0, idx);
+  std::string cas = idx == std::string::npos ? "" : data.substr(idx + 1);
+  if (fpr.empty()) return;
+  HibernatedPeer hibernated = hibernated_[uid];
+  // CreateTransport drops the hibernated record, our candidates go back
+  // with the con_resp once they are gathered
+  if (!CreateTransport(uid, fpr, hibernated.overlay_id,
+                       hibernated.stun_server, hibernated.turn_server,
+                       hibernated.turn_user, hibernated.turn_pass,
+                       hibernated.sec_enabled)) return;
+  if (!cas.empty()) CreateConnections(uid, cas);
+  revivals_++;
+  LOG_TS(INFO) << "REVIVED " << uid << " after "
+               << talk_base::TimeSince(hibernated.time) / 1000 << " s";
+}
+
+bool TinCanConnectionManager::DropHibernated(const std::string& uid) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  if (hibernated_.find(uid) == hibernated_.end()) return false;
+  hibernated_.erase(uid);
+  packet_handling_thread_->Invoke<void>(
+    Bind(&TinCanConnectionManager::DeleteHibernated_w, this,
+         uid.substr(0, kShortLen * 2)));
+  return true;
+}
+
+Json::Value TinCanConnectionManager::GetIdleStats(bool reset) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // process wide numbers, comparing them before and after links hibernate
+  // gives the cost of an active idle link
+  Json::Value stats(Json::objectValue);
+  stats["idle_timeout"] = idle_timeout_ / 1000;
+  stats["active"] = static_cast<uint32>(uid_map_.size());
+  stats["hibernated"] = static_cast<uint32>(hibernated_.size());
+  stats["hibernations"] = hibernations_;
+  stats["revivals"] = revivals_;
+  stats["open_fds"] = OpenFileCount();
+  stats["rss_kb"] = static_cast<int>(ResidentMemoryKb());
+  if (reset) {
+    hibernations_ = 0;
+    revivals_ = 0;
+  }
+  return stats;
+}
+
+void TinCanConnectionManager::OnMessage(talk_base::Message* msg) {
+  switch (msg->message_id) {
+    case MSG_QUEUESIGNAL: {
+        ASSERT(packet_handling_thread_->IsCurrent());
+        HandleQueueSignal_w();
+      }
+      break;
+    case MSG_PACE: {
+        ASSERT(packet_handling_thread_->IsCurrent());
+        Pace_w();
+      }
+      break;
+    case MSG_FECFLUSH: {
+        ASSERT(packet_handling_thread_->IsCurrent());
+        FlushFec_w();
+      }
+      break;
+    case MSG_LINKPHASE: {
+        talk_base::TypedMessageData<
+            std::pair<cricket::TransportChannel*, uint32> >* data =
+            static_cast<talk_base::TypedMessageData<
+                std::pair<cricket::TransportChannel*, uint32> >*>(
+                    msg->pdata);
+        RecordPhase(data->data().first, data->data().second);
+        delete data;
+      }
+      break;
+    case MSG_IDLECHECK: {
+        CheckIdle();
+      }
+      break;
+    case MSG_NETWORKCHANGE: {
+        talk_base::TypedMessageData<std::set<std::string> >* data =
+            static_cast<talk_base::TypedMessageData<std::set<std::string> >*>(
+                msg->pdata);
+        HandleNetworkChange(data->data());
+        delete data;
+      }
+      break;
+    case MSG_RESTARTTIMEOUT: {
+        CheckRestarts();
+      }
+      break;
+    case MSG_ONDEMAND: {
+        talk_base::TypedMessageData<std::string>* data =
+            static_cast<talk_base::TypedMessageData<std::string>*>(
+                msg->pdata);
+        StartOnDemand(data->data());
+        delete data;
+      }
+      break;
+    case MSG_REVIVE: {
+        talk_base::TypedMessageData<std::string>* data =
+            static_cast<talk_base::TypedMessageData<std::string>*>(
+                msg->pdata);
+        Revive(data->data());
+        delete data;
+      }
+      break;
+  }
+}
+
+void TinCanConnectionManager::HandlePeer(const std::string& uid, 
+    const std::string& data, const std::string& type) {
+  ASSERT(link_setup_thread_->IsCurrent());
+  // with an on-demand policy or a revival in progress the link is set up
+  // here, the controller still gets the message and its create_link finds
+  // the link already there
+  std::map<std::string, HibernatedPeer>::iterator it = hibernated_.find(uid);
+  if (type == kConResp && it != hibernated_.end() &&
+      it->second.revive_time != 0) {
+    CompleteRevive(uid, data);
+  }
+  if (on_demand_.threshold > 0) HandleOnDemandSignal(uid, data, type);
+  signal_sender_->SendToPeer(kLocalControllerId, uid, data, type);
+  LOG_TS(INFO) << "uid:" << uid << " data:" << data << " type:" << type;
+}
+
+int TinCanConnectionManager::DoPacketSend(const char* buf, size_t len) {
+  if (g_manager == 0) return -1;
+  return g_manager->QueueFromTap(buf, len);
+}
+
+int TinCanConnectionManager::DoPacketRecv(char* buf, size_t len) {
+  if (g_manager == 0) return -1;
+  return g_manager->ReadForTap(buf, len);
+}
+
+int TinCanConnectionManager::QueueFromTap(const char* buf, size_t len) {
+  send_queue_.add(new talk_base::Buffer(buf, len));
+  // This is called when main_thread has to process outgoing packet
+  packet_handling_thread_->Post(this, MSG_QUEUESIGNAL, 0);
+  return len;
+}
+
+int TinCanConnectionManager::ReadForTap(char* buf, size_t len) {
+  talk_base::scoped_ptr<talk_base::Buffer> packet(recv_queue_.remove());
+  if (packet->length() > len) {
+    return -1;
+  }
+  memcpy(buf, packet->data(), packet->length());
+  return packet->length();
+}
+
+int TinCanConnectionManager::SendToTap(const char* buf, size_t len) {
+  recv_queue_.add(new talk_base::Buffer(buf, len));
+  return len;
+}
+
+void TinCanConnectionManager::HandleQueueSignal_w() {
+  ASSERT(packet_handling_thread_->IsCurrent());
+  talk_base::scoped_ptr<talk_base::Buffer> packet(send_queue_.remove());
+  HandlePacket(0, packet->data(), packet->length(), forward_addr_);
+}
+
+void TinCanConnectionManager::GetDataBytes_w(
+    const std::vector<std::string>* uids, std::vector<uint64>* counters)
+{
+  counters->resize(uids->size());
+  for (size_t i = 0; i < uids->size(); i++) {
+    cricket::ConnectionInfos infos;
+    GetChannelStats_w((*uids)[i], &infos);
+    uint64 bytes = 0;
+    for (size_t j = 0; j < infos.size(); j++) {
+      bytes += infos[j].sent_total_bytes + infos[j].recv_total_bytes;
+    }
+    (*counters)[i] = bytes;
+  }
+}
+
+void TinCanConnectionManager::GetChannelStats_w(const std::string &uid,
+                                                cricket::ConnectionInfos *infos)
+{
+  cricket::TransportChannelImpl* channel;
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+
+  // Invoke by link_setup_thread_, so we are safe to access uid_map_ here
+  channel = uid_map_[uid]->transport->GetChannel(component);
+  channel->GetStats(infos);
+}
+
+void TinCanConnectionManager::InsertTransportMap_w(const std::string sub_uid,
+                                                   cricket::Transport* transport)
+{
+  if (short_uid_map_.find(sub_uid) != short_uid_map_.end()) {
+    LOG_TS(LERROR) << "uid: " << sub_uid << " already exists" << endl;
+  }
+  short_uid_map_[sub_uid] = transport;
+}
+
+void TinCanConnectionManager::DeleteTransportMap_w(const std::string sub_uid)
+{
+  if (short_uid_map_.find(sub_uid) == short_uid_map_.end()) {
+    // There is some bug here. So log it.
+    LOG_TS(LERROR) << "Can't find uid: " << sub_uid;
+  } else {
+    // the channel is destroyed with the transport, its address may be
+    // reused by the next link
+    int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+    fec_receivers_w_.erase(short_uid_map_[sub_uid]->GetChannel(component));
+    short_uid_map_.erase(sub_uid);
+  }
+  restarting_short_set_.erase(sub_uid);
+  DropShaper_w(sub_uid);
+  fec_encoders_w_.erase(sub_uid);
+  fec_capable_w_.erase(sub_uid);
+}
+
+void TinCanConnectionManager::InsertHibernated_w(const std::string sub_uid,
+                                                 const std::string uid)
+{
+  hibernated_short_map_[sub_uid] = uid;
+}
+
+void TinCanConnectionManager::DeleteHibernated_w(const std::string sub_uid)
+{
+  hibernated_short_map_.erase(sub_uid);
+}
+
+void TinCanConnectionManager::RestartChannels_w(
+    const std::set<std::string>* removed, std::vector<std::string>* restarted)
+{
+  // Invoke by link_setup_thread_, so we are safe to access uid_map_ here
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  for (std::map<std::string, PeerStatePtr>::iterator it = uid_map_.begin();
+       it != uid_map_.end(); ++it) {
+    TinCanTransportChannel* p2p_channel =
+        static_cast<TinCanTransportChannel*>(it->second->channel);
+    cricket::Connection* connection = p2p_channel->preferred();
+    if (connection == NULL) connection = p2p_channel->best_connection();
+    // links without a connection are still looking and take any new
+    // address, the others keep a route whose local address survived
+    if (connection != NULL &&
+        removed->find(connection->port()->ip().ToString()) == removed->end()) {
+      continue;
+    }
+    std::string sub_uid = it->first.substr(0, kShortLen * 2);
+    if (short_uid_map_.find(sub_uid) == short_uid_map_.end()) continue;
+    cricket::TransportChannelImpl* channel =
+        short_uid_map_[sub_uid]->GetChannel(component);
+    if (channel == NULL) continue;
+    // an extra allocator session gathers candidates on the current
+    // networks, the transport and its DTLS association are kept and the
+    // new candidates are signaled by OnCandidatesReady
+    restarting_short_set_.insert(sub_uid);
+    channel->Connect();
+    restarted->push_back(it->first);
+  }
+}
+
+void TinCanConnectionManager::SetPathPolicy_w(bool multipath,
+                                              bool path_selection,
+                                              bool prune_relay)
+{
+  for (std::map<std::string, cricket::Transport*>::iterator it =
+       short_uid_map_.begin(); it != short_uid_map_.end(); ++it) {
+    TinCanP2PTransport* transport =
+        static_cast<TinCanP2PTransport*>(it->second);
+    transport->set_multipath(multipath);
+    transport->set_path_selection(path_selection);
+    transport->set_prune_relay(prune_relay);
+  }
+}
+
+void TinCanConnectionManager::GetPathInfo_w(const std::string& uid,
+                                            std::string* preferred,
+                                            uint32* switches)
+{
+  // Invoke by link_setup_thread_, so we are safe to access uid_map_ here
+  TinCanTransportChannel* channel =
+      static_cast<TinCanTransportChannel*>(uid_map_[uid]->channel);
+  *switches = channel->path_switches();
+  if (channel->preferred() != NULL) {
+    *preferred = channel->preferred()->local_candidate().address().ToString() +
+        " " + channel->preferred()->remote_candidate().address().ToString();
+  }
+}
+
+void TinCanConnectionManager::DeleteRestarting_w(const std::string sub_uid)
+{
+  restarting_short_set_.erase(sub_uid);
+}
+
+void TinCanConnectionManager::SetRoute_w(const std::string sub_uid,
+                                         const std::string next_hop)
+{
+  if (next_hop.empty()) route_map_w_.erase(sub_uid);
+  else route_map_w_[sub_uid] = next_hop;
+}
+
+void TinCanConnectionManager::SetForwarding_w(bool forwarding,
+                                              bool accept_relayed,
+                                              const std::string local_sub_uid)
+{
+  forwarding_w_ = forwarding;
+  accept_relayed_w_ = accept_relayed;
+  local_short_w_ = local_sub_uid;
+}
+
+bool TinCanConnectionManager::FromNextHop_w(
+    const std::string& source, cricket::TransportChannel* channel)
+{
+  // any peer can put another uid in the source field, so the link has to
+  // be the one our own route to the source goes through
+  std::map<std::string, std::string>::iterator route =
+      route_map_w_.find(source);
+  if (route == route_map_w_.end()) return false;
+  std::map<std::string, cricket::Transport*>::iterator it =
+      short_uid_map_.find(route->second);
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  return it != short_uid_map_.end() &&
+         it->second->GetChannel(component) == channel;
+}
+
+void TinCanConnectionManager::GetRouteStats_w(RouteStats* stats, bool reset)
+{
+  *stats = route_stats_w_;
+  if (reset) route_stats_w_ = RouteStats();
+}
+
+bool TinCanConnectionManager::RelayFrame_w(
+    const std::string& sub_uid, cricket::TransportChannel* in_channel,
+    const char* data, size_t len)
+{
+  // the destination delivers the frame to its tap and does not relay it
+  if (short_uid_map_.find(sub_uid) != short_uid_map_.end()) {
+    return SendRouted_w(sub_uid, in_channel, data, len);
+  }
+  // the next hop may relay the frame again, split horizon only stops
+  // loops of two peers so longer ones run out of hop limit. Frames without
+  // one (e.g. ARP) are only relayed to their destination.
+  std::string frame(data, len);
+  if (!DecrementHopLimit(&frame[0], len)) {
+    route_stats_w_.expired++;
+    return false;
+  }
+  return SendRouted_w(sub_uid, in_channel, frame.data(), len);
+}
+
+bool TinCanConnectionManager::SendRouted_w(
+    const std::string& sub_uid, cricket::TransportChannel* in_channel,
+    const char* data, size_t len)
+{
+  // a direct link wins over a route
+  std::map<std::string, cricket::Transport*>::iterator it =
+      short_uid_map_.find(sub_uid);
+  if (it == short_uid_map_.end()) {
+    std::map<std::string, std::string>::iterator route =
+        route_map_w_.find(sub_uid);
+    if (route == route_map_w_.end()) return false;
+    it = short_uid_map_.find(route->second);
+    if (it == short_uid_map_.end()) return false;
+  }
+  if (!it->second->writable()) return false;
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  cricket::TransportChannelImpl* channel = it->second->GetChannel(component);
+  // split horizon, a frame never goes back over the link it came from
+  if (channel == NULL || channel == in_channel) return false;
+  // the limit belongs to the link the frame leaves on
+  SendShaped_w(it->first, channel, data, len);
+  return true;
+}
+
+void TinCanConnectionManager::SetNeighborProxy_w(bool neighbor_proxy)
+{
+  // the cache is kept, learned entries expire on their own and the
+  // set_remote_ip mappings are still valid when it is turned on again
+  neighbor_proxy_w_ = neighbor_proxy;
+}
+
+void TinCanConnectionManager::AddNeighbor_w(const std::string ip,
+                                            const std::string uid)
+{
+  neighbor_cache_.AddMapping(ip, uid);
+}
+
+void TinCanConnectionManager::GetNeighborStats_w(NeighborCache::Stats* stats,
+                                                 size_t* size, bool reset)
+{
+  *stats = neighbor_cache_.stats();
+  *size = neighbor_cache_.size();
+  if (reset) neighbor_cache_.ResetStats();
+}
+
+void TinCanConnectionManager::SetReplication_w(bool replication)
+{
+  replication_w_ = replication;
+  // memberships snooped before are out of date once it is turned back on
+  if (!replication) group_table_.Clear();
+}
+
+bool TinCanConnectionManager::Replicate_w(const char* data, size_t len)
+{
+  // the same buffer goes to every peer, the destination uid stays null so
+  // that peers hand the frame to their tap instead of relaying it, so only
+  // direct links count and false is returned when a known peer was missed
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  const GroupTable::Members* members = group_table_.Lookup(data, len);
+  bool reached_all = true;
+  replication_stats_w_.frames++;
+  if (members == NULL) {
+    replication_stats_w_.floods++;
+    for (std::map<std::string, cricket::Transport*>::iterator it =
+         short_uid_map_.begin(); it != short_uid_map_.end(); ++it) {
+      if (!SendDirect_w(it->first, it->second, component, data, len)) {
+        reached_all = false;
+      }
+    }
+    // hibernated peers and peers behind a route have no direct link
+    if (!hibernated_short_map_.empty()) reached_all = false;
+    for (std::map<std::string, std::string>::iterator it =
+         route_map_w_.begin(); it != route_map_w_.end(); ++it) {
+      if (short_uid_map_.find(it->first) == short_uid_map_.end()) {
+        reached_all = false;
+      }
+    }
+    return reached_all;
+  }
+  for (GroupTable::Members::const_iterator it = members->begin();
+       it != members->end(); ++it) {
+    std::map<std::string, cricket::Transport*>::iterator tit =
+        short_uid_map_.find(it->first);
+    if (tit == short_uid_map_.end() ||
+        !SendDirect_w(tit->first, tit->second, component, data, len)) {
+      reached_all = false;
+    }
+  }
+  return reached_all;
+}
+
+bool TinCanConnectionManager::SendDirect_w(const std::string& sub_uid,
+                                           cricket::Transport* transport,
+                                           int component, const char* data,
+                                           size_t len)
+{
+  // a restarting link may already have lost its channel, like unicast
+  // traffic its copy goes through the controller
+  if (!transport->writable() ||
+      restarting_short_set_.find(sub_uid) != restarting_short_set_.end()) {
+    return false;
+  }
+  cricket::TransportChannelImpl* channel = transport->GetChannel(component);
+  if (channel == NULL) return false;
+  SendShaped_w(sub_uid, channel, data, len);
+  replication_stats_w_.copies++;
+  return true;
+}
+
+void TinCanConnectionManager::GetReplicationStats_w(ReplicationStats* stats,
+                                                    bool reset)
+{
+  *stats = replication_stats_w_;
+  stats->groups = group_table_.size();
+  stats->joins = group_table_.stats().joins;
+  stats->leaves = group_table_.stats().leaves;
+  if (reset) {
+    replication_stats_w_ = ReplicationStats();
+    group_table_.ResetStats();
+  }
+}
+
+PacketClassifier* TinCanConnectionManager::SwapClassifier_w(
+    PacketClassifier* classifier)
+{
+  PacketClassifier* old = classifier_w_.release();
+  classifier_w_.reset(classifier);
+  return old;
+}
+
+void TinCanConnectionManager::GetAclStats_w(Json::Value* stats, bool reset)
+{
+  (*stats)["dropped_in"] = acl_drops_w_[PacketClassifier::IN];
+  (*stats)["dropped_out"] = acl_drops_w_[PacketClassifier::OUT];
+  if (reset) {
+    acl_drops_w_[PacketClassifier::IN] = 0;
+    acl_drops_w_[PacketClassifier::OUT] = 0;
+  }
+  PacketClassifier* classifier = classifier_w_.get();
+  (*stats)["rules"] = static_cast<uint32>(classifier ? classifier->size() : 0);
+  if (classifier == NULL) return;
+  (*stats)["default"] =
+      classifier->default_action() == PacketClassifier::ALLOW ?
+      "allow" : "deny";
+  (*stats)["default_hits"] =
+      static_cast<double>(classifier->default_hits());
+  Json::Value hits(Json::arrayValue);
+  for (size_t i = 0; i < classifier->size(); i++) {
+    Json::Value hit(Json::objectValue);
+    hit["id"] = classifier->rule(i).id;
+    hit["hits"] = static_cast<double>(classifier->hits(i));
+    hits.append(hit);
+  }
+  (*stats)["hits"] = hits;
+  if (reset) classifier->ResetHits();
+}
+
+void TinCanConnectionManager::SetRateLimit_w(const std::string sub_uid,
+                                             bool global, uint32 rate,
+                                             uint32 burst)
+{
+  if (global) {
+    global_bucket_w_.Configure(rate, burst);
+  }
+  else if (sub_uid.empty()) {
+    peer_default_w_.Configure(rate, burst);
+  }
+  else if (rate == 0) {
+    rate_overrides_w_.erase(sub_uid);
+  }
+  else {
+    rate_overrides_w_[sub_uid] = std::make_pair(rate, burst);
+  }
+  for (std::map<std::string, PeerShaper>::iterator it = shapers_w_.begin();
+       it != shapers_w_.end(); ++it) {
+    ConfigureShaper_w(it->first, &it->second);
+  }
+  // frames that are still queued are paced out by the new limits
+  shaping_w_ = global_bucket_w_.limited() || peer_default_w_.limited() ||
+               !rate_overrides_w_.empty();
+  if (!shapers_w_.empty()) SchedulePace_w(0);
+}
+
+TinCanConnectionManager::PeerShaper& TinCanConnectionManager::Shaper_w(
+    const std::string& sub_uid)
+{
+  std::map<std::string, PeerShaper>::iterator it = shapers_w_.find(sub_uid);
+  if (it != shapers_w_.end()) return it->second;
+  PeerShaper& shaper = shapers_w_[sub_uid];
+  ConfigureShaper_w(sub_uid, &shaper);
+  return shaper;
+}
+
+void TinCanConnectionManager::ConfigureShaper_w(const std::string& sub_uid,
+                                                PeerShaper* shaper)
+{
+  std::map<std::string, std::pair<uint32, uint32> >::iterator it =
+      rate_overrides_w_.find(sub_uid);
+  if (it != rate_overrides_w_.end()) {
+    shaper->bucket.Configure(it->second.first, it->second.second);
+  }
+  else {
+    shaper->bucket.Configure(peer_default_w_.rate(),
+                             peer_default_w_.burst());
+  }
+}
+
+void TinCanConnectionManager::DropShaper_w(const std::string& sub_uid)
+{
+  std::map<std::string, PeerShaper>::iterator it = shapers_w_.find(sub_uid);
+  if (it == shapers_w_.end()) return;
+  std::deque<talk_base::Buffer*>& queue = it->second.queue;
+  for (size_t i = 0; i < queue.size(); i++) delete queue[i];
+  shapers_w_.erase(it);
+}
+
+void TinCanConnectionManager::SendShaped_w(
+    const std::string& sub_uid, cricket::TransportChannelImpl* channel,
+    const char* data, size_t len)
+{
+  if (!shaping_w_ && shapers_w_.empty()) {
+    SendFrame_w(sub_uid, channel, data, len);
+    return;
+  }
+  PeerShaper& shaper = Shaper_w(sub_uid);
+  uint64 now = talk_base::TimeNanos() / 1000;
+  // queued frames go first so that a link keeps its order
+  if (shaper.queue.empty() && shaper.bucket.Ready(len, now) &&
+      global_bucket_w_.Ready(len, now)) {
+    shaper.bucket.Take(len);
+    global_bucket_w_.Take(len);
+    shaper.sent++;
+    SendFrame_w(sub_uid, channel, data, len);
+    return;
+  }
+  // the queue holds what the slower of the two limits sends in
+  // kMaxPaceDelay, links that share the global limit may wait longer
+  uint32 rate = shaper.bucket.rate();
+  if (global_bucket_w_.limited() && (rate == 0 ||
+      global_bucket_w_.rate() < rate)) rate = global_bucket_w_.rate();
+  size_t max_queued = std::max(
+      static_cast<size_t>(static_cast<uint64>(rate) * kMaxPaceDelay / 1000),
+      len);
+  if (shaper.queued_bytes + len > max_queued) {
+    shaper.dropped++;
+    return;
+  }
+  shaper.queue.push_back(new talk_base::Buffer(data, len));
+  shaper.queued_bytes += len;
+  shaper.delayed++;
+  SchedulePace_w(std::max(shaper.bucket.Wait(len),
+                          global_bucket_w_.Wait(len)));
+}
+
+void TinCanConnectionManager::SchedulePace_w(uint64 wait)
+{
+  if (pace_scheduled_w_) return;
+  pace_scheduled_w_ = true;
+  int delay = static_cast<int>((wait + 999) / 1000);
+  packet_handling_thread_->PostDelayed(std::max(delay, 1), this, MSG_PACE);
+}
+
+void TinCanConnectionManager::Pace_w()
+{
+  pace_scheduled_w_ = false;
+  uint64 now = talk_base::TimeNanos() / 1000;
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  // one frame per peer and round so that the global limit is shared
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (std::map<std::string, PeerShaper>::iterator it =
+         shapers_w_.begin(); it != shapers_w_.end(); ++it) {
+      PeerShaper& shaper = it->second;
+      if (shaper.queue.empty()) continue;
+      size_t len = shaper.queue.front()->length();
+      if (!shaper.bucket.Ready(len, now) ||
+          !global_bucket_w_.Ready(len, now)) continue;
+      talk_base::scoped_ptr<talk_base::Buffer> packet(shaper.queue.front());
+      shaper.queue.pop_front();
+      shaper.queued_bytes -= len;
+      shaper.bucket.Take(len);
+      global_bucket_w_.Take(len);
+      progress = true;
+
+      std::map<std::string, cricket::Transport*>::iterator tit =
+          short_uid_map_.find(it->first);
+      cricket::TransportChannelImpl* channel = NULL;
+      if (tit != short_uid_map_.end() && tit->second->writable()) {
+        channel = tit->second->GetChannel(component);
+      }
+      if (channel == NULL) {
+        shaper.dropped++;
+        continue;
+      }
+      TinCanP2PTransport* transport =
+          static_cast<TinCanP2PTransport*>(tit->second);
+      if (transport->multipath()) {
+        transport->set_flow_hint(FlowHash(packet->data() + kHeaderSize,
+                                          len - kHeaderSize));
+      }
+      SendFrame_w(it->first, channel, packet->data(), len);
+      shaper.sent++;
+    }
+  }
+
+  // the next round starts when the first waiting frame can go
+  uint64 wait = 0;
+  bool waiting = false;
+  for (std::map<std::string, PeerShaper>::iterator it = shapers_w_.begin();
+       it != shapers_w_.end(); ++it) {
+    if (it->second.queue.empty()) continue;
+    size_t len = it->second.queue.front()->length();
+    uint64 frame_wait = std::max(it->second.bucket.Wait(len),
+                                 global_bucket_w_.Wait(len));
+    wait = waiting ? std::min(wait, frame_wait) : frame_wait;
+    waiting = true;
+  }
+  if (waiting) SchedulePace_w(wait);
+
+  // without limits the drained shapers go away and sends take the
+  // direct path again
+  if (!shaping_w_ && !waiting) shapers_w_.clear();
+}
+
+void TinCanConnectionManager::GetRateLimitState_w(Json::Value* state)
+{
+  (*state)["global_rate_kbps"] = global_bucket_w_.rate() / 125;
+  (*state)["global_burst"] = global_bucket_w_.burst();
+  (*state)["peer_rate_kbps"] = peer_default_w_.rate() / 125;
+  (*state)["peer_burst"] = peer_default_w_.burst();
+  (*state)["peer_overrides"] =
+      static_cast<uint32>(rate_overrides_w_.size());
+  uint32 queued = 0;
+  uint32 sent = 0;
+  uint32 delayed = 0;
+  uint32 dropped = 0;
+  for (std::map<std::string, PeerShaper>::iterator it = shapers_w_.begin();
+       it != shapers_w_.end(); ++it) {
+    queued += it->second.queued_bytes;
+    sent += it->second.sent;
+    delayed += it->second.delayed;
+    dropped += it->second.dropped;
+  }
+  (*state)["queued_bytes"] = queued;
+  (*state)["sent"] = sent;
+  (*state)["delayed"] = delayed;
+  (*state)["dropped"] = dropped;
+}
+
+void TinCanConnectionManager::GetShaperState_w(const std::string sub_uid,
+                                               Json::Value* state)
+{
+  std::map<std::string, PeerShaper>::iterator it = shapers_w_.find(sub_uid);
+  if (it == shapers_w_.end()) return;
+  (*state)["rate_kbps"] = it->second.bucket.rate() / 125;
+  (*state)["burst"] = it->second.bucket.burst();
+  (*state)["queued_bytes"] = static_cast<uint32>(it->second.queued_bytes);
+  (*state)["sent"] = it->second.sent;
+  (*state)["delayed"] = it->second.delayed;
+  (*state)["dropped"] = it->second.dropped;
+}
+
+void TinCanConnectionManager::SetFec_w(const std::string sub_uid,
+                                       bool enabled)
+{
+  if (sub_uid.empty()) {
+    fec_all_w_ = enabled;
+    if (!enabled) fec_peers_w_.clear();
+  }
+  else if (enabled) {
+    fec_peers_w_.insert(sub_uid);
+  }
+  else {
+    fec_peers_w_.erase(sub_uid);
+  }
+  // the receivers stay, the peer may still protect its frames to us
+  if (!fec_all_w_) {
+    std::map<std::string, FecEncoder>::iterator it = fec_encoders_w_.begin();
+    while (it != fec_encoders_w_.end()) {
+      if (fec_peers_w_.find(it->first) == fec_peers_w_.end()) {
+        fec_encoders_w_.erase(it++);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+}
+
+void TinCanConnectionManager::SetFecCapable_w(const std::string sub_uid)
+{
+  fec_capable_w_.insert(sub_uid);
+}
+
+void TinCanConnectionManager::SendFrame_w(
+    const std::string& sub_uid, cricket::TransportChannelImpl* channel,
+    const char* data, size_t len)
+{
+  if ((!fec_all_w_ && fec_peers_w_.find(sub_uid) == fec_peers_w_.end()) ||
+      fec_capable_w_.find(sub_uid) == fec_capable_w_.end() ||
+      len > kFecMaxFrame) {
+    channel->SendPacket(data, len, packet_options_, 0);
+    return;
+  }
+  FecEncoder& encoder = fec_encoders_w_[sub_uid];
+  char packet[kFecMaxPacket];
+  bool complete = encoder.Encode(data, len, packet);
+  channel->SendPacket(packet, len + kFecShimLen, packet_options_, 0);
+  if (complete) {
+    size_t parity_len = encoder.Parity(packet);
+    channel->SendPacket(packet, parity_len, packet_options_, 0);
+  }
+  else if (!fec_flush_scheduled_w_) {
+    fec_flush_scheduled_w_ = true;
+    packet_handling_thread_->PostDelayed(kFecFlushDelay, this,
+                                         MSG_FECFLUSH);
+  }
+}
+
+void TinCanConnectionManager::FlushFec_w()
+{
+  fec_flush_scheduled_w_ = false;
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  char packet[kFecMaxPacket];
+  for (std::map<std::string, FecEncoder>::iterator it =
+       fec_encoders_w_.begin(); it != fec_encoders_w_.end(); ++it) {
+    if (!it->second.pending()) continue;
+    size_t parity_len = it->second.Parity(packet);
+    std::map<std::string, cricket::Transport*>::iterator tit =
+        short_uid_map_.find(it->first);
+    if (tit == short_uid_map_.end() || !tit->second->writable()) continue;
+    cricket::TransportChannelImpl* channel =
+        tit->second->GetChannel(component);
+    if (channel == NULL) continue;
+    channel->SendPacket(packet, parity_len, packet_options_, 0);
+  }
+}
+
+void TinCanConnectionManager::HandleFec_w(cricket::TransportChannel* channel,
+                                          const char* data, size_t len)
+{
+  FecReceiver& receiver = fec_receivers_w_[channel];
+  FecDecoder::Output out;
+  receiver.decoder.Decode(data, len, &out);
+  if (out.frame != NULL) ReadFrame_w(channel, out.frame, out.frame_len);
+  if (out.recovered_len > 0) {
+    ReadFrame_w(channel, out.recovered, out.recovered_len);
+  }
+
+  int component = cricket::ICE_CANDIDATE_COMPONENT_DEFAULT;
+  if (out.feedback >= 0) {
+    // the loss of the frames we send over this link, as seen by the peer
+    for (std::map<std::string, FecEncoder>::iterator it =
+         fec_encoders_w_.begin(); it != fec_encoders_w_.end(); ++it) {
+      std::map<std::string, cricket::Transport*>::iterator tit =
+          short_uid_map_.find(it->first);
+      if (tit != short_uid_map_.end() &&
+          tit->second->GetChannel(component) == channel) {
+        it->second.UpdateLoss(out.feedback);
+        break;
+      }
+    }
+    return;
+  }
+
+  uint32 now = talk_base::Time();
+  if (talk_base::TimeDiff(now, receiver.feedback_time) <
+      static_cast<int32>(kFecFeedbackInterval)) return;
+  int loss = receiver.decoder.TakeLoss();
+  if (loss < 0) return;
+  char feedback[kFecShimLen + 2];
+  size_t feedback_len = FecDecoder::Feedback(loss, feedback);
+  channel->SendPacket(feedback, feedback_len, packet_options_, 0);
+  receiver.feedback_time = now;
+}
+
+void TinCanConnectionManager::GetFecStats_w(Json::Value* stats)
+{
+  uint32 data_packets = 0;
+  uint32 parity_packets = 0;
+  Json::Value group_sizes(Json::objectValue);
+  for (std::map<std::string, FecEncoder>::iterator it =
+       fec_encoders_w_.begin(); it != fec_encoders_w_.end(); ++it) {
+    data_packets += it->second.data_packets();
+    parity_packets += it->second.parity_packets();
+    group_sizes[it->first] = it->second.group_size();
+  }
+  uint32 received = 0;
+  uint32 recovered = 0;
+  uint32 lost = 0;
+  for (std::map<cricket::TransportChannel*, FecReceiver>::iterator it =
+       fec_receivers_w_.begin(); it != fec_receivers_w_.end(); ++it) {
+    received += it->second.decoder.received();
+    recovered += it->second.decoder.recovered();
+    lost += it->second.decoder.lost();
+  }
+  (*stats)["enabled"] = fec_all_w_;
+  (*stats)["peers"] = static_cast<uint32>(fec_peers_w_.size());
+  (*stats)["capable"] = static_cast<uint32>(fec_capable_w_.size());
+  (*stats)["group_sizes"] = group_sizes;
+  (*stats)["data_sent"] = data_packets;
+  (*stats)["parity_sent"] = parity_packets;
+  (*stats)["received"] = received;
+  (*stats)["recovered"] = recovered;
+  (*stats)["lost"] = lost;
+}
+
+void TinCanConnectionManager::SetDemandThreshold_w(uint32 threshold,
+                                                   uint32 window)
+{
+  on_demand_threshold_w_ = threshold;
+  on_demand_window_w_ = window * 1000;
+  demand_map_.clear();
+}
+
+void TinCanConnectionManager::CountDemand_w(const std::string& sub_uid,
+                                            const char* dest_uid)
+{
+  uint32 now = talk_base::Time();
+  if (demand_map_.size() >= kMaxDemandEntries &&
+      demand_map_.find(sub_uid) == demand_map_.end()) {
+    // a scan of the address space should not grow the table without bound
+    demand_map_.clear();
+  }
+  DemandCounter& counter = demand_map_[sub_uid];
+  if (counter.count == 0 ||
+      talk_base::TimeDiff(now, counter.start) >
+      static_cast<int32>(on_demand_window_w_)) {
+    counter.count = 0;
+    counter.start = now;
+  }
+  if (++counter.count != on_demand_threshold_w_) return;
+  // only the full uid identifies the peer for signaling
+  link_setup_thread_->Post(this, MSG_ONDEMAND,
+      new talk_base::TypedMessageData<std::string>(
+          talk_base::hex_encode(dest_uid, kIdBytesLen)));
+}
+
+bool TinCanConnectionManager::WakePeer_w(const std::string& sub_uid)
+{
+  std::map<std::string, std::string>::iterator it =
+      hibernated_short_map_.find(sub_uid);
+  if (it == hibernated_short_map_.end()) return false;
+  // only the first packet asks for a revival
+  link_setup_thread_->Post(this, MSG_REVIVE,
+      new talk_base::TypedMessageData<std::string>(it->second));
+  hibernated_short_map_.erase(it);
+  return true;
+}
+
+Json::Value TinCanConnectionManager::StateToJson(const std::string& uid,
+                                                 const PeerRecord& record,
+                                                 bool get_stats) {
+  Json::Value peer(Json::objectValue);
+  peer["uid"] = uid;
+  peer["status"] = "offline";
+  peer["link_state"] = LinkStateName(record.link_state);
+
+  // time_diff gives the amount of time since last xmpp presense message
+  uint32 time_diff = talk_base::Time() - record.presence_time;
+  peer["xmpp_time"] = time_diff/1000;
+
+  if (ip_map_.find(uid) != ip_map_.end()) {
+    peer["ip4"] = ip_map_[uid].ip4;
+    peer["ip6"] = ip_map_[uid].ip6;
+  }
+
+  if (uid_map_.find(uid) != uid_map_.end()) {
+    peer["fpr"] = uid_map_[uid]->fingerprint;
+
+    // time_diff gives the amount of time since connection was created
+    time_diff = talk_base::Time() - uid_map_[uid]->last_time;
+    peer["last_time"] = time_diff/1000;
+    peer["setup_times"] = uid_map_[uid]->times.ToJson();
+
+    // if transport is readable and writable that means P2P connection 
+    // is online and ready to send packets
+    if (uid_map_[uid]->transport->readable() && 
         uid_map_[uid]->transport->writable()) {
       peer["status"] = "online";
       peer["security"] = uid_map_[uid]->connection_security;
+      peer["multipath"] = uid_map_[uid]->transport->multipath();
+      Json::Value rate_limit(Json::objectValue);
+      packet_handling_thread_->Invoke<void>(
+        Bind(&TinCanConnectionManager::GetShaperState_w, this,
+             uid.substr(0, kShortLen * 2), &rate_limit));
+      if (!rate_limit.empty()) peer["rate_limit"] = rate_limit;
 #if !defined(WIN32)
         // For some odd reason, GetStats fails on WIN32
       if (get_stats) {
@@ -707,6 +2657,13 @@ Json::Value TinCanConnectionManager::StateToJson(const std::string& uid,
           Bind(&TinCanConnectionManager::GetChannelStats_w, this,
                uid,&infos));
 
+        std::string preferred;
+        uint32 switches = 0;
+        packet_handling_thread_->Invoke<void>(
+          Bind(&TinCanConnectionManager::GetPathInfo_w, this,
+               uid, &preferred, &switches));
+        peer["path_switches"] = switches;
+
         Json::Value stats(Json::arrayValue);
         for (int i = 0; i < infos.size(); i++) {
           Json::Value stat(Json::objectValue);
@@ -715,6 +2672,9 @@ Json::Value TinCanConnectionManager::StateToJson(const std::string& uid,
           stat["local_type"] = infos[i].local_candidate.type();
           stat["rem_type"] = infos[i].remote_candidate.type();
           stat["best_conn"] = infos[i].best_connection;
+          stat["preferred"] = !preferred.empty() && preferred ==
+              stat["local_addr"].asString() + " " +
+              stat["rem_addr"].asString();
           stat["writable"] = infos[i].writable;
           stat["readable"] = infos[i].readable;
           stat["timeout"] = infos[i].timeout;
@@ -731,18 +2691,24 @@ Json::Value TinCanConnectionManager::StateToJson(const std::string& uid,
 #endif
     }
   }
+  else if (hibernated_.find(uid) != hibernated_.end()) {
+    peer["fpr"] = hibernated_[uid].fingerprint;
+    peer["status"] = kHibernated;
+  }
   return peer;
 }
 
-Json::Value TinCanConnectionManager::GetState(
-    const std::map<std::string, uint32>& friends, bool get_stats) {
+Json::Value TinCanConnectionManager::GetState(const PeerDirectory& peers,
+                                              bool get_stats) {
   ASSERT(link_setup_thread_->IsCurrent());
-  Json::Value peers(Json::objectValue);
-  for (std::map<std::string, uint32>::const_iterator it =
-       friends.begin(); it != friends.end(); ++it) {
-    peers[it->first] = StateToJson(it->first, it->second, get_stats);
+  Json::Value state(Json::objectValue);
+  for (PeerDirectory::const_iterator it = peers.begin(); it != peers.end();
+       ++it) {
+    if (it->second.presence_time == 0) continue;
+    state[it->first] =
+        StateToJson(it->first, it->second, get_stats);
   }
-  return peers;
+  return state;
 }
 
 bool TinCanConnectionManager::is_icc(const unsigned char * buf) {
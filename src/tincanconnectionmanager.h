@@ -25,6 +25,7 @@
 #define TINCAN_CONNECTIONMANAGER_H_
 #pragma once
 
+#include <deque>
 #include <string>
 #include <map>
 #include <set>
@@ -50,13 +51,23 @@
 #include "talk/ipop-project/ipop-tap/src/peerlist.h"
 #include "talk/ipop-project/ipop-tap/src/packetio.h"
 
+#include "candidatecache.h"
+#include "candidatecodec.h"
+#include "fec.h"
+#include "grouptable.h"
+#include "linkstats.h"
+#include "neighborcache.h"
+#include "packetclassifier.h"
+#include "peerdirectory.h"
 #include "peersignalsender.h"
+#include "sharedsocketfactory.h"
+#include "tincanchannel.h"
+#include "tincanidentity.h"
+#include "tokenbucket.h"
 #include "wqueue.h"
 
 namespace tincan {
 static const char kTapDesc[] = "TAP";
-//name is configurable using argument passed to tincan.
-extern  string kTapName;
 
 class PeerSignalSender : public PeerSignalSenderInterface {
  public:
@@ -83,7 +94,9 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
   TinCanConnectionManager(PeerSignalSenderInterface* signal_sender,
                           talk_base::Thread* link_setup_thread,
                           talk_base::Thread* packet_handling_thread,
-                          thread_opts_t* opts);
+                          thread_opts_t* opts, const std::string& tap_name);
+
+  virtual ~TinCanConnectionManager();
 
   // Accessors
   const std::string fingerprint() const { return fingerprint_; }
@@ -108,8 +121,112 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
     forward_socket_ = socket;
   }
 
-  void set_trim_connection(bool trim) {
-    trim_enabled_ = trim;
+  // also prunes relay connections of links that found a direct path
+  void set_trim_connection(bool trim);
+
+  // when enabled candidates are signaled as they are gathered, the peer
+  // must accept additional batches in CreateConnections
+  void set_trickle(bool trickle) {
+    trickle_enabled_ = trickle;
+  }
+
+  // shared socket mode must be chosen before links are created, it only
+  // affects links created afterwards
+  void set_shared_socket(bool shared_socket, int port);
+
+  // ttl is in seconds, 0 disables the reflexive candidate cache
+  void set_candidate_cache_ttl(int ttl);
+
+  // in multipath mode each flow is sent over one of the writable
+  // connections of a link, weighted by rtt
+  void set_multipath(bool multipath);
+
+  // with path selection links send on their lowest rtt connection instead
+  // of the one libjingle ranks highest
+  void set_path_selection(bool path_selection);
+
+  // link parameters used when tincan sets up links by itself, a threshold
+  // of 0 leaves link setup to the controller
+  struct OnDemandPolicy {
+    OnDemandPolicy()
+        : threshold(0), window(0), overlay_id(1), sec_enabled(true) {}
+    // packets to one destination within window seconds
+    uint32 threshold;
+    uint32 window;
+    int overlay_id;
+    std::string stun_server;
+    std::string turn_server;
+    std::string turn_user;
+    std::string turn_pass;
+    bool sec_enabled;
+  };
+
+  void set_on_demand_policy(const OnDemandPolicy& policy);
+
+  // a route sends frames for uid over the link to next_hop instead of the
+  // controller, the next hop must have forwarding enabled and the
+  // destination must accept relayed frames with a route back through it
+  bool AddRoute(const std::string& uid, const std::string& next_hop);
+  bool DelRoute(const std::string& uid);
+
+  // with forwarding, frames received for other peers are relayed over
+  // their link or route, must be called after Setup
+  bool set_forwarding(bool forwarding);
+
+  // accepts frames for us whose source is not the peer of the link they
+  // arrived on, only when that link is the next hop of our route to the
+  // source, must be called after Setup
+  bool set_accept_relayed(bool accept_relayed);
+
+  // in switch mode ARP requests and neighbor solicitations from the tap
+  // are answered from a cache of peer addresses instead of being flooded
+  void set_neighbor_proxy(bool neighbor_proxy);
+
+  // broadcast and multicast frames from the tap are sent to every peer, or
+  // to the peers that joined the group, instead of the controller
+  void set_replication(bool replication);
+
+  // replaces the ACL applied to frames from the tap and from peers, the
+  // rules are compiled here and swapped in between two packets
+  void SetAcl(const std::vector<PacketClassifier::Rule>& rules,
+              bool default_allow);
+
+  // egress limits in kbit/s with a burst in bytes, a rate of 0 removes the
+  // limit. Without uid the limit is the default for every peer or, with
+  // global set, the one for all links together. Frames over the limit are
+  // queued for up to about 200 ms and paced out instead of being sent in a
+  // burst. Routed, relayed and replicated frames count against the link
+  // they leave on.
+  bool SetRateLimit(const std::string& uid, bool global, uint32 rate_kbps,
+                    uint32 burst);
+
+  // global and default limits and the totals of all peers
+  Json::Value GetRateLimitState();
+
+  // protects frames to the peer, or to every peer without uid, with XOR
+  // parity. The group size follows the loss the peer reports back. Only
+  // peers that advertised kFecCapability get protected frames.
+  bool SetFec(const std::string& uid, bool enabled);
+
+  // the directory is updated with the state of every link, it must
+  // outlive the manager
+  void set_peer_directory(PeerDirectory* peer_directory) {
+    peer_directory_ = peer_directory;
+  }
+
+  // links without data traffic for idle_timeout seconds are hibernated,
+  // 0 disables hibernation
+  void set_idle_timeout(int idle_timeout);
+
+  // format used to signal local candidates: "text", "binary" or "auto"
+  void set_candidate_format(const std::string& format);
+
+  // must be called before Setup, an empty path keeps the identity in memory
+  // only and a new one is generated on every start
+  void set_identity_options(const std::string& identity_file,
+                            const std::string& key_type) {
+    identity_file_ = identity_file;
+    key_type_ = KeyTypeFromString(key_type);
   }
 
   void set_network_ignore_list(
@@ -126,6 +243,8 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
   virtual void OnCandidatesReady(cricket::Transport* transport,
                                  const cricket::Candidates& candidates);
   virtual void OnCandidatesAllocationDone(cricket::Transport* transport);
+  virtual void OnRouteChange(cricket::Transport* transport, int component,
+                             const cricket::Candidate& remote_candidate);
   virtual void OnReadPacket(cricket::TransportChannel* channel, 
                             const char* data, size_t len,
                             const talk_base::PacketTime& ptime, int flags);
@@ -161,16 +280,57 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
 
   virtual bool DestroyTransport(const std::string& uid);
 
-  virtual Json::Value GetState(const std::map<std::string, uint32>& friends,
-                               bool get_stats);
+  // state of the peers in the directory that have been seen on XMPP
+  virtual Json::Value GetState(const PeerDirectory& peers, bool get_stats);
+
+  // per-phase link setup histograms across all links
+  Json::Value GetLinkStats(bool reset);
+
+  // signaling payload sizes per candidate format and remote parse time
+  Json::Value GetCodecStats(bool reset);
+
+  // hits and misses of the reflexive candidate cache
+  Json::Value GetCandidateCacheStats(bool reset);
+
+  // hibernation counters with the open fds and resident memory
+  Json::Value GetIdleStats(bool reset);
+
+  // number of in place restarts after underlay changes and how long the
+  // links took to switch to a new route
+  Json::Value GetRestartStats(bool reset);
+
+  // installed routes and frames sent and relayed through them
+  Json::Value GetRouteStats(bool reset);
+
+  // neighbor cache size and how many requests it answered
+  Json::Value GetNeighborStats(bool reset);
+
+  // replicated frames, copies sent and snooped group memberships
+  Json::Value GetReplicationStats(bool reset);
+
+  // ACL drops and per rule hit counters
+  Json::Value GetAclStats(bool reset);
 
+  // parity overhead, received and recovered frames, totals since start
+  Json::Value GetFecStats();
+
+  // links started by the on-demand policy and their time to come online
+  Json::Value GetOnDemandStats(bool reset);
+
+  // ipop-tap callbacks, they are forwarded to the manager of the process
   static int DoPacketSend(const char* buf, size_t len);
 
   static int DoPacketRecv(char* buf, size_t len);
 
-  static int SendToTap(const char* buf, size_t len);
+  // queues a frame read from the tap for the packet handling thread
+  int QueueFromTap(const char* buf, size_t len);
+
+  // blocks until a frame for the tap is available
+  int ReadForTap(char* buf, size_t len);
 
-  typedef cricket::DtlsTransport<cricket::P2PTransport> DtlsP2PTransport;
+  int SendToTap(const char* buf, size_t len);
+
+  typedef cricket::DtlsTransport<TinCanP2PTransport> DtlsP2PTransport;
 
   struct PeerState {
     int overlay_id;
@@ -178,14 +338,37 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
     std::string uid;
     std::string fingerprint;
     std::string connection_security;
-    talk_base::scoped_ptr<cricket::P2PTransport> transport;
+    std::string stun_server;
+    std::string turn_server;
+    std::string turn_user;
+    std::string turn_pass;
+    std::string local_ufrag;
+    std::string remote_ufrag;
+    talk_base::scoped_ptr<talk_base::PacketSocketFactory> socket_factory;
+    talk_base::scoped_ptr<TinCanP2PTransport> transport;
     talk_base::scoped_ptr<cricket::BasicPortAllocator> port_allocator;
     talk_base::scoped_ptr<talk_base::SSLFingerprint> remote_fingerprint;
     talk_base::scoped_ptr<cricket::TransportDescription> local_description;
     talk_base::scoped_ptr<cricket::TransportDescription> remote_description;
     cricket::P2PTransportChannel* channel;
     cricket::Candidates candidates;
-    std::set<std::string> candidate_list;
+    // local candidates by their text encoding
+    std::map<std::string, cricket::Candidate> candidate_list;
+    std::set<std::string> sent_candidates;
+    bool con_resp_sent;
+    // true once the peer signaled a binary candidate batch
+    bool binary_candidates;
+    // true once the peer signaled kFecCapability
+    bool fec_capable;
+    // data byte count at the last idle check and when it last changed
+    uint64 idle_bytes;
+    uint32 idle_since;
+    // when the last network change restarted the link, 0 once it switched
+    // to a new route
+    uint32 restart_time;
+    // when traffic triggered an on-demand link, 0 once it is online
+    uint32 on_demand_time;
+    LinkTimes times;
     ~PeerState() {
       transport.reset();
       port_allocator.reset();
@@ -200,25 +383,193 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
   typedef talk_base::scoped_refptr<
       talk_base::RefCountedObject<PeerState> > PeerStatePtr;
 
+  // what is kept of a hibernated link to bring it back
+  struct HibernatedPeer {
+    std::string fingerprint;
+    int overlay_id;
+    std::string stun_server;
+    std::string turn_server;
+    std::string turn_user;
+    std::string turn_pass;
+    bool sec_enabled;
+    uint32 time;
+    // when the con_req of a revival went out, 0 if none is in progress
+    uint32 revive_time;
+  };
+
+  struct DemandCounter {
+    DemandCounter() : count(0), start(0) {}
+    uint32 count;
+    uint32 start;
+  };
+
+  struct RouteStats {
+    RouteStats()
+        : routed(0), relayed(0), relayed_bytes(0), delivered(0), dropped(0),
+          rejected(0), expired(0) {}
+    // local frames sent through a next hop
+    uint32 routed;
+    uint32 relayed;
+    uint64 relayed_bytes;
+    // relayed frames for us
+    uint32 delivered;
+    uint32 dropped;
+    // relayed frames for us that did not come from the next hop
+    uint32 rejected;
+    // dropped frames that ran out of hop limit or had none
+    uint32 expired;
+  };
+
+  struct ReplicationStats {
+    ReplicationStats()
+        : frames(0), copies(0), floods(0), forwarded(0), groups(0), joins(0),
+          leaves(0) {}
+    uint32 frames;
+    uint32 copies;
+    // frames sent to every peer, no group members were known
+    uint32 floods;
+    // frames also sent to the controller for peers without a direct link
+    uint32 forwarded;
+    uint32 groups;
+    uint32 joins;
+    uint32 leaves;
+  };
+
+  // egress limit of one peer, frames over it wait in the queue
+  struct PeerShaper {
+    PeerShaper() : queued_bytes(0), sent(0), delayed(0), dropped(0) {}
+    TokenBucket bucket;
+    std::deque<talk_base::Buffer*> queue;
+    size_t queued_bytes;
+    uint32 sent;
+    uint32 delayed;
+    uint32 dropped;
+  };
+
+  struct FecReceiver {
+    FecReceiver() : feedback_time(0) {}
+    FecDecoder decoder;
+    uint32 feedback_time;
+  };
+
+  struct CodecStats {
+    CodecStats()
+        : text_messages(0), text_candidates(0), text_bytes(0),
+          binary_messages(0), binary_candidates(0), binary_bytes(0),
+          parsed(0), parse_ns(0) {}
+    uint32 text_messages;
+    uint32 text_candidates;
+    uint64 text_bytes;
+    uint32 binary_messages;
+    uint32 binary_candidates;
+    uint64 binary_bytes;
+    uint32 parsed;
+    uint64 parse_ns;
+  };
+
  private:
   void HandleConnectionSignal(cricket::Port* port,
                               cricket::Connection* connection);
   void SetupTransport(PeerState* peer_state);
+  void SendCandidates(PeerState* peer_state, bool allocation_done);
+  void RecordOnline(PeerState* peer_state);
+  void OnChannelWritable_w(cricket::TransportChannel* channel);
+  void RecordPhase(cricket::TransportChannel* channel, uint32 time);
+  PeerStatePtr RemoveTransport(const std::string& uid);
+  void AddRemoteCandidate(PeerState* peer_state,
+                          const cricket::Candidate& candidate,
+                          cricket::Candidates* new_candidates);
+  void CheckIdle();
+  void Hibernate(const std::string& uid);
+  void Revive(const std::string& uid);
+  void CompleteRevive(const std::string& uid, const std::string& data);
+  bool DropHibernated(const std::string& uid);
+  void InsertHibernated_w(const std::string sub_uid, const std::string uid);
+  void DeleteHibernated_w(const std::string sub_uid);
+  bool WakePeer_w(const std::string& sub_uid);
+  void HandleNetworkChange(const std::set<std::string>& removed);
+  void EndRestart(PeerState* peer_state, bool recovered);
+  void CheckRestarts();
+  void RestartChannels_w(const std::set<std::string>* removed,
+                         std::vector<std::string>* restarted);
+  void StartOnDemand(const std::string& uid);
+  void ExpireOnDemand();
+  bool CreateOnDemandLink(const std::string& uid, const std::string& fpr,
+                          uint32 trigger_time);
+  void HandleOnDemandSignal(const std::string& uid, const std::string& data,
+                            const std::string& type);
+  void SetDemandThreshold_w(uint32 threshold, uint32 window);
+  void CountDemand_w(const std::string& sub_uid, const char* dest_uid);
+  void SetRoute_w(const std::string sub_uid, const std::string next_hop);
+  void SetForwarding_w(bool forwarding, bool accept_relayed,
+                       const std::string local_sub_uid);
+  bool FromNextHop_w(const std::string& source,
+                     cricket::TransportChannel* channel);
+  void GetRouteStats_w(RouteStats* stats, bool reset);
+  bool RelayFrame_w(const std::string& sub_uid,
+                    cricket::TransportChannel* in_channel,
+                    const char* data, size_t len);
+  bool SendRouted_w(const std::string& sub_uid,
+                    cricket::TransportChannel* in_channel,
+                    const char* data, size_t len);
+  void SetNeighborProxy_w(bool neighbor_proxy);
+  void AddNeighbor_w(const std::string ip, const std::string uid);
+  void GetNeighborStats_w(NeighborCache::Stats* stats, size_t* size,
+                          bool reset);
+  void SetReplication_w(bool replication);
+  bool Replicate_w(const char* data, size_t len);
+  bool SendDirect_w(const std::string& sub_uid, cricket::Transport* transport,
+                    int component, const char* data, size_t len);
+  void GetReplicationStats_w(ReplicationStats* stats, bool reset);
+  PacketClassifier* SwapClassifier_w(PacketClassifier* classifier);
+  void GetAclStats_w(Json::Value* stats, bool reset);
+  void SetRateLimit_w(const std::string sub_uid, bool global, uint32 rate,
+                      uint32 burst);
+  PeerShaper& Shaper_w(const std::string& sub_uid);
+  void ConfigureShaper_w(const std::string& sub_uid, PeerShaper* shaper);
+  void DropShaper_w(const std::string& sub_uid);
+  void SendShaped_w(const std::string& sub_uid,
+                    cricket::TransportChannelImpl* channel,
+                    const char* data, size_t len);
+  void SchedulePace_w(uint64 wait);
+  void Pace_w();
+  void GetRateLimitState_w(Json::Value* state);
+  void GetShaperState_w(const std::string sub_uid, Json::Value* state);
+  void SetFec_w(const std::string sub_uid, bool enabled);
+  void SetFecCapable_w(const std::string sub_uid);
+  void SendFrame_w(const std::string& sub_uid,
+                   cricket::TransportChannelImpl* channel,
+                   const char* data, size_t len);
+  void FlushFec_w();
+  void ReadFrame_w(cricket::TransportChannel* channel, const char* data,
+                   size_t len);
+  void HandleFec_w(cricket::TransportChannel* channel, const char* data,
+                   size_t len);
+  void GetFecStats_w(Json::Value* stats);
+  void SetLinkState(const std::string& uid, LinkState state);
+  void UpdatePathPolicy();
+  void SetPathPolicy_w(bool multipath, bool path_selection, bool prune_relay);
+  void GetPathInfo_w(const std::string& uid, std::string* preferred,
+                     uint32* switches);
+  void DeleteRestarting_w(const std::string sub_uid);
   void HandleQueueSignal_w();
   void HandleControllerSignal_w();
   void InsertTransportMap_w(const std::string sub_uid,
                             cricket::Transport* transport);
   void DeleteTransportMap_w(const std::string sub_uid);
-  Json::Value StateToJson(const std::string& uid, uint32 xmpp_time,
+  Json::Value StateToJson(const std::string& uid, const PeerRecord& record,
                           bool get_stats);
   bool SetRelay(PeerState* peer_state, const std::string& turn_server,
                 const std::string& username, const std::string& password);
+  void GetDataBytes_w(const std::vector<std::string>* uids,
+                      std::vector<uint64>* counters);
   void GetChannelStats_w(const std::string &uid,
                          cricket::ConnectionInfos *infos);
   bool is_icc(const unsigned char * buf);
 
   const std::string content_name_;
   PeerSignalSenderInterface* signal_sender_;
+  PeerDirectory* peer_directory_;
   talk_base::BasicPacketSocketFactory packet_factory_;
   std::map<std::string, PeerStatePtr> uid_map_;
   std::map<std::string, cricket::Transport*> short_uid_map_;
@@ -229,6 +580,11 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
   talk_base::BasicNetworkManager network_manager_;
   std::string tincan_id_;
   talk_base::scoped_ptr<talk_base::SSLIdentity> identity_;
+  std::string identity_file_;
+  IdentityKeyType key_type_;
+  // used to report the time from Setup until the first link is online
+  uint32 setup_time_;
+  bool first_link_online_;
   talk_base::scoped_ptr<talk_base::SSLFingerprint> local_fingerprint_;
   std::string fingerprint_;
   const uint64 tiebreaker_;
@@ -239,7 +595,89 @@ class TinCanConnectionManager : public talk_base::MessageHandler,
   talk_base::SocketAddress forward_addr_;
   talk_base::PacketOptions packet_options_;
   bool trim_enabled_;
+  bool shared_socket_enabled_;
+  talk_base::scoped_ptr<SharedSocketPool> shared_socket_pool_;
+  CandidateCache candidate_cache_;
+  bool trickle_enabled_;
+  LinkSetupStats link_stats_;
+  // channels whose writable signal marks a setup phase, the ICE channel
+  // and for secure links the DTLS channel on top of it
+  std::map<cricket::TransportChannel*,
+           std::pair<std::string, LinkPhase> > phase_channels_;
+  CandidateFormat candidate_format_;
+  CodecStats codec_stats_;
+  uint32 idle_timeout_;
+  bool idle_check_scheduled_;
+  std::map<std::string, HibernatedPeer> hibernated_;
+  // short uid to uid of hibernated peers, only used on the packet thread
+  std::map<std::string, std::string> hibernated_short_map_;
+  uint32 hibernations_;
+  uint32 revivals_;
+  // underlay addresses seen by the last network update, packet thread only
+  std::set<std::string> underlay_ips_;
+  // short uids of restarting links, only used on the packet thread
+  std::set<std::string> restarting_short_set_;
+  uint32 restarts_;
+  uint32 recoveries_;
+  uint32 recover_time_sum_;
+  uint32 recover_time_max_;
+  bool multipath_enabled_;
+  bool path_selection_enabled_;
+  OnDemandPolicy on_demand_;
+  // uid to time of the con_req we sent for it, entries older than the
+  // holdoff are dropped
+  std::map<std::string, uint32> on_demand_pending_;
+  // per destination packet counts, only used on the packet thread
+  std::map<std::string, DemandCounter> demand_map_;
+  uint32 on_demand_threshold_w_;
+  uint32 on_demand_window_w_;
+  uint32 on_demand_started_;
+  uint32 on_demand_links_;
+  uint32 on_demand_online_;
+  uint32 on_demand_time_sum_;
+  uint32 on_demand_time_max_;
+  // uid to next hop uid
+  std::map<std::string, std::string> routes_;
+  bool forwarding_enabled_;
+  bool accept_relayed_enabled_;
+  // short uid to short next hop uid, only used on the packet thread
+  std::map<std::string, std::string> route_map_w_;
+  bool forwarding_w_;
+  bool accept_relayed_w_;
+  std::string local_short_w_;
+  RouteStats route_stats_w_;
+  bool neighbor_proxy_enabled_;
+  // only used on the packet thread
+  bool neighbor_proxy_w_;
+  NeighborCache neighbor_cache_;
+  bool replication_enabled_;
+  // only used on the packet thread
+  bool replication_w_;
+  GroupTable group_table_;
+  ReplicationStats replication_stats_w_;
+  // only used on the packet thread, NULL when there is no ACL
+  talk_base::scoped_ptr<PacketClassifier> classifier_w_;
+  uint32 acl_drops_w_[2];
+  // egress shaping, only used on the packet thread
+  bool shaping_w_;
+  bool pace_scheduled_w_;
+  TokenBucket global_bucket_w_;
+  TokenBucket peer_default_w_;
+  // short uid to (rate, burst) of peers with their own limit
+  std::map<std::string, std::pair<uint32, uint32> > rate_overrides_w_;
+  std::map<std::string, PeerShaper> shapers_w_;
+  // forward error correction, only used on the packet thread
+  bool fec_all_w_;
+  bool fec_flush_scheduled_w_;
+  std::set<std::string> fec_peers_w_;
+  // peers that decode FEC
+  std::set<std::string> fec_capable_w_;
+  std::map<std::string, FecEncoder> fec_encoders_w_;
+  std::map<cricket::TransportChannel*, FecReceiver> fec_receivers_w_;
   thread_opts_t* opts_;
+  // frames between ipop-tap and the packet handling thread
+  wqueue<talk_base::Buffer*> recv_queue_;
+  wqueue<talk_base::Buffer*> send_queue_;
 };
 
 }  // namespace tincan
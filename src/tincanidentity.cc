@@ -0,0 +1,289 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include <fstream>
+#include <sstream>
+
+#if defined(LINUX) || defined(ANDROID)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(SSL_USE_OPENSSL)
+#include <openssl/bio.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#endif
+
+#include "talk/base/logging.h"
+
+#include "tincan_utils.h"
+#include "tincanidentity.h"
+
+namespace tincan {
+
+static const char kEcdsa[] = "ecdsa";
+static const char kCertBegin[] = "-----BEGIN CERTIFICATE-----";
+
+#if defined(SSL_USE_OPENSSL)
+// same key size as the identities generated by libjingle
+static const int kRsaKeyBits = 1024;
+// certificates are valid from a day ago to allow for clock skew
+static const long kCertificateWindow = -60 * 60 * 24;
+// persisted certificates are valid for a year and regenerated afterwards
+static const long kCertificateLifetime = 60 * 60 * 24 * 365;
+static const int kSerialBytes = 8;
+static const int kCommonNameLen = 256;
+#endif
+
+IdentityKeyType KeyTypeFromString(const std::string& key_type) {
+  return key_type == kEcdsa ? KEY_ECDSA : KEY_RSA;
+}
+
+#if defined(SSL_USE_OPENSSL)
+static EVP_PKEY* MakeKey(IdentityKeyType key_type) {
+  EVP_PKEY* pkey = EVP_PKEY_new();
+  if (pkey == NULL) return NULL;
+  if (key_type == KEY_ECDSA) {
+    EC_KEY* ec_key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    if (ec_key == NULL || !EC_KEY_generate_key(ec_key)) {
+      EC_KEY_free(ec_key);
+      EVP_PKEY_free(pkey);
+      return NULL;
+    }
+    // the curve is written by name so that peers can parse the certificate
+    EC_KEY_set_asn1_flag(ec_key, OPENSSL_EC_NAMED_CURVE);
+    EVP_PKEY_assign_EC_KEY(pkey, ec_key);
+  }
+  else {
+    BIGNUM* exponent = BN_new();
+    RSA* rsa = RSA_new();
+    if (exponent == NULL || rsa == NULL || !BN_set_word(exponent, RSA_F4) ||
+        !RSA_generate_key_ex(rsa, kRsaKeyBits, exponent, NULL)) {
+      BN_free(exponent);
+      RSA_free(rsa);
+      EVP_PKEY_free(pkey);
+      return NULL;
+    }
+    BN_free(exponent);
+    EVP_PKEY_assign_RSA(pkey, rsa);
+  }
+  return pkey;
+}
+
+static X509* MakeCertificate(EVP_PKEY* pkey, const std::string& common_name) {
+  X509* x509 = X509_new();
+  if (x509 == NULL) return NULL;
+  unsigned char serial[kSerialBytes];
+  RAND_bytes(serial, sizeof(serial));
+  BIGNUM* serial_bn = BN_bin2bn(serial, sizeof(serial), NULL);
+  X509_NAME* name = X509_get_subject_name(x509);
+  bool ok = serial_bn != NULL &&
+      X509_set_version(x509, 2) &&
+      BN_to_ASN1_INTEGER(serial_bn, X509_get_serialNumber(x509)) &&
+      X509_gmtime_adj(X509_get_notBefore(x509), kCertificateWindow) &&
+      X509_gmtime_adj(X509_get_notAfter(x509), kCertificateLifetime) &&
+      X509_set_pubkey(x509, pkey) &&
+      X509_NAME_add_entry_by_NID(name, NID_commonName, MBSTRING_UTF8,
+          (unsigned char*) common_name.c_str(), -1, -1, 0) &&
+      X509_set_issuer_name(x509, name) &&
+      X509_sign(x509, pkey, EVP_sha256());
+  BN_free(serial_bn);
+  if (!ok) {
+    X509_free(x509);
+    return NULL;
+  }
+  return x509;
+}
+
+static std::string BioToString(BIO* bio) {
+  char* data = NULL;
+  long len = BIO_get_mem_data(bio, &data);
+  return std::string(data, len);
+}
+
+static bool GeneratePEM(const std::string& common_name,
+                        IdentityKeyType key_type, std::string* key_pem,
+                        std::string* cert_pem) {
+  EVP_PKEY* pkey = MakeKey(key_type);
+  if (pkey == NULL) return false;
+  X509* x509 = MakeCertificate(pkey, common_name);
+  if (x509 == NULL) {
+    EVP_PKEY_free(pkey);
+    return false;
+  }
+  BIO* key_bio = BIO_new(BIO_s_mem());
+  BIO* cert_bio = BIO_new(BIO_s_mem());
+  bool ok = key_bio != NULL && cert_bio != NULL &&
+      PEM_write_bio_PrivateKey(key_bio, pkey, NULL, NULL, 0, NULL, NULL) &&
+      PEM_write_bio_X509(cert_bio, x509);
+  if (ok) {
+    *key_pem = BioToString(key_bio);
+    *cert_pem = BioToString(cert_bio);
+  }
+  BIO_free(key_bio);
+  BIO_free(cert_bio);
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+  return ok;
+}
+
+// a stored certificate is reused only if it was issued for this uid, has
+// not expired yet and holds a key of the configured type
+static bool IsUsableCertificate(const std::string& cert_pem,
+                                const std::string& common_name,
+                                IdentityKeyType key_type) {
+  BIO* bio = BIO_new_mem_buf(const_cast<char*>(cert_pem.c_str()),
+                             cert_pem.size());
+  if (bio == NULL) return false;
+  X509* x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+  BIO_free(bio);
+  if (x509 == NULL) return false;
+  char cn[kCommonNameLen] = { '\0' };
+  X509_NAME_get_text_by_NID(X509_get_subject_name(x509), NID_commonName,
+                            cn, sizeof(cn));
+  EVP_PKEY* pkey = X509_get_pubkey(x509);
+  int pkey_type = key_type == KEY_ECDSA ? EVP_PKEY_EC : EVP_PKEY_RSA;
+  bool usable = common_name == cn &&
+                X509_cmp_current_time(X509_get_notAfter(x509)) > 0 &&
+                pkey != NULL && EVP_PKEY_id(pkey) == pkey_type;
+  EVP_PKEY_free(pkey);
+  X509_free(x509);
+  return usable;
+}
+#else
+static bool GeneratePEM(const std::string& common_name,
+                        IdentityKeyType key_type, std::string* key_pem,
+                        std::string* cert_pem) {
+  return false;
+}
+
+static bool IsUsableCertificate(const std::string& cert_pem,
+                                const std::string& common_name,
+                                IdentityKeyType key_type) {
+  return true;
+}
+#endif  // defined(SSL_USE_OPENSSL)
+
+static bool ReadFile(const std::string& path, std::string* contents) {
+#if defined(LINUX) || defined(ANDROID)
+  // the identity is read through a read-only mapping, this avoids stdio
+  // buffering on the startup path
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+  contents->assign(static_cast<const char*>(mapped), st.st_size);
+  munmap(mapped, st.st_size);
+  return true;
+#else
+  std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+  if (!file) return false;
+  std::ostringstream oss;
+  oss << file.rdbuf();
+  *contents = oss.str();
+  return !contents->empty();
+#endif
+}
+
+static bool WriteFile(const std::string& path, const std::string& contents) {
+#if defined(LINUX) || defined(ANDROID)
+  // the file holds our private key so only the owner may read it
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return false;
+  ssize_t written = write(fd, contents.c_str(), contents.size());
+  close(fd);
+  return written == static_cast<ssize_t>(contents.size());
+#else
+  std::ofstream file(path.c_str(), std::ios::out | std::ios::binary);
+  if (!file) return false;
+  file << contents;
+  return file.good();
+#endif
+}
+
+// libjingle only generates RSA identities, a requested ECDSA key is lost
+// when this fallback is taken
+static talk_base::SSLIdentity* GenerateFallback(
+    const std::string& common_name, IdentityKeyType key_type) {
+  if (key_type == KEY_ECDSA) {
+    LOG_TS(LERROR) << "IDENTITY ECDSA key not available, using RSA";
+  }
+  return talk_base::SSLIdentity::Generate(common_name);
+}
+
+talk_base::SSLIdentity* GenerateIdentity(const std::string& common_name,
+                                         IdentityKeyType key_type) {
+  std::string key_pem, cert_pem;
+  if (!GeneratePEM(common_name, key_type, &key_pem, &cert_pem)) {
+    return GenerateFallback(common_name, key_type);
+  }
+  return talk_base::SSLIdentity::FromPEMStrings(key_pem, cert_pem);
+}
+
+talk_base::SSLIdentity* LoadOrCreateIdentity(const std::string& path,
+                                             const std::string& common_name,
+                                             IdentityKeyType key_type) {
+  std::string contents;
+  if (ReadFile(path, &contents)) {
+    size_t cert_pos = contents.find(kCertBegin);
+    if (cert_pos != std::string::npos) {
+      std::string key_pem = contents.substr(0, cert_pos);
+      std::string cert_pem = contents.substr(cert_pos);
+      if (IsUsableCertificate(cert_pem, common_name, key_type)) {
+        talk_base::SSLIdentity* identity =
+            talk_base::SSLIdentity::FromPEMStrings(key_pem, cert_pem);
+        if (identity != NULL) {
+          LOG_TS(INFO) << "IDENTITY loaded from " << path;
+          return identity;
+        }
+      }
+    }
+    LOG_TS(INFO) << "IDENTITY in " << path << " is not usable, regenerating";
+  }
+
+  std::string key_pem, cert_pem;
+  if (!GeneratePEM(common_name, key_type, &key_pem, &cert_pem)) {
+    LOG_TS(LERROR) << "IDENTITY generation failed";
+    return GenerateFallback(common_name, key_type);
+  }
+  if (!WriteFile(path, key_pem + cert_pem)) {
+    LOG_TS(LERROR) << "IDENTITY could not be stored in " << path;
+  }
+  return talk_base::SSLIdentity::FromPEMStrings(key_pem, cert_pem);
+}
+
+}  // namespace tincan
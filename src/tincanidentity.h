@@ -0,0 +1,58 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_TINCANIDENTITY_H_
+#define TINCAN_TINCANIDENTITY_H_
+#pragma once
+
+#include <string>
+
+#include "talk/base/sslidentity.h"
+
+namespace tincan {
+
+enum IdentityKeyType {
+  KEY_RSA = 0,
+  KEY_ECDSA = 1,
+};
+
+// Returns KEY_ECDSA for "ecdsa" and KEY_RSA for anything else
+IdentityKeyType KeyTypeFromString(const std::string& key_type);
+
+// Creates a self-signed identity, ECDSA P-256 keys are much cheaper to
+// generate than RSA keys which matters on small ARM nodes
+talk_base::SSLIdentity* GenerateIdentity(const std::string& common_name,
+                                         IdentityKeyType key_type);
+
+// Loads the identity stored at path, or creates one and stores it there
+// when the file is missing, expired, was issued for another uid or holds a
+// key of another type. The file holds the PEM private key followed by the
+// PEM certificate. Keeping the identity across restarts keeps our
+// fingerprint stable for the peers.
+talk_base::SSLIdentity* LoadOrCreateIdentity(const std::string& path,
+                                             const std::string& common_name,
+                                             IdentityKeyType key_type);
+
+}  // namespace tincan
+
+#endif  // TINCAN_TINCANIDENTITY_H_
@@ -0,0 +1,66 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "tokenbucket.h"
+
+namespace tincan {
+
+// a full ipop frame, a smaller burst would never let it through
+static const uint32 kMinBurst = 1600;
+static const double kMicrosPerSecond = 1000000.0;
+
+TokenBucket::TokenBucket()
+    : rate_(0),
+      burst_(0),
+      tokens_(0),
+      last_(0) {
+}
+
+void TokenBucket::Configure(uint32 rate, uint32 burst) {
+  rate_ = rate;
+  burst_ = burst < kMinBurst ? kMinBurst : burst;
+  // a new limit starts with a full bucket
+  tokens_ = burst_;
+  last_ = 0;
+}
+
+bool TokenBucket::Ready(size_t len, uint64 now) {
+  if (rate_ == 0) return true;
+  if (last_ != 0 && now > last_) {
+    tokens_ += (now - last_) * rate_ / kMicrosPerSecond;
+    if (tokens_ > burst_) tokens_ = burst_;
+  }
+  last_ = now;
+  return tokens_ >= len;
+}
+
+void TokenBucket::Take(size_t len) {
+  if (rate_ != 0) tokens_ -= len;
+}
+
+uint64 TokenBucket::Wait(size_t len) const {
+  if (rate_ == 0 || tokens_ >= len) return 0;
+  return static_cast<uint64>((len - tokens_) * kMicrosPerSecond / rate_) + 1;
+}
+
+}  // namespace tincan
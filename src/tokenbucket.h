@@ -0,0 +1,62 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#ifndef TINCAN_TOKENBUCKET_H_
+#define TINCAN_TOKENBUCKET_H_
+#pragma once
+
+#include "talk/base/basictypes.h"
+
+namespace tincan {
+
+// TokenBucket limits a byte rate while allowing bursts up to its depth.
+// Times are in microseconds.
+class TokenBucket {
+ public:
+  TokenBucket();
+
+  // rate is in bytes per second, a rate of 0 removes the limit, the burst
+  // is raised to fit at least one full frame
+  void Configure(uint32 rate, uint32 burst);
+
+  uint32 rate() const { return rate_; }
+  uint32 burst() const { return burst_; }
+  bool limited() const { return rate_ > 0; }
+
+  // refills the bucket and returns true if len bytes can be sent now
+  bool Ready(size_t len, uint64 now);
+  void Take(size_t len);
+
+  // time until len bytes are available, valid after Ready returned false
+  uint64 Wait(size_t len) const;
+
+ private:
+  uint32 rate_;
+  uint32 burst_;
+  double tokens_;
+  uint64 last_;
+};
+
+}  // namespace tincan
+
+#endif  // TINCAN_TOKENBUCKET_H_
@@ -0,0 +1,90 @@
+/*
+ * ipop-tincan
+ * Copyright 2015, University of Florida
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+*/
+
+#include "talk/base/gunit.h"
+
+#include "tokenbucket.h"
+
+namespace tincan {
+
+// times are in microseconds and must not be 0, which marks a fresh bucket
+static const uint64 kStart = 1000000;
+
+TEST(TokenBucketTest, UnlimitedByDefault) {
+  TokenBucket bucket;
+  EXPECT_FALSE(bucket.limited());
+  EXPECT_TRUE(bucket.Ready(1000000, kStart));
+  bucket.Take(1000000);
+  EXPECT_TRUE(bucket.Ready(1000000, kStart));
+  EXPECT_EQ(0U, bucket.Wait(1000000));
+}
+
+TEST(TokenBucketTest, BurstThenRate) {
+  TokenBucket bucket;
+  // 100 KB/s with a 10 KB burst
+  bucket.Configure(100000, 10000);
+  ASSERT_TRUE(bucket.limited());
+  uint32 sent = 0;
+  while (bucket.Ready(1000, kStart)) {
+    bucket.Take(1000);
+    sent += 1000;
+  }
+  EXPECT_EQ(10000U, sent);
+  // 1000 bytes take 10 ms at this rate
+  EXPECT_NEAR(10000.0, static_cast<double>(bucket.Wait(1000)), 2.0);
+  EXPECT_FALSE(bucket.Ready(1000, kStart + 5000));
+  EXPECT_TRUE(bucket.Ready(1000, kStart + 10001));
+
+  // over one second the bucket passes the rate plus its burst
+  bucket.Configure(100000, 10000);
+  sent = 0;
+  for (uint64 now = kStart; now <= kStart + 1000000; now += 1000) {
+    while (bucket.Ready(500, now)) {
+      bucket.Take(500);
+      sent += 500;
+    }
+  }
+  EXPECT_NEAR(110000.0, static_cast<double>(sent), 1000.0);
+}
+
+TEST(TokenBucketTest, BurstIsCapped) {
+  TokenBucket bucket;
+  bucket.Configure(100000, 10000);
+  bucket.Ready(0, kStart);
+  bucket.Take(10000);
+  // an idle minute refills only up to the burst
+  EXPECT_TRUE(bucket.Ready(10000, kStart + 60000000));
+  bucket.Take(10000);
+  EXPECT_FALSE(bucket.Ready(1, kStart + 60000000));
+}
+
+TEST(TokenBucketTest, MinimumBurstFitsAFrame) {
+  TokenBucket bucket;
+  bucket.Configure(1000, 1);
+  EXPECT_LE(1500U, bucket.burst());
+  EXPECT_TRUE(bucket.Ready(1500, kStart));
+  bucket.Configure(0, 0);
+  EXPECT_FALSE(bucket.limited());
+}
+
+}  // namespace tincan
@@ -21,9 +21,12 @@
  * THE SOFTWARE.
 */
 
+#include <algorithm>
 #include <string>
 
+#include "talk/base/helpers.h"
 #include "talk/base/thread.h"
+#include "talk/base/timeutils.h"
 #include "talk/xmpp/constants.h"
 #include "talk/xmpp/xmppclientsettings.h"
 #include "talk/xmpp/xmppthread.h"
@@ -31,6 +34,7 @@
 #include "talk/xmpp/jid.h"
 #include "talk/xmpp/constants.h"
 
+#include "signalcompression.h"
 #include "tincan_utils.h"
 #include "xmppnetwork.h"
 
@@ -44,16 +48,44 @@ static const int kPingTimeout = 5000;
 static const int kInterval = 15000;
 // this constant sets how often presense message is sent (sec)
 static const int kPresenceInterval = 120;
+// messages queued within this window (ms) are sent together
+static const int kBatchDelay = 20;
+// a batch is closed once its data reaches this size, XMPP servers limit
+// the size of a stanza
+static const size_t kMaxBatchBytes = 16 * 1024;
+
+// reconnects start after this delay (ms), it doubles with every failed
+// attempt up to kMaxReconnectDelay
+static const int kMinReconnectDelay = 500;
+static const int kMaxReconnectDelay = 30000;
+static const int kMaxBackoffShift = 6;
+// a stream that stayed open this long (ms) resets the backoff, one that
+// drops right after login keeps backing off
+static const uint32 kStableStreamTime = 60000;
+
+// enumeration used by OnMessage function
+enum {
+  MSG_CHECKSTATE = 0,
+  MSG_FLUSH = 1,
+  MSG_ENABLESM = 2,
+  MSG_RECONNECT = 3,
+  MSG_DISCONNECT = 4,
+  MSG_REPLAY = 5,
+};
 
 static const buzz::StaticQName QN_TINCAN = { "jabber:iq:tincan", "query" };
 static const buzz::StaticQName QN_TINCAN_DATA = { "jabber:iq:tincan", "data" };
 static const buzz::StaticQName QN_TINCAN_TYPE = { "jabber:iq:tincan", "type" };
+static const buzz::StaticQName QN_TINCAN_VERSION = { "", "v" };
+// queries with this version may carry several data and type pairs
+static const char kBatchVersion[] = "2";
+// set on queries of peers that inflate data bodies marked enc="z"
+static const buzz::StaticQName QN_TINCAN_ZLIB = { "", "z" };
+static const buzz::StaticQName QN_TINCAN_ENC = { "", "enc" };
+static const char kZlibEncoding[] = "z";
 static const char kTemplate[] = "<query xmlns=\"jabber:iq:tincan\" />";
 static const char kErrorMsg[] = "error";
 
-// TODO - we should not be storing in global map, need to move to a class
-static std::map<std::string, std::string> g_uid_map;
-
 static std::string get_key(const std::string& uid) {
   size_t idx = uid.find('/') + sizeof(kXmppPrefix);
   if ((idx + kIdSize) <= uid.size()) {
@@ -63,36 +95,78 @@ static std::string get_key(const std::string& uid) {
 }
 
 TinCanTask::TinCanTask(buzz::XmppClient* client,
-                       PeerHandlerInterface* handler)
+                       PeerHandlerInterface* handler,
+                       SignalingStats* stats,
+                       StreamManagement* sm,
+                       PeerDirectory* directory)
   : XmppTask(client, buzz::XmppEngine::HL_TYPE),
-    handler_(handler) {
+    handler_(handler),
+    stats_(stats),
+    sm_(sm),
+    directory_(directory) {
+  // the template is parsed once, every stanza gets a copy of it
+  std::string templ(kTemplate);
+  query_proto_.reset(buzz::XmlElement::ForStr(templ));
+  query_proto_->AddAttr(QN_TINCAN_VERSION, kBatchVersion);
+  query_proto_->AddAttr(QN_TINCAN_ZLIB, "1");
 }
 
 void TinCanTask::SendToPeer(int overlay_id, const std::string &uid,
                             const std::string &data,
                             const std::string &type) {
-  if (g_uid_map.find(uid) == g_uid_map.end()) return;
-  const buzz::Jid to(g_uid_map[uid]);
-  talk_base::scoped_ptr<buzz::XmlElement> get(
-      MakeIq(buzz::STR_GET, to, task_id()));
-  // TODO - Figure out how to build from QN_TINCAN instead of template
-  std::string templ(kTemplate);
-  buzz::XmlElement* element = buzz::XmlElement::ForStr(templ);
-  //buzz::XmlElement* element = new buzz::XmlElement(QN_TINCAN);
-  buzz::XmlElement* data_xe = new buzz::XmlElement(QN_TINCAN_DATA);
-  buzz::XmlElement* type_xe = new buzz::XmlElement(QN_TINCAN_TYPE);
-
-  data_xe->SetBodyText(data);
-  type_xe->SetBodyText(type);
-  element->AddElement(data_xe);
-  element->AddElement(type_xe);
-
-  get->AddElement(element);
-  SendStanza(get.get());
+  const PeerRecord* peer = directory_->Find(uid);
+  if (peer == NULL || peer->jid.empty()) return;
+  pending_[peer->jid].push_back(std::make_pair(data, type));
+  stats_->messages_sent++;
   LOG_TS(INFO) << "XMPP SEND uid " << uid << " data " << data
                << " type " << type;
 }
 
+void TinCanTask::Flush() {
+  uint64 start = talk_base::TimeNanos();
+  for (std::map<std::string, MessageList>::iterator it = pending_.begin();
+       it != pending_.end(); ++it) {
+    const buzz::Jid to(it->first);
+    bool batch = batch_peers_.find(it->first) != batch_peers_.end();
+    bool zlib = zlib_peers_.find(it->first) != zlib_peers_.end();
+    const MessageList& messages = it->second;
+    size_t i = 0;
+    while (i < messages.size()) {
+      talk_base::scoped_ptr<buzz::XmlElement> get(
+          MakeIq(buzz::STR_GET, to, task_id()));
+      buzz::XmlElement* element = new buzz::XmlElement(*query_proto_);
+      size_t bytes = 0;
+      do {
+        buzz::XmlElement* data_xe = new buzz::XmlElement(QN_TINCAN_DATA);
+        buzz::XmlElement* type_xe = new buzz::XmlElement(QN_TINCAN_TYPE);
+        std::string compressed;
+        if (zlib && CompressBody(messages[i].first, &compressed)) {
+          data_xe->AddAttr(QN_TINCAN_ENC, kZlibEncoding);
+          data_xe->SetBodyText(compressed);
+          stats_->compressed++;
+          stats_->data_bytes_sent += compressed.size();
+        }
+        else {
+          data_xe->SetBodyText(messages[i].first);
+          stats_->data_bytes_sent += messages[i].first.size();
+        }
+        stats_->data_bytes += messages[i].first.size();
+        type_xe->SetBodyText(messages[i].second);
+        element->AddElement(data_xe);
+        element->AddElement(type_xe);
+        bytes += messages[i].first.size();
+        i++;
+      } while (batch && i < messages.size() && bytes < kMaxBatchBytes);
+      get->AddElement(element);
+      SendStanza(get.get());
+      if (sm_ != NULL) sm_->Track(get.get());
+      stats_->stanzas_sent++;
+    }
+  }
+  pending_.clear();
+  stats_->send_ns += talk_base::TimeNanos() - start;
+}
+
 int TinCanTask::ProcessStart() {
   const buzz::XmlElement* stanza = NextStanza();
   if (stanza == NULL) {
@@ -105,24 +179,51 @@ int TinCanTask::ProcessStart() {
     std::string uid = stanza->Attr(buzz::QN_FROM);
     std::string uid_key = get_key(uid);
     // map each uid to a uid_key
-    g_uid_map[uid_key] = uid;
+    directory_->UpdateJid(uid_key, uid);
 
     const buzz::XmlElement* msg = stanza->FirstNamed(QN_TINCAN);
     if (msg != NULL) {
-      const buzz::XmlElement* xml_data = msg->FirstNamed(QN_TINCAN_DATA);
-      const buzz::XmlElement* xml_type = msg->FirstNamed(QN_TINCAN_TYPE);
-      std::string data, type;
-      if (xml_data != NULL) {
-        data = xml_data->BodyText();
-      }
-      if (xml_data != NULL) {
-        type= xml_type->BodyText();
+      uint64 start = talk_base::TimeNanos();
+      if (msg->Attr(QN_TINCAN_VERSION) == kBatchVersion) {
+        batch_peers_.insert(uid);
       }
-      handler_->DoHandlePeer(uid_key, data, type);
+      if (msg->HasAttr(QN_TINCAN_ZLIB)) zlib_peers_.insert(uid);
+      stats_->stanzas_received++;
+      // every data element is followed by its type, older peers send
+      // exactly one pair
+      const buzz::XmlElement* xml_data = msg->FirstNamed(QN_TINCAN_DATA);
+      do {
+        const buzz::XmlElement* xml_type = xml_data != NULL ?
+            xml_data->NextNamed(QN_TINCAN_TYPE) :
+            msg->FirstNamed(QN_TINCAN_TYPE);
+        std::string data, type;
+        bool valid = true;
+        if (xml_data != NULL) {
+          data = xml_data->BodyText();
+          if (xml_data->Attr(QN_TINCAN_ENC) == kZlibEncoding) {
+            valid = DecompressBody(xml_data->BodyText(), &data);
+          }
+        }
+        if (xml_type != NULL) {
+          type= xml_type->BodyText();
+        }
+        stats_->messages_received++;
+        if (valid) {
+          handler_->DoHandlePeer(uid_key, data, type);
+        }
+        else {
+          LOG_TS(LERROR) << "XMPP bad compressed data from " << uid;
+        }
+        if (xml_data != NULL) xml_data = xml_data->NextNamed(QN_TINCAN_DATA);
+      } while (xml_data != NULL);
+      stats_->receive_ns += talk_base::TimeNanos() - start;
+    }
+    else if (stanza->Attr(buzz::QN_TYPE) == buzz::STR_UNAVAILABLE) {
+      directory_->RemovePresence(uid_key);
     }
     else {
       // Assuming this is a presence message therefore update time
-      handler_->SetTime(uid_key, talk_base::Time());
+      directory_->UpdatePresence(uid_key, talk_base::Time());
     }
   }
   return STATE_START;
@@ -139,10 +240,12 @@ bool TinCanTask::HandleStanza(const buzz::XmlElement* stanza) {
 }
 
 bool XmppNetwork::Login(std::string username, std::string password,
-                        std::string pcid, std::string host, int port) {
+                        std::string pcid, std::string host, int port,
+                        bool stream_management) {
   if (pump_.get() || username.empty() || password.empty() || 
       pcid.empty() || host.empty()) return false;
 
+  stream_management_ = stream_management;
   talk_base::InsecureCryptStringImpl pass;
   pass.password() = password;
   std::string resource(kXmppPrefix);
@@ -163,8 +266,8 @@ bool XmppNetwork::Connect() {
   xmpp_socket_->SignalCloseEvent.connect(this, &XmppNetwork::OnCloseEvent);
 
   pump_.reset(new buzz::XmppPump());
-  pump_->client()->SignalLogInput.connect(this, &XmppNetwork::OnLogging);
-  pump_->client()->SignalLogOutput.connect(this, &XmppNetwork::OnLogging);
+  pump_->client()->SignalLogInput.connect(this, &XmppNetwork::OnLogInput);
+  pump_->client()->SignalLogOutput.connect(this, &XmppNetwork::OnLogOutput);
   pump_->client()->SignalStateChange.connect(this, 
       &XmppNetwork::OnStateChange);
   pump_->client()->SignalDisconnected.connect(this,
@@ -174,7 +277,11 @@ bool XmppNetwork::Connect() {
   pump_->DoLogin(xcs_, xmpp_socket_.get(), 0);
   LOG_TS(INFO) << "XMPP CONNECTING";
   main_thread_->Clear(this);
-  main_thread_->PostDelayed(kInterval, this, 0, 0);
+  flush_scheduled_ = false;
+  reconnect_scheduled_ = false;
+  sm_.Stop();
+  sm_.ClearFeatures();
+  main_thread_->PostDelayed(kInterval, this, MSG_CHECKSTATE, 0);
   on_msg_counter_ = 0;
   return true;
 }
@@ -189,7 +296,10 @@ void XmppNetwork::OnSignOn() {
 
   presence_out_.reset(new buzz::PresenceOutTask(pump_->client()));
 
-  tincan_task_.reset(new TinCanTask(pump_->client(), this));
+  tincan_task_.reset(new TinCanTask(pump_->client(), this,
+                                    &signaling_stats_,
+                                    stream_management_ ? &sm_ : NULL,
+                                    &directory_));
 
   ping_task_.reset(new buzz::PingTask(pump_->client(), main_thread_,
                                       kPingPeriod, kPingTimeout));
@@ -199,6 +309,15 @@ void XmppNetwork::OnSignOn() {
   presence_out_->Start();
   ping_task_->Start();
   tincan_task_->Start();
+  if (stream_management_) {
+    // enabled from the message loop so that the output of the client is
+    // flushed after each stanza and the counters stay exact
+    sm_task_.reset(new StreamManagementTask(pump_->client(), &sm_));
+    sm_task_->SignalEnabled.connect(this,
+        &XmppNetwork::OnStreamManagementEnabled);
+    sm_task_->Start();
+    main_thread_->Post(this, MSG_ENABLESM);
+  }
   LOG_TS(INFO) << "XMPP ONLINE " << pump_->client()->jid().Str();
 }
 
@@ -213,23 +332,125 @@ void XmppNetwork::OnStateChange(buzz::XmppEngine::State state) {
       break;
     case buzz::XmppEngine::STATE_OPEN:
       LOG_TS(INFO) << "OPEN";
+      open_time_ = talk_base::Time();
       OnSignOn();
       break;
     case buzz::XmppEngine::STATE_CLOSED:
       LOG_TS(INFO) << "CLOSED";
+      sm_.Stop();
+      ScheduleReconnect();
       break;
   }
 }
 
 void XmppNetwork::OnCloseEvent(int error) {
   LOG_TS(INFO) << "ONCLOSEEVENT " << error;
+  ScheduleReconnect();
+}
+
+void XmppNetwork::OnStreamManagementEnabled() {
+  // replayed from the message loop for the same reason as the enable
+  main_thread_->Post(this, MSG_REPLAY);
 }
 
 void XmppNetwork::OnTimeout() {
   LOG_TS(INFO) << "ONTIMEOUT";
+  // the server stopped answering pings, the socket may take much longer
+  // to notice. Disconnecting is left to the message loop because this is
+  // called from inside the client.
+  main_thread_->Post(this, MSG_DISCONNECT);
+}
+
+void XmppNetwork::Reconnect() {
+  xmpp_socket_.release();
+  presence_out_.release();
+  tincan_task_.release();
+  ping_task_.release();
+  sm_task_.release();
+  //pump_.release();
+  Connect();
+}
+
+void XmppNetwork::ScheduleReconnect() {
+  if (reconnect_scheduled_) return;
+  reconnect_scheduled_ = true;
+  if (open_time_ != 0 && talk_base::TimeSince(open_time_) >=
+      static_cast<int32>(kStableStreamTime)) {
+    reconnect_attempts_ = 0;
+  }
+  open_time_ = 0;
+  int delay = std::min(kMinReconnectDelay <<
+                       std::min(reconnect_attempts_, kMaxBackoffShift),
+                       kMaxReconnectDelay);
+  // jitter keeps nodes that lost the same server from coming back at once
+  delay = delay / 2 + talk_base::CreateRandomId() % (delay / 2 + 1);
+  reconnect_attempts_++;
+  LOG_TS(INFO) << "XMPP RECONNECT in " << delay << " ms";
+  main_thread_->PostDelayed(delay, this, MSG_RECONNECT, 0);
+}
+
+void XmppNetwork::SendToPeer(int overlay_id, const std::string& uid,
+                             const std::string& data,
+                             const std::string& type) {
+  if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN && tincan_task_.get()) {
+    tincan_task_->SendToPeer(overlay_id, uid, data, type);
+    if (!flush_scheduled_) {
+      flush_scheduled_ = true;
+      main_thread_->PostDelayed(kBatchDelay, this, MSG_FLUSH, 0);
+    }
+  }
+}
+
+Json::Value XmppNetwork::GetSignalingStats(bool reset) {
+  Json::Value stats(Json::objectValue);
+  stats["messages_sent"] = signaling_stats_.messages_sent;
+  stats["stanzas_sent"] = signaling_stats_.stanzas_sent;
+  stats["messages_received"] = signaling_stats_.messages_received;
+  stats["stanzas_received"] = signaling_stats_.stanzas_received;
+  stats["compressed"] = signaling_stats_.compressed;
+  stats["data_bytes"] =
+      static_cast<uint32>(signaling_stats_.data_bytes);
+  stats["data_bytes_sent"] =
+      static_cast<uint32>(signaling_stats_.data_bytes_sent);
+  stats["send_us"] =
+      static_cast<uint32>(signaling_stats_.send_ns / 1000);
+  stats["receive_us"] =
+      static_cast<uint32>(signaling_stats_.receive_ns / 1000);
+  if (reset) signaling_stats_ = SignalingStats();
+  return stats;
 }
 
 void XmppNetwork::OnMessage(talk_base::Message* msg) {
+  switch (msg->message_id) {
+    case MSG_FLUSH:
+      flush_scheduled_ = false;
+      if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN && tincan_task_.get()) {
+        tincan_task_->Flush();
+        if (sm_task_.get() && sm_.unacked() > 0) sm_task_->RequestAck();
+      }
+      return;
+    case MSG_ENABLESM:
+      if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN && sm_task_.get()) {
+        sm_task_->Enable();
+      }
+      return;
+    case MSG_REPLAY:
+      if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN && sm_task_.get()) {
+        sm_task_->Replay();
+      }
+      return;
+    case MSG_RECONNECT:
+      reconnect_scheduled_ = false;
+      if (pump_.get() && xmpp_state_ == buzz::XmppEngine::STATE_CLOSED) {
+        Reconnect();
+      }
+      return;
+    case MSG_DISCONNECT:
+      if (pump_.get() && xmpp_state_ != buzz::XmppEngine::STATE_CLOSED) {
+        pump_->DoDisconnect();
+      }
+      return;
+  }
   if (pump_.get()) {
     if (xmpp_state_ == buzz::XmppEngine::STATE_START ||
         xmpp_state_ == buzz::XmppEngine::STATE_OPENING) {
@@ -243,13 +464,9 @@ void XmppNetwork::OnMessage(talk_base::Message* msg) {
       xmpp_socket_.release();
       Connect();
     }
-    else if (xmpp_state_ == buzz::XmppEngine::STATE_CLOSED) {
-      xmpp_socket_.release();
-      presence_out_.release();
-      tincan_task_.release();
-      ping_task_.release();
-      //pump_.release();
-      Connect();
+    else if (xmpp_state_ == buzz::XmppEngine::STATE_CLOSED &&
+             !reconnect_scheduled_) {
+      Reconnect();
     }
     else if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN &&
              on_msg_counter_ % kPresenceInterval == 0) {
@@ -261,7 +478,7 @@ void XmppNetwork::OnMessage(talk_base::Message* msg) {
     }
 
   }
-  main_thread_->PostDelayed(kInterval, this, 0, 0);
+  main_thread_->PostDelayed(kInterval, this, MSG_CHECKSTATE, 0);
   on_msg_counter_ += kInterval/1000;
 }
 
@@ -25,6 +25,12 @@
 #define TINCAN_XMPPNETWORK_H_
 #pragma once
 
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "talk/xmpp/xmpptask.h"
 #include "talk/xmpp/xmppengine.h"
 #include "talk/xmpp/presencestatus.h"
@@ -34,9 +40,12 @@
 #include "talk/xmpp/xmppclient.h"
 #include "talk/xmpp/xmpppump.h"
 #include "talk/base/logging.h"
+#include "talk/base/json.h"
 
 #include "tincanxmppsocket.h"
+#include "peerdirectory.h"
 #include "peersignalsender.h"
+#include "streammanagement.h"
 #include "tincan_utils.h"
 
 namespace tincan {
@@ -48,24 +57,64 @@ class PeerHandlerInterface {
  public:
   virtual void DoHandlePeer(std::string& uid, std::string& data, 
                             std::string& type) = 0;
-  virtual void SetTime(std::string& uid, uint32) = 0;
+};
+
+struct SignalingStats {
+  SignalingStats()
+      : messages_sent(0), stanzas_sent(0), messages_received(0),
+        stanzas_received(0), compressed(0), data_bytes(0),
+        data_bytes_sent(0), send_ns(0), receive_ns(0) {}
+  uint32 messages_sent;
+  uint32 stanzas_sent;
+  uint32 messages_received;
+  uint32 stanzas_received;
+  // data bodies before and after compression
+  uint32 compressed;
+  uint64 data_bytes;
+  uint64 data_bytes_sent;
+  // time spent building and parsing stanzas
+  uint64 send_ns;
+  uint64 receive_ns;
 };
 
 class TinCanTask
     :  public buzz::XmppTask {
  public:
+  // stanzas are tracked by sm until the server acknowledges them, sm is
+  // NULL when stream management is off
   explicit TinCanTask(buzz::XmppClient* client,
-                      PeerHandlerInterface* handler);
+                      PeerHandlerInterface* handler,
+                      SignalingStats* stats,
+                      StreamManagement* sm,
+                      PeerDirectory* directory);
 
+  // queues the message, it is sent by the next Flush
   virtual void SendToPeer(int overlay_id, const std::string& uid,
                           const std::string& data, const std::string& type);
 
+  // sends the queued messages, one stanza per peer when the peer is
+  // known to unpack batches and one stanza per message otherwise
+  void Flush();
+
  protected:
   virtual int ProcessStart();
   virtual bool HandleStanza(const buzz::XmlElement* stanza);
 
  private:
+  typedef std::vector<std::pair<std::string, std::string> > MessageList;
+
   PeerHandlerInterface* handler_;
+  SignalingStats* stats_;
+  StreamManagement* sm_;
+  PeerDirectory* directory_;
+  // the query element every stanza is copied from
+  talk_base::scoped_ptr<buzz::XmlElement> query_proto_;
+  // full jid to data and type of the messages waiting for Flush
+  std::map<std::string, MessageList> pending_;
+  // full jids that sent us a batch capable query
+  std::set<std::string> batch_peers_;
+  // full jids that inflate compressed data bodies
+  std::set<std::string> zlib_peers_;
 };
 
 class XmppNetwork 
@@ -75,7 +124,9 @@ class XmppNetwork
       public sigslot::has_slots<> {
  public:
   explicit XmppNetwork(talk_base::Thread* main_thread) 
-      : main_thread_(main_thread){};
+      : main_thread_(main_thread), flush_scheduled_(false),
+        stream_management_(false), reconnect_scheduled_(false),
+        reconnect_attempts_(0), open_time_(0) {};
 
   // Slot for message callbacks
   sigslot::signal3<const std::string&, const std::string&,
@@ -86,8 +137,10 @@ class XmppNetwork
     return uid_;
   }
 
-  virtual const std::map<std::string, uint32> friends() {
-    return presence_time_;
+  // jids and presence of every peer seen on XMPP, the connection manager
+  // adds the link state
+  PeerDirectory* directory() {
+    return &directory_;
   }
 
   // inherited from PeerHandler
@@ -95,33 +148,49 @@ class XmppNetwork
                             std::string& type) {
     HandlePeer(uid, data, type);
   }
-  
-  virtual void SetTime(std::string& uid, uint32 xmpp_time) {
-    presence_time_[uid] = xmpp_time;
-  }
 
+  // messages sent within kBatchDelay of each other share stanzas
   virtual void SendToPeer(int overlay_id, const std::string& uid,
-                          const std::string& data, const std::string& type) {
-    if (xmpp_state_ == buzz::XmppEngine::STATE_OPEN && tincan_task_.get()) {
-      tincan_task_->SendToPeer(overlay_id, uid, data, type);
-    }
-  }
+                          const std::string& data, const std::string& type);
 
   void OnLogging(const char* data, int len) {
     LOG_TS(LS_VERBOSE) << std::string(data, len);
   }
 
+  void OnLogInput(const char* data, int len) {
+    // the stream features arrive before the stream is open
+    if (xmpp_state_ != buzz::XmppEngine::STATE_OPEN) {
+      sm_.ScanFeatures(data, len);
+    }
+    OnLogging(data, len);
+  }
+
+  void OnLogOutput(const char* data, int len) {
+    sm_.CountOutput(data, len);
+    OnLogging(data, len);
+  }
+
   virtual void OnMessage(talk_base::Message* msg);
 
+  // with stream_management set the server is asked to acknowledge
+  // stanzas (XEP-0198) and signaling it did not acknowledge is sent again
+  // after a reconnect
   bool Login(std::string username, std::string password,
-             std::string pcid, std::string host, int port);
+             std::string pcid, std::string host, int port,
+             bool stream_management);
+
+  // messages and stanzas sent and received and the time spent on them
+  Json::Value GetSignalingStats(bool reset);
 
  private:
   bool Connect();
+  void Reconnect();
+  void ScheduleReconnect();
   void OnSignOn();
   void OnStateChange(buzz::XmppEngine::State state);
   void OnCloseEvent(int error);
   void OnTimeout();
+  void OnStreamManagementEnabled();
 
   talk_base::Thread* main_thread_;
   buzz::XmppClientSettings xcs_;
@@ -131,10 +200,19 @@ class XmppNetwork
   talk_base::scoped_ptr<buzz::PresenceOutTask> presence_out_;
   talk_base::scoped_ptr<buzz::PingTask> ping_task_;
   talk_base::scoped_ptr<TinCanTask> tincan_task_;
-  std::map<std::string, uint32> presence_time_;
+  PeerDirectory directory_;
   buzz::XmppEngine::State xmpp_state_;
   int on_msg_counter_;
   std::string uid_;
+  bool flush_scheduled_;
+  SignalingStats signaling_stats_;
+  bool stream_management_;
+  StreamManagement sm_;
+  talk_base::scoped_ptr<StreamManagementTask> sm_task_;
+  bool reconnect_scheduled_;
+  int reconnect_attempts_;
+  // when the stream last opened, 0 once it closed
+  uint32 open_time_;
 
 };
 